@@ -0,0 +1,105 @@
+/* arena.c */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t size;            /* of the data */
+    size_t used;
+};
+
+/* the strictest alignment of the basic types */
+typedef union ArenaAlign {
+    long l;
+    double d;
+    long double ld;
+    void *p;
+    void (*f) (void);
+} ArenaAlign;
+
+#define ARENA_ROUND(n) (((n) + sizeof (ArenaAlign)-1) / sizeof (ArenaAlign) * sizeof (ArenaAlign))
+#define ARENA_DATA(b)  ((char *)(b) + ARENA_ROUND (sizeof (ArenaBlock)))
+
+void *ArenaAlloc (Arena *a, size_t n)
+{
+    ArenaBlock *b, **pb;
+    size_t size;
+
+    n = ARENA_ROUND (n ? n : 1);
+
+    /* the next kept block that has room (the rest of a skipped one is
+       lost until the reset) */
+    for (b = a->cur; b != NULL && b->size - b->used < n; b = b->next);
+    if (b == NULL) {
+        size = n > (size_t)ARENA_BLOCKSIZE ? n : (size_t)ARENA_BLOCKSIZE;
+        b = malloc (ARENA_ROUND (sizeof (ArenaBlock)) + size);
+        if (b == NULL) return NULL;
+        b->next = NULL;
+        b->size = size;
+        b->used = 0;
+        for (pb = &a->first; *pb != NULL; pb = &(*pb)->next);
+        *pb = b;
+        ++a->nblocks;
+    }
+    a->cur = b;
+    b->used += n;
+    a->used += n;
+    if (a->used > a->peak) a->peak = a->used;
+    return ARENA_DATA (b) + b->used - n;
+}
+
+void *ArenaGrow (Arena *a, void *p, size_t old, size_t n)
+{
+    ArenaBlock *b, *nb, **pb;
+    void *q;
+
+    b = a->cur;
+    old = ARENA_ROUND (old ? old : 1);
+    n = ARENA_ROUND (n ? n : 1);
+    if (n <= old) return p;
+    if (b != NULL && (char *)p == ARENA_DATA (b) + b->used - old) {
+        if (b->size - b->used < n - old && b->used == old) {
+            /* the block has p only */
+            for (pb = &a->first; *pb != b; pb = &(*pb)->next);
+            nb = realloc (b, ARENA_ROUND (sizeof (ArenaBlock)) + n);
+            if (nb == NULL) return NULL;
+            nb->size = n;
+            *pb = a->cur = b = nb;
+            p = ARENA_DATA (b);
+        }
+        if (b->size - b->used >= n - old) {
+            b->used += n - old;
+            a->used += n - old;
+            if (a->used > a->peak) a->peak = a->used;
+            return p;
+        }
+    }
+    q = ArenaAlloc (a, n);
+    if (q != NULL) memcpy (q, p, old);
+    return q;
+}
+
+void ArenaReset (Arena *a)
+{
+    ArenaBlock *b;
+
+    for (b = a->first; b != NULL; b = b->next) b->used = 0;
+    a->cur = a->first;
+    a->used = 0;
+}
+
+void ArenaFree (Arena *a)
+{
+    ArenaBlock *b, *next;
+
+    for (b = a->first; b != NULL; b = next) {
+        next = b->next;
+        free (b);
+    }
+    a->first = a->cur = NULL;
+    a->used = a->peak = 0;
+    a->nblocks = 0;
+}
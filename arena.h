@@ -0,0 +1,31 @@
+/* arena.h */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* memory for the data of one file (or one request): given out in order,
+   and taken back all at once by ArenaReset; the blocks are kept for the
+   next file, so converting many files of similar size doesn't call
+   malloc after the first ones. A zeroed Arena is empty. */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *first;      /* the blocks, in the order of use */
+    ArenaBlock *cur;        /* the block being given out */
+    size_t used;            /* bytes given out since the last reset */
+    size_t peak;            /* the most ever given out */
+    unsigned long nblocks;  /* blocks allocated (malloc calls) */
+} Arena;
+
+#define ARENA_BLOCKSIZE (64*1024L)
+
+void *ArenaAlloc (Arena *a, size_t n);  /* NULL if out of memory */
+/* p (old bytes) made n bytes: in place if it is the last one given out
+   (its block is made bigger if it has nothing else), else copied */
+void *ArenaGrow  (Arena *a, void *p, size_t old, size_t n);
+void  ArenaReset (Arena *a);
+void  ArenaFree  (Arena *a);
+
+#endif
@@ -0,0 +1,109 @@
+#!/bin/sh
+# bench-wav.sh: decode-accuracy and throughput of wavread
+#
+# usage: sh bench-wav.sh <file.cas> [seeds]
+#
+# The CAS-file is put onto a synthetic tape four times (wavgen), with
+# each of the impairments below, and decoded by each engine of wavread.
+# Reported per impairment and engine: samples/s (decode only), the
+# rate of the wrong or missing bytes and sectors, and the programs
+# decoded without any error.
+
+CAS=${1:?usage: sh bench-wav.sh <file.cas> [seeds]}
+SEEDS=${2:-2}
+WAVGEN=${WAVGEN:-$PWD/wavgen}
+WAVREAD=${WAVREAD:-$PWD/wavread}
+NPROG=4
+
+# wavread options common to all engines
+COMMON="-recover -stats"
+
+IMPAIRMENTS="
+clean|
+snr30|-snr=30
+snr24|-snr=24
+snr20|-snr=20
+rate22050|-rate=22050
+speed+4%|-speed=1.04
+drift5%/min|-drift=0.05
+wow0.5%|-wow=0.005
+flutter0.3%|-flutter=0.003
+dc20|-dc=20
+dropouts|-dropouts=2 -droplen=1
+invert|-invert
+mixed|-snr=26 -wow=0.003 -flutter=0.002 -dc=10 -dropouts=1
+"
+
+# the bit-engines: the default decoder as shipped (no DC-tracking, no
+# dead-band), then with DC-tracking and a narrow and a wide dead-band
+ENGINES="
+default|
+zero-crossing|-dc -band=4
+interp|-dc -interp -band=4
+interp/band16|-dc -interp -band=16
+matched/band16|-dc -matched -interp -band=16
+"
+
+TMP=${TMPDIR:-/tmp}/bench-wav.$$
+trap 'rm -rf "$TMP"' 0 1 2 15
+mkdir -p "$TMP/in" "$TMP/out" || exit 1
+
+i=1
+while [ $i -le $NPROG ]; do
+    cp "$CAS" "$TMP/in/P$i.cas" || exit 1
+    i=$((i+1))
+done
+SIZE=$(wc -c < "$CAS")
+
+printf '%-14s %-14s %12s %10s %10s %8s\n' \
+    impairment engine samples/s byte-err sect-err ok-progs
+
+echo "$IMPAIRMENTS" | while IFS='|' read -r iname iopts; do
+    [ -n "$iname" ] || continue
+    echo "$ENGINES" | while IFS='|' read -r ename eopts; do
+        [ -n "$ename" ] || continue
+        seed=1
+        while [ $seed -le $SEEDS ]; do
+            # shellcheck disable=SC2086
+            "$WAVGEN" -seed=$seed $iopts "$TMP/t.wav" "$TMP"/in/P*.cas || exit 1
+            rm -f "$TMP"/out/*
+            # shellcheck disable=SC2086
+            (cd "$TMP/out" && "$WAVREAD" $COMMON $eopts "$TMP/t.wav" \
+                > /dev/null 2> "$TMP/log")
+            sed -n 's/^stats: samples=.* samples\/s=\([0-9]*\)$/rate \1/p' "$TMP/log"
+            i=1
+            while [ $i -le $NPROG ]; do
+                if [ -f "$TMP/out/P$i.cas" ]; then
+                    echo "size $(wc -c < "$TMP/out/P$i.cas")"
+                    cmp -l -i 128 "$TMP/out/P$i.cas" "$CAS" 2>/dev/null |
+                        sed 's/^ *\([0-9]*\) .*/diff \1/'
+                else
+                    echo "size 0"
+                fi
+                echo "prog"
+                i=$((i+1))
+            done
+            seed=$((seed+1))
+        done | awk -v size="$SIZE" -v iname="$iname" -v ename="$ename" '
+            # offsets after the CPMHDR: 1..16 is the header-sector, then sectors of 256
+            function sect(off) { return off <= 16 ? 0 : int ((off-17)/256)+1 }
+            BEGIN { data= size-128; nsect= 1+int((size-144+255)/256) }
+            $1=="rate" { rate += $2; nrate++ }
+            $1=="size" { got= $2 ? $2-128 : 0; split ("", bad); nbad= 0 }
+            $1=="diff" { d++; if (!(sect($2) in bad)) { bad[sect($2)]; nbad++ } }
+            $1=="prog" {
+                # missing bytes at the end (or the whole file)
+                if (got < data) {
+                    d += data-got
+                    for (o= got+1; o<=data; ++o) if (!(sect(o) in bad)) { bad[sect(o)]; nbad++ }
+                }
+                bytes += data; db += d; d= 0
+                sects += nsect; ds += nbad
+                progs++; if (nbad==0) okp++
+            }
+            END {
+                printf "%-14s %-14s %12.0f %10.2e %10.2e %4d/%-3d\n", iname, ename,
+                    nrate ? rate/nrate : 0, db/bytes, ds/sects, okp, progs
+            }'
+    done
+done
@@ -0,0 +1,542 @@
+/* casarc.c */
+
+/* deduplicating archive of CAS-files: a file is cut into records, the
+   CASHDR, the BASLINE-s of the program one by one, then the rest (the
+   program end and the BYTES-payload) in pieces cut where the content
+   says (so an insertion moves only the cuts near it). Each different
+   record is stored once, the files are lists of records; extracting
+   puts the records after each other, giving back the file byte for byte.
+
+   archive (the numbers are little endian, 4 bytes):
+     header   magic "CASARC1\0", nfiles, nrecs, nrefs, namesize, datasize,
+              offset of files, recs, refs, names, data
+     files    nfiles * (offset of the name, first ref, number of refs, size)
+     recs     nrecs * (offset in data, length)
+     refs     nrefs * (record)
+     names    the names, '\0'-terminated
+     data     the records */
+
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
+#endif
+
+#include "tvc.h"
+#include "casfile.h"
+
+#define ARC_MAGIC   "CASARC1"
+#define ARC_HDRSIZE 48
+
+/* the pieces of the rest: 64..1024 bytes, cut where the rolling hash
+   has its low 8 bits zero (256 bytes on the average) */
+#define CHUNK_MIN  64
+#define CHUNK_MAX  1024
+#define CHUNK_MASK 0xffUL
+
+static struct {
+    const char *progname;
+    const char *create;     /* -create=ARCHIVE */
+    const char *extract;    /* -extract=DIR */
+    int list;
+    int verbose;
+} opt = {
+    NULL, NULL, NULL, 0, 0
+};
+
+/* creating */
+typedef struct Rec {
+    unsigned long off, len;     /* in C.data */
+    unsigned long long hash;
+} Rec;
+
+typedef struct ArcFile {
+    char *name;
+    unsigned long ref, nref, size;
+} ArcFile;
+
+static struct {
+    ArcFile *files;
+    unsigned long nfiles, maxfiles;
+    Rec *recs;
+    unsigned long nrecs, maxrecs;
+    unsigned long *refs;
+    unsigned long nrefs, maxrefs;
+    unsigned char *data;
+    unsigned long datasize, maxdata;
+    unsigned long *hash;        /* open addressing, record+1 (0: empty) */
+    unsigned long hashsize;
+    unsigned long insize;
+    unsigned long gear [256];
+} C;
+
+/* reading */
+typedef struct Archive {
+    const unsigned char *map;
+    size_t size;
+    unsigned long nfiles, nrecs, nrefs;
+    const unsigned char *files, *recs, *refs, *data;
+    const char *names;
+    unsigned long namesize, datasize;
+} Archive;
+
+static void ParseArgs (int *pargc, char ***pargv);
+
+static void Create (int n, char **paths);
+static void AddCas (const char *name);
+static void WriteArchive (const char *name);
+
+static void OpenArchive (Archive *a, const char *name);
+static void List (const Archive *a);
+static int Extract (const Archive *a, int n, char **names);
+
+int main (int argc, char **argv)
+{
+    Archive a;
+
+    ParseArgs (&argc, &argv);
+    if (opt.create && argc>=2) {
+        Create (argc-1, argv+1);
+        return 0;
+    }
+    if (opt.create || argc<2 || (!opt.list && !opt.extract)) {
+        fprintf (stderr, "usage: casarc -create=<archive> <file.cas>|<dir>...\n"
+            "       casarc -list <archive>\n"
+            "       casarc -extract=<dir> <archive> [<name>...]\n"
+            "options: -v\n");
+        exit (8);
+    }
+    OpenArchive (&a, argv[1]);
+    if (opt.list) List (&a);
+    if (opt.extract) return Extract (&a, argc-2, argv+2);
+    return 0;
+}
+
+/* ---------------------------------------------------------------- create */
+
+static void Create (int n, char **paths)
+{
+    unsigned long x;
+    int i;
+
+    for (x= 0x2545f491UL, i=0; i<256; ++i) {    /* xorshift32 */
+        x ^= x << 13;
+        x &= 0xffffffffUL;
+        x ^= x >> 17;
+        x ^= x << 5;
+        x &= 0xffffffffUL;
+        C.gear[i]= x;
+    }
+    for (i=0; i<n; ++i) {
+        AddPath (paths[i], 1, AddCas);
+    }
+    WriteArchive (opt.create);
+}
+
+static void HashGrow (void)
+{
+    unsigned long i, h, size;
+
+    free (C.hash);
+    size= C.hashsize ? 2*C.hashsize : 4096;
+    C.hash= emalloc (size * sizeof *C.hash);
+    memset (C.hash, 0, size * sizeof *C.hash);
+    C.hashsize= size;
+    for (i=0; i<C.nrecs; ++i) {
+        for (h= C.recs[i].hash & (size-1); C.hash[h]; h= (h+1) & (size-1));
+        C.hash[h]= i+1;
+    }
+}
+
+/* the record with this content (a new one if there isn't), to the file */
+static void AddRec (const unsigned char *p, unsigned long len)
+{
+    unsigned long long hash;
+    unsigned long h, r;
+    Rec *rc;
+
+    if (2*(C.nrecs+1) > C.hashsize) HashGrow ();
+    hash= FnvHash (p, len);
+    for (h= hash & (C.hashsize-1); (r= C.hash[h]) != 0; h= (h+1) & (C.hashsize-1)) {
+        rc= &C.recs [r-1];
+        if (rc->hash==hash && rc->len==len && memcmp (C.data+rc->off, p, len)==0) break;
+    }
+    if (r==0) {
+        if (C.nrecs == C.maxrecs) {
+            C.maxrecs= C.maxrecs ? 2*C.maxrecs : 4096;
+            C.recs= erealloc (C.recs, C.maxrecs * sizeof *C.recs);
+        }
+        while (C.datasize + len > C.maxdata) {
+            C.maxdata= C.maxdata ? 2*C.maxdata : 65536;
+            C.data= erealloc (C.data, C.maxdata);
+        }
+        rc= &C.recs [C.nrecs];
+        rc->off= C.datasize;
+        rc->len= len;
+        rc->hash= hash;
+        memcpy (C.data+C.datasize, p, len);
+        C.datasize += len;
+        r= ++C.nrecs;
+        C.hash[h]= r;
+    }
+    if (C.nrefs == C.maxrefs) {
+        C.maxrefs= C.maxrefs ? 2*C.maxrefs : 16384;
+        C.refs= erealloc (C.refs, C.maxrefs * sizeof *C.refs);
+    }
+    C.refs [C.nrefs++]= r-1;
+}
+
+/* the rest in pieces: a cut after a byte where the gear-hash says so */
+static void AddChunks (const unsigned char *p, unsigned long len)
+{
+    unsigned long i, h;
+
+    while (len > 0) {
+        for (i=0, h=0; i<len && i<CHUNK_MAX; ++i) {
+            h= ((h << 1) + C.gear [p[i]]) & 0xffffffffUL;
+            if (i+1 >= CHUNK_MIN && (h & CHUNK_MASK)==0) {
+                ++i;
+                break;
+            }
+        }
+        AddRec (p, i);
+        p += i;
+        len -= i;
+    }
+}
+
+static void AddCas (const char *name)
+{
+    unsigned char *buf;
+    const unsigned char *p, *prgend, *end;
+    const CASHDR *ch;
+    CasLine l;
+    ArcFile *af;
+    long size;
+    FILE *f;
+
+    f= efopen (name, "rb");
+    fseek (f, 0, SEEK_END);
+    size= ftell (f);
+    fseek (f, 0, SEEK_SET);
+    if (size<0 || size > 0x7fffffffL) {
+        fprintf (stderr, "%s: can't tell the size, skipped\n", name);
+        fclose (f);
+        return;
+    }
+    buf= emalloc (size ? size : 1);
+    if (fread (buf, 1, size, f) != (size_t)size) {
+        fprintf (stderr, "%s: read error\n", name);
+        exit (32);
+    }
+    fclose (f);
+
+    if (C.nfiles == C.maxfiles) {
+        C.maxfiles= C.maxfiles ? 2*C.maxfiles : 256;
+        C.files= erealloc (C.files, C.maxfiles * sizeof *C.files);
+    }
+    af= &C.files [C.nfiles++];
+    while (name[0]=='.' && name[1]=='/') name += 2;
+    while (name[0]=='/') ++name;
+    af->name= strcpy (emalloc (strlen (name)+1), name);
+    af->ref= C.nrefs;
+    af->size= size;
+    C.insize += size;
+
+    end= buf+size;
+    p= buf;
+    ch= (const CASHDR *)buf;
+    if ((unsigned long)size >= sizeof (CASHDR) &&
+        ch->cph.magic==CPMHDR_MAGIC && ch->pfh.magic==PRGFILE_MAGIC) {
+        AddRec (p, sizeof (CASHDR));
+        p += sizeof (CASHDR);
+        prgend= p + PEEK2 (ch->pfh.prgsize);
+        if (prgend > end) prgend= end;
+        /* the lines, while they are lines */
+        while (NextLine (&p, prgend, &l) > 0) {
+            AddRec (l.line, l.next - l.line);
+        }
+    } else if (opt.verbose) {
+        fprintf (stderr, "%s: not a CAS-file, stored in pieces\n", name);
+    }
+    AddChunks (p, end-p);
+    af->nref= C.nrefs - af->ref;
+    if (opt.verbose) {
+        fprintf (stderr, "%s: %ld bytes, %lu records\n", name, size, af->nref);
+    }
+    free (buf);
+}
+
+static void Put4 (FILE *g, unsigned long v)
+{
+    unsigned char b [4];
+
+    POKE4 (b, v);
+    fwrite (b, 1, 4, g);
+}
+
+static void WriteArchive (const char *name)
+{
+    unsigned long i, namesize, pos, offfiles, offrecs, offrefs, offnames, offdata, total;
+    FILE *g;
+
+    for (i=0, namesize=0; i<C.nfiles; ++i) namesize += strlen (C.files[i].name)+1;
+    offfiles= ARC_HDRSIZE;
+    offrecs= offfiles + 16*C.nfiles;
+    offrefs= offrecs + 8*C.nrecs;
+    offnames= offrefs + 4*C.nrefs;
+    offdata= offnames + namesize;
+    total= offdata + C.datasize;
+    if ((double)offdata + C.datasize > 4294967295.0) {
+        fprintf (stderr, "The archive would be too large\n");
+        exit (16);
+    }
+
+    g= efopen (name, "wb");
+    fwrite (ARC_MAGIC, 1, 8, g);
+    Put4 (g, C.nfiles);
+    Put4 (g, C.nrecs);
+    Put4 (g, C.nrefs);
+    Put4 (g, namesize);
+    Put4 (g, C.datasize);
+    Put4 (g, offfiles);
+    Put4 (g, offrecs);
+    Put4 (g, offrefs);
+    Put4 (g, offnames);
+    Put4 (g, offdata);
+    for (i=0, pos=0; i<C.nfiles; ++i) {
+        Put4 (g, pos);
+        Put4 (g, C.files[i].ref);
+        Put4 (g, C.files[i].nref);
+        Put4 (g, C.files[i].size);
+        pos += strlen (C.files[i].name)+1;
+    }
+    for (i=0; i<C.nrecs; ++i) {
+        Put4 (g, C.recs[i].off);
+        Put4 (g, C.recs[i].len);
+    }
+    for (i=0; i<C.nrefs; ++i) Put4 (g, C.refs[i]);
+    for (i=0; i<C.nfiles; ++i) fwrite (C.files[i].name, 1, strlen (C.files[i].name)+1, g);
+    fwrite (C.data, 1, C.datasize, g);
+    if (fclose (g)) {
+        fprintf (stderr, "Error writing '%s", name);
+        perror ("'");
+        exit (32);
+    }
+    fprintf (stderr, "%s: %lu files, %lu bytes -> %lu bytes (%.1fx), "
+        "%lu records, %lu different\n",
+        name, C.nfiles, C.insize, total, total ? (double)C.insize/total : 0.0,
+        C.nrefs, C.nrecs);
+}
+
+/* ---------------------------------------------------------------- read */
+
+static void OpenArchive (Archive *a, const char *name)
+{
+    struct stat st;
+    const unsigned char *m;
+    unsigned long i, offfiles, offrecs, offrefs, offnames, offdata, ref, nref;
+    int fd;
+
+    fd= open (name, O_RDONLY);
+    if (fd<0 || fstat (fd, &st)) {
+        fprintf (stderr, "Error opening file '%s", name);
+        perror ("'");
+        exit (32);
+    }
+    a->size= st.st_size;
+    if (a->size < ARC_HDRSIZE) goto BAD;
+    a->map= mmap (NULL, a->size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (a->map==MAP_FAILED) {
+        perror ("mmap");
+        exit (32);
+    }
+    m= a->map;
+    if (memcmp (m, ARC_MAGIC, 8)) goto BAD;
+    a->nfiles= PEEK4 (m+8);
+    a->nrecs= PEEK4 (m+12);
+    a->nrefs= PEEK4 (m+16);
+    a->namesize= PEEK4 (m+20);
+    a->datasize= PEEK4 (m+24);
+    offfiles= PEEK4 (m+28);
+    offrecs= PEEK4 (m+32);
+    offrefs= PEEK4 (m+36);
+    offnames= PEEK4 (m+40);
+    offdata= PEEK4 (m+44);
+    if (offfiles + 16*a->nfiles > a->size || offrecs + 8*a->nrecs > a->size ||
+        offrefs + 4*a->nrefs > a->size || offnames + a->namesize > a->size ||
+        offdata + a->datasize != a->size ||
+        (a->namesize && m [offnames + a->namesize-1] != '\0')) goto BAD;
+    a->files= m + offfiles;
+    a->recs= m + offrecs;
+    a->refs= m + offrefs;
+    a->names= (const char *)m + offnames;
+    a->data= m + offdata;
+
+    /* everything is checked here, so the extraction needn't */
+    for (i=0; i<a->nrecs; ++i) {
+        if (PEEK4 (a->recs + 8*i) + PEEK4 (a->recs + 8*i + 4) > a->datasize) goto BAD;
+    }
+    for (i=0; i<a->nrefs; ++i) {
+        if (PEEK4 (a->refs + 4*i) >= a->nrecs) goto BAD;
+    }
+    for (i=0; i<a->nfiles; ++i) {
+        ref= PEEK4 (a->files + 16*i + 4);
+        nref= PEEK4 (a->files + 16*i + 8);
+        if (PEEK4 (a->files + 16*i) >= a->namesize || ref + nref > a->nrefs) goto BAD;
+    }
+    return;
+
+BAD:
+    fprintf (stderr, "%s: not an archive made by casarc\n", name);
+    exit (16);
+}
+
+static const char *FileName (const Archive *a, unsigned long i)
+{
+    return a->names + PEEK4 (a->files + 16*i);
+}
+
+static void List (const Archive *a)
+{
+    unsigned long i;
+
+    for (i=0; i<a->nfiles; ++i) {
+        printf ("%8lu %6lu %s\n", PEEK4 (a->files + 16*i + 12),
+                PEEK4 (a->files + 16*i + 8), FileName (a, i));
+    }
+}
+
+/* the directories on the way to the file */
+static void MkDirs (char *path)
+{
+    char *p;
+
+    for (p= strchr (path, '/'); p; p= strchr (p+1, '/')) {
+        if (p==path) continue;          /* the root */
+        *p= '\0';
+        if (mkdir (path, 0777) && errno != EEXIST) {
+            fprintf (stderr, "Error making directory '%s", path);
+            perror ("'");
+            exit (32);
+        }
+        *p= '/';
+    }
+}
+
+static void ExtractFile (const Archive *a, unsigned long i)
+{
+    const char *name= FileName (a, i);
+    unsigned long ref, nref, k, rec, size;
+    char *path;
+    FILE *g;
+
+    if (strstr (name, "..")) {
+        fprintf (stderr, "%s: not extracted (..)\n", name);
+        return;
+    }
+    path= emalloc (strlen (opt.extract)+1+strlen (name)+1);
+    sprintf (path, "%s/%s", opt.extract, name);
+    MkDirs (path);
+    g= efopen (path, "wb");
+    ref= PEEK4 (a->files + 16*i + 4);
+    nref= PEEK4 (a->files + 16*i + 8);
+    for (k=0, size=0; k<nref; ++k) {
+        rec= PEEK4 (a->refs + 4*(ref+k));
+        fwrite (a->data + PEEK4 (a->recs + 8*rec), 1, PEEK4 (a->recs + 8*rec + 4), g);
+        size += PEEK4 (a->recs + 8*rec + 4);
+    }
+    if (fclose (g) || size != PEEK4 (a->files + 16*i + 12)) {
+        fprintf (stderr, "Error writing '%s'\n", path);
+        exit (32);
+    }
+    if (opt.verbose) fprintf (stderr, "%s\n", path);
+    free (path);
+}
+
+/* all the files, or the ones named */
+static int Extract (const Archive *a, int n, char **names)
+{
+    unsigned long i;
+    int k, rc;
+
+    if (n==0) {
+        for (i=0; i<a->nfiles; ++i) ExtractFile (a, i);
+        return 0;
+    }
+    for (rc=0, k=0; k<n; ++k) {
+        for (i=0; i<a->nfiles && strcmp (FileName (a, i), names[k]); ++i);
+        if (i<a->nfiles) {
+            ExtractFile (a, i);
+        } else {
+            fprintf (stderr, "%s: not in the archive\n", names[k]);
+            rc= 1;
+        }
+    }
+    return rc;
+}
+
+/* ---------------------------------------------------------------- misc */
+
+static void ParseArgs (int *pargc, char ***pargv)
+{
+    int argc;
+    char **argv;
+    int parse_arg;
+    char *arg;
+
+    argc = *pargc;
+    argv = *pargv;
+    parse_arg = 1;
+    opt.progname = argv[0];
+
+    while (--argc && **++argv=='-' && parse_arg) {
+        arg= strchr (argv[0], '=');
+        arg= arg ? arg+1 : "";
+        switch (argv[0][1]) {
+        case 'c': case 'C':
+            if (strncasecmp (argv[0], "-create=", 8)==0) {
+                opt.create= arg;
+                break;
+            } goto UNKOPT;
+
+        case 'e': case 'E':
+            if (strncasecmp (argv[0], "-extract=", 9)==0) {
+                opt.extract= arg;
+                break;
+            } goto UNKOPT;
+
+        case 'l': case 'L':
+            if (strcasecmp (argv[0], "-list")==0) {
+                opt.list= 1;
+                break;
+            } goto UNKOPT;
+
+        case 'v': case 'V':
+            if (strcasecmp (argv[0], "-v")==0) {
+                opt.verbose= 1;
+                break;
+            } goto UNKOPT;
+
+        case 0: case '-': parse_arg = 0; break;
+        default:
+UNKOPT:
+            fprintf (stderr, "Unknown option '%s'\n", *argv);
+            exit (4);
+        }
+    }
+    ++argc;
+    *--argv = (char *)opt.progname;
+    *pargc = argc;
+    *pargv = argv;
+}
@@ -1,34 +1,68 @@
 /* casbas.c */
 
-#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "tvc.h"
+#include "arena.h"
 
 static struct {
     int debug;
     int overw;
+    const char *serve;  /* --serve: NULL = no, "" = stdin/stdout, else the socket */
+    int jobs;           /* --jobs: threads of the server, 0 = one per CPU */
+    int stats;          /* --stats: 0 = no, 1 = text, 2 = JSON (to stderr) */
+    int check;          /* --check: BAS-files, all the errors, no output */
+    int watch;          /* --watch: convert the changed files of a directory, WATCH_* */
+    int debounce;       /* --debounce: ms to wait for more events of a file */
+    int bin;            /* --bin: the bytes after the program into a .bin file */
+    int utf8;           /* --utf8: the BAS-files are UTF-8, not latin2 */
 } opt = {
-    0, 0
+    0, 0, NULL, 0, 0, 0, 0, 5, 0, 0
 };
 
 static void ParseArgs (int *pargc, char ***pargv);
 
 static FILE *efopen (const char *name, const char *mode);
 static void  efread (FILE *f, void *buff, size_t len);
-static void *emalloc (int n);
+static void *emalloc (size_t n);
+static void *egrow (void *p, size_t old, size_t n);
+static void  StreamBuf (FILE *f);
+static void  Fail (int code, const char *fmt, ...);
 
 static void GetHeaderData (const CASHDR *ch, CASHDR_DATA *cd);
 static void SetHeaderData (const CASHDR_DATA *cd, CASHDR *ch);
 
 static void Cas2Bas (FILE *f, FILE *g);
 static void Bas2Cas (FILE *f, FILE *g);
+static void Bas2CasMem (char *buf, size_t size, FILE *g);
+
+/* a BAS-file in memory: the lines are tokenized in place, so there are
+   sizeof (BASLINE) bytes before it and one byte after it to write to */
+#define BAS_BEFORE (sizeof (BASLINE))
+#define BAS_AFTER  1
 
 static const char *charmap[2][256];
 
+/* charmap with the accented letters in UTF-8 (--utf8), made by main */
+static const char *charmap_utf8[2][256];
+static void MakeUtf8Map (void);
+
 #define TYPE_CAS 1
 #define TYPE_BAS 2
 
@@ -40,24 +74,121 @@ static struct {
     int itype;
 } var;
 
+/* --serve: a conversion runs in a worker thread, and an error ends the
+   request instead of the process (Fail) */
+typedef struct Conv {
+    jmp_buf stop;
+    int code;           /* the exit code of casbas, 0 = ok */
+    int line;           /* line of the BAS-file, 0 = not known */
+    char msg [256];
+} Conv;
+
+static _Thread_local Conv *Cv= NULL;
+static _Thread_local int LineNo= 0;     /* the line being read by Bas2Cas */
+
+/* BYTES @file: the raw bytes after the program are in a file, named
+   relative to the BAS-file (NULL: no files, --serve); Cas2Bas writes
+   them into BinName (--bin) */
+static _Thread_local const char *BasName= NULL;
+static _Thread_local const char *BinName= NULL;
+
+static char *BinFor (const char *basname);
+
+/* the memory of the file being converted (emalloc), reset after it */
+static _Thread_local Arena *Ar= NULL;
+
+/* --stats: the time of the phases of a conversion (a phase gets the time
+   since the previous Lap) and what is in the program */
+#define PH_READ       0
+#define PH_PARSE      1     /* the lines, the line numbers, BYTES */
+#define PH_TRANSLATE  2     /* TrLine */
+#define PH_TOKENIZE   3     /* TokLine */
+#define PH_DETOKENIZE 4     /* Cas2Bas, into the stream buffer */
+#define PH_WRITE      5
+#define PH_N          6
+
+static const char *const PhaseName [PH_N] = {
+    "read", "parse", "translate", "tokenize", "detokenize", "write"
+};
+
+typedef struct Stats {
+    double t0;                  /* the last Lap */
+    double t [PH_N];
+    unsigned long lines;
+    unsigned long tokcount [256];
+    unsigned long esct, escx;   /* \t.. and \x.. */
+    unsigned long bytes;        /* BYTES after the program */
+} Stats;
+
+static _Thread_local Stats *St= NULL;
+
+/* --check: the errors of a file are collected (LineError), not only the
+   first one is reported */
+typedef struct Check {
+    const char *name;
+    FILE *f;
+    FILE *out;              /* into report, while checking */
+    char *report;
+    size_t reportlen;
+    int errors, warnings;
+    int code;               /* the highest exit code of the errors */
+} Check;
+
+static _Thread_local Check *Ck= NULL;
+
+static void LineError (int code, const char *why, const char *fmt, ...);
+static int  CheckFiles (int n, char **names);
+
+static double Now (void);
+static void Lap (int phase);
+static void PutStats (FILE *g, const Stats *s, const char *name, int dir);
+
 static void TipVizsg (void);
+static void Serve (void);
+static void Watch (const char *dir);
 
 int main (int argc, char **argv)
 {
+    static Arena arena;
+    static Stats stats;
     FILE *f, *g;
 
     ParseArgs (&argc, &argv);
+    if (opt.utf8) MakeUtf8Map ();
+    if (opt.serve) {
+        Serve ();
+        return 0;
+    }
+    if (opt.watch && argc==2) {
+        Watch (argv[1]);
+        return 0;
+    }
     if (argc<2) {
         fprintf (stderr, "usage:\n"
                          "\tcasbas [options] <casfile> [<basfile>]\n"
                          "\tcasbas [options] <basfile> [<casfile>]\n"
+                         "\tcasbas --serve[=<socket>] [--jobs=N]\n"
+                         "\tcasbas --check [--jobs=N] <basfile>|<dir>...\n"
+                         "\tcasbas --watch[=bas|cas|both] [--debounce=MS] <dir>\n"
                          "options:\n"
                          "\t-d debug\n"
-                         "\t-o overwrite existing file\n");
+                         "\t-o overwrite existing file\n"
+                         "\t--serve conversion server on a unix socket (or stdin/stdout)\n"
+                         "\t--jobs=N threads of the server or of --check (default: one per CPU)\n"
+                         "\t--stats[=json] time of the phases and counts, to stderr\n"
+                         "\t--check all the errors of the BAS-files (*.bas in a dir), no output\n"
+                         "\t--watch convert the *.bas (=cas: *.cas, =both) files written in dir\n"
+                         "\t--debounce=MS wait for more writes of a file (--watch, default 5)\n"
+                         "\t--bin the bytes after the program into <basfile>.bin (BYTES @file)\n"
+                         "\t--utf8 the BAS-file is UTF-8 (default: latin2)\n");
         return 4;
     }
+    if (opt.check) {
+        return CheckFiles (argc-1, argv+1);
+    }
 
     memset (&var, 0, sizeof (var));
+    Ar = &arena;
 
     var.iname =  argv[1];
     if (argc>2) {
@@ -66,6 +197,8 @@ int main (int argc, char **argv)
     }
 
     TipVizsg ();
+    BasName = var.itype==TYPE_BAS ? var.iname : var.oname;
+    if (opt.bin && var.itype==TYPE_CAS) BinName = BinFor (var.oname);
 
     f = efopen (var.iname, var.imode);
     if (! opt.overw) {
@@ -76,26 +209,42 @@ int main (int argc, char **argv)
                      var.oname);
             exit (35);
         }
+        g = BinName ? fopen (BinName, "r") : NULL;
+        if (g!=NULL) {
+            fclose (g);
+            fprintf (stderr, "Output file '%s' already exists!\n",
+                     BinName);
+            exit (35);
+        }
     }
     g = efopen (var.oname, var.omode);
+    StreamBuf (f);
+    StreamBuf (g);
 
+    if (opt.stats) {
+        St = &stats;
+        St->t0 = Now ();
+    }
     if (var.itype == TYPE_CAS) Cas2Bas (f, g);
     else Bas2Cas (f, g);
 
     fclose (f);
+    fclose (g);
+    if (St) {
+        Lap (PH_WRITE);
+        PutStats (stderr, St, var.iname, var.itype);
+    }
+    ArenaFree (&arena);
 
     return 0;
 }
 
-static const char hdig [] = "0123456789ABCDEF";
-
 static int HexDig (int x)
 {
-    const char *p;
+    const TVCCHAR *t = &tvc_chars [(unsigned char)x];
 
-    p= strchr (hdig, toupper(x));
-    if (!p) exit (37);
-    return p-hdig;
+    if (! (t->cc & TVC_CC_XDIGIT)) Fail (37, "Bad hex digit '%c'\n", x);
+    return t->cc & TVC_CC_DIGIT ? x-'0' : t->up-'A'+10;
 }
 
 typedef struct BuffData {
@@ -103,53 +252,60 @@ typedef struct BuffData {
     unsigned len;
 } BuffData;
 
-static const char uhun [] = "";
-static const char lhun [] = "";
-
+/* the accented letters and the case are in tvc_chars (tvc.h); --utf8:
+   a byte above 0x7f may begin an accented letter (tvc_utf8), the other
+   ones are kept as they are, as the latin2 bytes */
 static int TrLine (BuffData *b)
 {
     unsigned i, j;
     int c;
     int rc;
-    const char *p;
+    const TVCCHAR *t;
 
         for (i=0, j=0; i<b->len; ++i) {
-            p = strchr (uhun, b->ptr[i]);
-            if (p) {
-                b->ptr[j++] = (char)(0x00 + p-uhun);
+            c = (unsigned char)b->ptr[i];
+            t = &tvc_chars [c];
+            if (! (t->cc & TVC_CC_ESCAPE)) {
+                if (c>=0x80 && opt.utf8) {
+                    if (c>=TVC_UTF8_FIRST && c<=TVC_UTF8_LAST && i+1<b->len &&
+                        ((unsigned char)b->ptr[i+1] & 0xc0)==0x80 &&
+                        tvc_utf8 [(c-TVC_UTF8_FIRST)*64 + (b->ptr[i+1]&0x3f)] != TVC_UTF8_NONE) {
+                        c = tvc_utf8 [(c-TVC_UTF8_FIRST)*64 + (b->ptr[i+1]&0x3f)];
+                        ++i;
+                    }
+                    b->ptr[j++] = (char)c;
+                    continue;
+                }
+                b->ptr[j++] = (char)t->tr;
                 continue;
             }
-            p = strchr (lhun, b->ptr[i]);
-            if (p) {
-                b->ptr[j++] = (char)(0x10 + p-lhun);
+            if (i+1>=b->len) return -1;
+            if (b->ptr[i+1]=='\\') {
+                b->ptr[j++]='\\';
+                ++i;
                 continue;
             }
-            if (b->ptr[i]=='\\') {
-                if (i+1>=b->len) return -1;
-                if (b->ptr[i+1]=='\\') {
-                    b->ptr[j++]='\\';
-                    ++i;
-                    continue;
-                }
-                if ((b->ptr[i+1]!='t' && b->ptr[i+1]!='x') || i+3>=b->len || 
-                    !isxdigit(b->ptr[i+2]) || !isxdigit(b->ptr[i+3])) {
-                        rc= -1;
-                        goto RETURN;
-                    }
-                    c= HexDig (b->ptr[i+2])*16 + HexDig (b->ptr[i+3]);
-                    if (b->ptr[i+1]=='t') {
-                            if (c<0x20 || c>=0xe0) {
-                            rc= -1;
-                            goto RETURN;
-                        }
-                        if (c>=0x80 && c<0xa0) c -= 0x80;
-                    }
-                    b->ptr[j++]= (char)c;
-                    i+=3;
-                    continue;
+            if ((b->ptr[i+1]!='t' && b->ptr[i+1]!='x') || i+3>=b->len ||
+                !(tvc_chars [(unsigned char)b->ptr[i+2]].cc & TVC_CC_XDIGIT) ||
+                !(tvc_chars [(unsigned char)b->ptr[i+3]].cc & TVC_CC_XDIGIT)) {
+                rc= -1;
+                goto RETURN;
+            }
+            c= HexDig (b->ptr[i+2])*16 + HexDig (b->ptr[i+3]);
+            if (b->ptr[i+1]=='t') {
+                if (c<0x20 || c>=0xe0) {
+                    rc= -1;
+                    goto RETURN;
                 }
-                b->ptr[j++]= b->ptr[i];
+                if (c>=0x80 && c<0xa0) c -= 0x80;
+            }
+            if (St) {                   /* as Cas2Bas writes them */
+                if (b->ptr[i+1]=='t') ++St->esct;
+                else ++St->escx;
             }
+            b->ptr[j++]= (char)c;
+            i+=3;
+        }
     b->len = j;
     rc = 0;
 RETURN:
@@ -176,11 +332,11 @@ static int GetWord (BuffData *b, BuffData *w)
 
     p= b->ptr;
     plim = p + b->len;
-    while (p<plim && isspace (*p)) ++p;
+    while (p<plim && (tvc_chars [(unsigned char)*p].cc & TVC_CC_SPACE)) ++p;
     wd = p;
-    while (p<plim && ! isspace (*p)) ++p;
+    while (p<plim && ! (tvc_chars [(unsigned char)*p].cc & TVC_CC_SPACE)) ++p;
     wdlim = p;
-    while (p<plim && isspace (*p)) ++p;
+    while (p<plim && (tvc_chars [(unsigned char)*p].cc & TVC_CC_SPACE)) ++p;
 
     w->ptr = (char *)wd;
     w->len = wdlim - wd;
@@ -197,10 +353,10 @@ static void StripLabel (BuffData *b, BuffData *label)
 
     GetWord (&btmp, &mylabel);
     if (mylabel.len==5 &&
-        isxdigit((unsigned char)mylabel.ptr[0]) &&
-        isxdigit((unsigned char)mylabel.ptr[1]) &&
-        isxdigit((unsigned char)mylabel.ptr[2]) &&
-        isxdigit((unsigned char)mylabel.ptr[3]) &&
+        (tvc_chars [(unsigned char)mylabel.ptr[0]].cc & TVC_CC_XDIGIT) &&
+        (tvc_chars [(unsigned char)mylabel.ptr[1]].cc & TVC_CC_XDIGIT) &&
+        (tvc_chars [(unsigned char)mylabel.ptr[2]].cc & TVC_CC_XDIGIT) &&
+        (tvc_chars [(unsigned char)mylabel.ptr[3]].cc & TVC_CC_XDIGIT) &&
         mylabel.ptr[4]==':') {
         *b= btmp;
         if (label) *label= mylabel;
@@ -213,7 +369,7 @@ static int GetLineno (BuffData *b, unsigned *no)
 {
     long num= 0;
 
-    while (b->len>0 && isdigit (b->ptr[0])) {
+    while (b->len>0 && (tvc_chars [(unsigned char)b->ptr[0]].cc & TVC_CC_DIGIT)) {
         num *= 10;
         num += b->ptr[0] - '0';
         if (num>65535L) return -1;
@@ -226,58 +382,56 @@ static int GetLineno (BuffData *b, unsigned *no)
 
 static int TokLine (BuffData *b)
 {
-    unsigned i, j, k, cmplen;
-    int tok, c;
-    int found, fndlen, diff;
+    unsigned i, j, k, n, fndlen;
+    int c;
+    int found;
     int state;
 
     state= 0; /* Kell tokenizlni */
 
     for (i=0, j=0; i<b->len;) {
         if (state==0) {
-            for (tok= BASIC_TOKEN_END, found=-1;
-                 found==-1 && tok>= BASIC_TOKEN_START; --tok) {
-                cmplen = strlen (charmap [0][tok]);
-                if (b->len - i >= cmplen) {
-                    for (k=0, diff=0; !diff && k<cmplen; ++k) {
-                        c = b->ptr[i+k];
-                            if (c>=0x61 && c<=0x7a) c -= 0x20;          /* a-z -> A-Z */
-                            else if (c>=0x90 && c<=0x9a) c -= 0x10;     /* - -> - */
-                        diff = c != charmap[0][tok][k];
-                    }
-                    if (! diff) {
-                        found= tok;
-                        fndlen = cmplen;
-                    }
+            /* the trie of the tokens (tokens.h): the highest token
+               on the way is taken, as by trying them from the end */
+            found= -1;
+            fndlen= 0;
+            n= basic_token_root [tvc_chars [(unsigned char)b->ptr[i]].up];
+            for (k=1; n; ++k) {
+                if (basic_token_trie[n].tok && basic_token_trie[n].tok > found) {
+                    found= basic_token_trie[n].tok;
+                    fndlen= k;
                 }
+                if (i+k >= b->len) break;
+                c = tvc_chars [(unsigned char)b->ptr[i+k]].up;
+                for (n= basic_token_trie[n].child;
+                     n && basic_token_trie[n].ch != c; n= basic_token_trie[n].next);
             }
             if (found != -1) {
-                if (found==BASIC_TOKEN_REM ||
-                    found==BASIC_TOKEN_COMMENT) {
+                if (basic_token_class[found] & (TOK_CLASS_REM|TOK_CLASS_COMMENT)) {
                     state = 4; /* Megjegyzs */
-                } else if (found==BASIC_TOKEN_DATA) {
+                } else if (basic_token_class[found] & TOK_CLASS_DATA) {
                     state = 2; /* DATA  */
                 }
+                if (St) ++St->tokcount [found];
                 b->ptr[j++]= (char)found;
                 i += fndlen;
             } else {
-                if (b->ptr[i]=='"') state ^= 1; /* Macskakrm */
-                c = b->ptr[i++];
-                    if (c>=0x61 && c<=0x7a) c -= 0x20;          /* a-z -> A-Z */
-                    else if (c>=0x90 && c<=0x9a) c -= 0x10;     /* - -> - */
+                if (tvc_chars [(unsigned char)b->ptr[i]].cc & TVC_CC_QUOTE) state ^= 1; /* Macskakrm */
+                c = tvc_chars [(unsigned char)b->ptr[i++]].up;
                 b->ptr[j++]= (char)c;
             }
         } else {
             c = (int)(unsigned char)b->ptr[i++];
-            if (c=='"') state ^= 1; /* Macskakrm */
+            if (tvc_chars [c].cc & TVC_CC_QUOTE) state ^= 1; /* Macskakrm */
             else if (state==2) { /* DATA-sor, macskakrm nlkl */
-                if (b->ptr[i]==':') {
+                if (tvc_chars [c].cc & TVC_CC_COLON) {
                     c= BASIC_TOKEN_COLON;
                     state= 0;                    /* DATA-sor vge, kell tokenizlni */
-                } else if (b->ptr[i]=='!') {
+                } else if (tvc_chars [c].cc & TVC_CC_COMMENT) {
                     c= BASIC_TOKEN_COMMENT;
                     state= 4;                    /* DATA-sor vge, komment kezdete */
                 }
+                if (St && state!=2) ++St->tokcount [c];
             }
             b->ptr[j++]= (char)c;
         }
@@ -287,43 +441,144 @@ static int TokLine (BuffData *b)
     return 0;
 }
 
-#define MAXLINE 1024
+/* the whole input, with BAS_BEFORE and BAS_AFTER; the size of a file is
+   known, a pipe is read into a growing buffer */
+static char *ReadAll (FILE *f, size_t *plen)
+{
+    struct stat st;
+    size_t size, len, rd;
+    char *buf;
+    int fd;
+
+    /* a file is read at once (the BUFSIZ more sees the end); a pipe
+       grows the buffer, in place (egrow) */
+    fd = fileno (f);
+    size = BUFSIZ;
+    if (fd>=0 && fstat (fd, &st)==0 && S_ISREG (st.st_mode)) size += (size_t)st.st_size;
+    buf = emalloc (BAS_BEFORE + size + BAS_AFTER);
+    len = 0;
+    while ((rd = fread (buf+BAS_BEFORE+len, 1, size-len, f)) > 0) {
+        len += rd;
+        if (len==size) {
+            buf = egrow (buf, BAS_BEFORE + size + BAS_AFTER, BAS_BEFORE + 2*size + BAS_AFTER);
+            size *= 2;
+        }
+    }
+    if (ferror (f)) Fail (32, "Error reading the input\n");
+    *plen = len;
+    return buf+BAS_BEFORE;
+}
+
+/* BYTES @name: NULL if it can't be opened (LineError) */
+static FILE *OpenBin (const char *name)
+{
+    const char *slash;
+    char *path;
+    FILE *f;
+    size_t dlen;
+
+    if (BasName==NULL) {
+        LineError (32, NULL, "BYTES @%s in line #%d: no files here\n", name, LineNo);
+        return NULL;
+    }
+    slash = strrchr (BasName, '/');
+    dlen = name[0]!='/' && slash ? (size_t)(slash-BasName+1) : 0;
+    path = emalloc (dlen + strlen (name) + 1);
+    memcpy (path, BasName, dlen);
+    strcpy (path+dlen, name);
+    f = fopen (path, "rb");
+    if (f==NULL) {
+        LineError (32, strerror (errno), "Error opening '%s' in line #%d\n", path, LineNo);
+    }
+    return f;
+}
+
+/* the file as it is, without TrLine; g==NULL: only counted */
+static unsigned long CopyBin (FILE *bf, FILE *g)
+{
+    char *buf;
+    size_t rd;
+    unsigned long len;
+
+    buf = emalloc (BUFSIZ);
+    len = 0;
+    while ((rd = fread (buf, 1, BUFSIZ, bf)) > 0) {
+        if (g) fwrite (buf, 1, rd, g);
+        len += rd;
+    }
+    if (ferror (bf)) Fail (32, "Error reading BYTES @file in line #%d\n", LineNo);
+    if (St) St->bytes += len;
+    return len;
+}
+
+/* the .bin next to the BAS-file */
+static char *BinFor (const char *basname)
+{
+    char *bin;
+    size_t len;
+
+    len = strlen (basname);
+    if (len>4 && basname[len-4]=='.') len -= 4;
+    bin = emalloc (len+5);
+    memcpy (bin, basname, len);
+    strcpy (bin+len, ".bin");
+    return bin;
+}
 
 static void Bas2Cas (FILE *f, FILE *g)
 {
-    char line [3+MAXLINE+1], *l;
-    int ln, ll, basend, autorun;
+    char *buf;
+    size_t size;
+
+    buf = ReadAll (f, &size);
+    if (St) Lap (PH_READ);
+    Bas2CasMem (buf, size, g);
+}
+
+/* the lines are found with memchr (vectorized in the C library) and are
+   parsed where they are: no copy, no limit on the length of a line
+   (a BYTES-line may be any long) */
+/* g==NULL: no output (--check) */
+static void Bas2CasMem (char *buf, size_t size, FILE *g)
+{
+    char *l, *nl, *lim;
+    int ln, basend, autorun;
     BuffData b, w;
-    unsigned no;
-    unsigned prgsize, totsize;
+    unsigned no, lastno;
+    unsigned long prgsize, totsize;
+    const char *why;
     BASLINE *bl;
     CASHDR ch;
     CASHDR_DATA cd;
+    FILE *bf;
 
     memset (&ch, 0, sizeof (ch));
-    fwrite (&ch, 1, sizeof (ch), g);
+    if (g) fwrite (&ch, 1, sizeof (ch), g);
 
     ln= 0;
     basend= 0;
     prgsize = 0;
     autorun= 0;
-    l = line + 3;
-    while (fgets (l, MAXLINE, f)) {
-        ++ln;
-        ll = strlen (l);
-        if (ll==0 || l[ll-1]!='\n') {
-            fprintf (stderr, "line #%d is too long or contains '\\0'\n", ln);
-            exit (35);
-        }
-        b.len = ll;
+    lastno= 0;
+    lim = buf + size;
+    *lim = '\0';   /* looked at after the line, as after a chomped one */
+    for (l = buf; l<lim; l = nl) {
+        LineNo = ++ln;
+        nl = memchr (l, '\n', lim-l);
+        nl = nl ? nl+1 : lim;
+        b.len = nl-l;
         b.ptr = l;
+        if (memchr (l, '\0', b.len)) {
+            LineError (35, NULL, "line #%d contains '\\0'\n", ln);
+            continue;
+        }
 
         Chomp (&b);
         LTrim (&b);
         StripLabel (&b, NULL);
         if (b.len==0) continue;
 
-        if (! isdigit (b.ptr[0])) { /* Nincs sorszm */
+        if (! (tvc_chars [(unsigned char)b.ptr[0]].cc & TVC_CC_DIGIT)) { /* Nincs sorszm */
             GetWord (&b, &w);
             if (w.len == 7 &&
                 (memcmp (w.ptr, "AUTORUN", 7)==0 ||
@@ -333,56 +588,109 @@ static void Bas2Cas (FILE *f, FILE *g)
 
             } else if (w.len != 5 ||
                 (memcmp (w.ptr, "BYTES", 5)!=0 && 
-                 memcmp (w.ptr, "bytes", 5)!=0)) goto SYNERR;
+                 memcmp (w.ptr, "bytes", 5)!=0)) {
+                why= "a line number, AUTORUN or BYTES is expected";
+                goto SYNERR;
+            }
             GetWord (&b, &w);
-            if (w.len>0 && w.ptr[0]=='\'') {
-                --w.len;
-                ++w.ptr;
-                if (w.len>0 && w.ptr[w.len-1]=='\'') --w.len;
+            bf = NULL;
+            if (w.len>1 && w.ptr[0]=='@') {             /* BYTES @file */
+                w.ptr[w.len] = '\0';    /* a space, the line end or the byte after the buffer */
+                if (St) Lap (PH_PARSE);
+                bf = OpenBin (w.ptr+1);
+                if (bf==NULL) continue;
+            } else {
+                if (w.len>0 && w.ptr[0]=='\'') {
+                    --w.len;
+                    ++w.ptr;
+                    if (w.len>0 && w.ptr[w.len-1]=='\'') --w.len;
+                }
+                if (w.len==0) continue;
+                if (St) Lap (PH_PARSE);
+                if (TrLine (&w)) {
+                    why= "bad escape in BYTES";
+                    goto SYNERR;
+                }
+                if (St) {
+                    Lap (PH_TRANSLATE);
+                    St->bytes += w.len;
+                }
             }
-            if (w.len==0) continue;
-            if (TrLine (&w)) goto SYNERR;
             if (! basend) {
                 basend= 1;
-                line[0] = BASIC_PRGEND;
-                fwrite (line, 1, 1, g);
+                if (g) putc (BASIC_PRGEND, g);
                 ++prgsize;
             }
-            fwrite (w.ptr, 1, w.len, g);
-            prgsize += w.len;
+            if (bf) {
+                prgsize += CopyBin (bf, g);
+                fclose (bf);
+            } else {
+                if (g) fwrite (w.ptr, 1, w.len, g);
+                prgsize += w.len;
+            }
+            if (St) Lap (PH_WRITE);
             continue;
         }
-        if (basend) goto SYNERR;
+        if (basend) {
+            why= "a program line after BYTES";
+            goto SYNERR;
+        }
 
-        if (GetLineno (&b, &no)) goto SYNERR;
+        if (GetLineno (&b, &no)) {
+            why= "the line number is above 65535";
+            goto SYNERR;
+        }
+        if (Ck && no<=lastno && lastno) {
+            fprintf (Ck->out, "%s:%d: warning: line number %u after %u\n",
+                     Ck->name, ln, no, lastno);
+            ++Ck->warnings;
+        }
+        lastno= no;
         LTrim (&b);
 
-        if (TrLine (&b)) goto SYNERR;
+        if (St) Lap (PH_PARSE);
+        if (TrLine (&b)) {
+            why= "bad escape";
+            goto SYNERR;
+        }
+        if (St) Lap (PH_TRANSLATE);
         TokLine (&b);
+        if (St) {
+            Lap (PH_TOKENIZE);
+            ++St->lines;
+        }
         if (b.len > 252) {
-            fprintf (stderr, "Tokenized line is too long"
-                     " (line #%d (basic %u) len=%d)\n",
-                     ln, no, b.len);
-            exit (40);
+            LineError (40, NULL, "Tokenized line is too long"
+                       " (line #%d (basic %u) len=%d)\n",
+                       ln, no, b.len);
+            continue;
         }
         bl = (BASLINE *)(b.ptr - sizeof (BASLINE));
         bl->len = (unsigned char)(sizeof (BASLINE) + b.len);
         bl->no[0] = (unsigned char)(no&0xff);
         bl->no[1] = (unsigned char)(no>>8);
 
-        fwrite (bl, 1, bl->len, g);
+        if (g) fwrite (bl, 1, bl->len, g);
         prgsize += bl->len;
+        if (St) Lap (PH_WRITE);
         continue;
 
-SYNERR: fprintf (stderr, "Syntax error in line #%d\n", ln);
-        exit (38);
+SYNERR: LineError (38, why, "Syntax error in line #%d\n", ln);
     }
+    LineNo = 0;
     if (! basend) {
 /*        basend= 1; */
-        line[0] = BASIC_PRGEND;
-        fwrite (line, 1, 1, g);
+        if (g) putc (BASIC_PRGEND, g);
         ++prgsize;
     }
+    if (prgsize > 0xffff) { /* the header can't hold it */
+        if (Ck==NULL) Fail (40, "The program is %lu bytes, above 65535\n", prgsize);
+        fprintf (Ck->out, "%s: error: the program is %lu bytes, above 65535\n",
+                 Ck->name, prgsize);
+        ++Ck->errors;
+        if (40 > Ck->code) Ck->code = 40;
+    }
+    if (g==NULL) return;
     totsize = prgsize + sizeof (CASHDR);
 
     memset (&cd, 0, sizeof (cd));
@@ -395,6 +703,7 @@ SYNERR: fprintf (stderr, "Syntax error in line #%d\n", ln);
 
     fseek (g, 0, SEEK_SET);
     fwrite (&ch, 1, sizeof (ch), g);
+    fseek (g, (long)totsize, SEEK_SET); /* a memory-stream (--serve) ends at the position */
 }
 
 static void Cas2Bas (FILE *f, FILE *g)
@@ -404,8 +713,11 @@ static void Cas2Bas (FILE *f, FILE *g)
     const unsigned char *prg, *prglim;
     const BASLINE *line, *nextline;
     const unsigned char *p, *pend;
+    const char *name;
+    const char *(*map)[256];
     unsigned no, ni;
-    int state, c;
+    int state, c, ok;
+    FILE *bf;
 
     efread (f, &ch, sizeof (ch));
     GetHeaderData (&ch, &cd);
@@ -423,6 +735,7 @@ static void Cas2Bas (FILE *f, FILE *g)
     if (opt.debug) {
         fprintf (stderr, "program loaded\n");
     }
+    if (St) Lap (PH_READ);
 
     if (cd.autorun) {
         fprintf (g, "AUTORUN\n");
@@ -430,16 +743,18 @@ static void Cas2Bas (FILE *f, FILE *g)
 
     line= (const BASLINE *)prg;
     prglim = prg + cd.prgsize;
+    map = opt.utf8 ? charmap_utf8 : charmap;
 
     while ((unsigned char *)line < prglim &&
             line->len != BASIC_PRGEND) {
 
-        if (line->len < sizeof (BASLINE)) {
-            fprintf (stderr, "Broken BASIC program, exiting\n");
-            exit (32);
+        nextline = (BASLINE *)((unsigned char *)line + line->len);
+        if (line->len < sizeof (BASLINE) ||
+            (unsigned char *)line + sizeof (BASLINE) > prglim ||
+            (unsigned char *)nextline > prglim) {
+            Fail (32, "Broken BASIC program, exiting\n");
         }
 
-        nextline = (BASLINE *)((unsigned char *)line + line->len);
         no = line->no[0] + (line->no[1] << 8);
         fprintf (g, "%4u ", no);
 
@@ -449,24 +764,49 @@ static void Cas2Bas (FILE *f, FILE *g)
 
         for (state= 0; p<pend; ++p) {
             c = *p;
-            fprintf (g, "%s", charmap [state!=0][c]);
+            if ((state==0 ||        /* ':' and '!' end a DATA-line */
+                 (state==2 && (basic_token_class[c] & (TOK_CLASS_COLON|TOK_CLASS_COMMENT)))) &&
+                basic_token_text[c][0]) {
+                fwrite (basic_token_text[c]+1, 1, (unsigned char)basic_token_text[c][0], g);
+                if (St) ++St->tokcount [c];
+            } else {
+                fputs (map [state!=0][c], g);
+                if (St && map [state!=0][c][0]=='\\') {
+                    if (map [state!=0][c][1]=='t') ++St->esct;
+                    else if (map [state!=0][c][1]=='x') ++St->escx;
+                }
+            }
 
             if (c=='"') state ^= 1;                     /* macskakrmk kztt nem kell tokenizlni */
             else if ((state&1)==0) {
-                if (c==BASIC_TOKEN_DATA) state |= 2;        /* DATA-sorban nem kell tokenizlni */
-                else if (c==BASIC_TOKEN_COLON) state &= ~2; /* itt a DATA-sor vge */
-                else if (c==BASIC_TOKEN_COMMENT ||
-                         c==BASIC_TOKEN_REM) state |= 4;  /* megjegyzsben nem kell tokenizlni */
+                if (basic_token_class[c] & TOK_CLASS_DATA) state |= 2;        /* DATA-sorban nem kell tokenizlni */
+                else if (basic_token_class[c] & TOK_CLASS_COLON) state &= ~2; /* itt a DATA-sor vge */
+                else if (basic_token_class[c] &
+                         (TOK_CLASS_COMMENT|TOK_CLASS_REM)) state |= 4;  /* megjegyzsben nem kell tokenizlni */
             }
         }
         fprintf (g, "\n");
+        if (St) ++St->lines;
 
         line = nextline;
     }
 
     p= (unsigned char *)line;
     if (p<prglim && *p==BASIC_PRGEND) ++p;
+    if (St && p<prglim) {
+        St->bytes += prglim-p;
+        if (!BinName) St->escx += prglim-p;     /* BYTES '\x..': as TrLine reads them */
+    }
 
+    if (BinName && p<prglim) {                  /* --bin: raw, BYTES @file */
+        bf = fopen (BinName, "wb");
+        if (bf==NULL) Fail (32, "Error opening '%s': %s\n", BinName, strerror (errno));
+        ok = fwrite (p, 1, prglim-p, bf) == (size_t)(prglim-p);
+        if (fclose (bf) || !ok) Fail (32, "Error writing '%s': %s\n", BinName, strerror (errno));
+        name = strrchr (BinName, '/');
+        fprintf (g, "%04x: BYTES @%s\n", (unsigned)(p-prg + BASIC_PROGBASE), name ? name+1 : BinName);
+        p = prglim;
+    }
     for (ni=0; p<prglim; ++p) {
         if (++ni==1) fprintf (g, "%04x: BYTES '", (unsigned)(p-prg + BASIC_PROGBASE));
         fprintf (g, "\\x%02x", *p);
@@ -478,6 +818,101 @@ static void Cas2Bas (FILE *f, FILE *g)
     if (ni) {
         fprintf (g, "'\n");
     }
+    if (St) Lap (PH_DETOKENIZE);
+}
+
+/* an error of a BAS-line: --check reports it and goes on, else Fail */
+static void LineError (int code, const char *why, const char *fmt, ...)
+{
+    char msg [256];
+    va_list ap;
+    size_t len;
+
+    va_start (ap, fmt);
+    vsnprintf (msg, sizeof (msg), fmt, ap);
+    va_end (ap);
+    if (Ck==NULL) Fail (code, "%s", msg);
+
+    len = strlen (msg);
+    if (len>0 && msg[len-1]=='\n') msg[len-1] = '\0';
+    fprintf (Ck->out, "%s:%d: error: %s%s%s\n", Ck->name, LineNo, msg,
+             why ? ": " : "", why ? why : "");
+    ++Ck->errors;
+    if (code > Ck->code) Ck->code = code;
+}
+
+static double Now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void Lap (int phase)
+{
+    double t = Now ();
+
+    St->t[phase] += t - St->t0;
+    St->t0 = t;
+}
+
+/* the names of the files may contain anything */
+static void PutStr (FILE *g, const char *s)
+{
+    putc ('"', g);
+    for (; *s; ++s) {
+        if (*s=='"' || *s=='\\') fprintf (g, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20 || (unsigned char)*s >= 0x7f) {
+            fprintf (g, "\\u%04x", (unsigned char)*s);  /* latin2 is not UTF-8 */
+        }
+        else putc (*s, g);
+    }
+    putc ('"', g);
+}
+
+/* text: a line per item; JSON: one line (an object) per file */
+static void PutStats (FILE *g, const Stats *s, const char *name, int dir)
+{
+    double tot;
+    unsigned long ntok;
+    int i, c, n;
+
+    for (tot=0, i=0; i<PH_N; ++i) tot += s->t[i];
+    for (ntok=0, c=0; c<256; ++c) ntok += s->tokcount[c];
+    if (opt.stats==2) {
+        fprintf (g, "{\"file\": ");
+        PutStr (g, name);
+        fprintf (g, ", \"conversion\": \"%s\", \"time\": {",
+                 dir==TYPE_CAS ? "cas2bas" : "bas2cas");
+        for (i=0; i<PH_N; ++i) fprintf (g, "\"%s\": %.6f, ", PhaseName[i], s->t[i]);
+        fprintf (g, "\"total\": %.6f}, \"lines\": %lu, \"tokens\": %lu, \"token_counts\": {",
+                 tot, s->lines, ntok);
+        for (n=0, c=BASIC_TOKEN_START; c<=BASIC_TOKEN_END; ++c) {
+            if (s->tokcount[c]==0) continue;
+            if (n++) fprintf (g, ", ");
+            PutStr (g, basic_token_names [c-BASIC_TOKEN_START]);
+            fprintf (g, ": %lu", s->tokcount[c]);
+        }
+        fprintf (g, "}, \"escapes_t\": %lu, \"escapes_x\": %lu, \"bytes\": %lu}\n",
+                 s->esct, s->escx, s->bytes);
+        return;
+    }
+    fprintf (g, "%s: %s\n", name, dir==TYPE_CAS ? "CAS -> BAS" : "BAS -> CAS");
+    for (i=0; i<PH_N; ++i) {
+        if (s->t[i]>0) fprintf (g, "  %-10s %10.6fs %5.1f%%\n", PhaseName[i], s->t[i],
+                                tot>0 ? 100*s->t[i]/tot : 0.0);
+    }
+    fprintf (g, "  %-10s %10.6fs\n", "total", tot);
+    fprintf (g, "  lines %lu, tokens %lu, escapes \\t %lu, \\x %lu, BYTES %lu\n",
+             s->lines, ntok, s->esct, s->escx, s->bytes);
+    for (n=0, c=BASIC_TOKEN_START; c<=BASIC_TOKEN_END; ++c) {
+        if (s->tokcount[c]==0) continue;
+        fprintf (g, "%s%s %lu", n==0 ? "  " : n%6 ? ", " : "\n  ",
+                 basic_token_names [c-BASIC_TOKEN_START], s->tokcount[c]);
+        ++n;
+    }
+    fprintf (g, "%s", n ? "\n" : "");
 }
 
 static void GetHeaderData (const CASHDR *ch, CASHDR_DATA *cd)
@@ -486,8 +921,7 @@ static void GetHeaderData (const CASHDR *ch, CASHDR_DATA *cd)
         ch->pfh.magic != PRGFILE_MAGIC ||
         (ch->pfh.type != PRGFILE_TYPE_DATA && 
          ch->pfh.type != PRGFILE_TYPE_PROG)) {
-        fprintf (stderr, "Bad CAS-header\n");
-        exit (32);
+        Fail (32, "Bad CAS-header\n");
     }
     cd->blocknum  = PEEK2 (ch->cph.blocknum);
     cd->lastblock = PEEK2 (ch->cph.lastblock);
@@ -562,17 +996,32 @@ HIBA:        fprintf (stderr, "input filename '%s' should be *.cas or *.bas\n",
     }
 }
 
-static void *emalloc (int n)
+/* from the arena of the current file, if there is one */
+static void *emalloc (size_t n)
 {
     void *p;
 
-    p = malloc (n);
+    p = Ar ? ArenaAlloc (Ar, n) : malloc (n);
     if (p) return p;
-    fprintf (stderr, "Out of memory (malloc (%d))\n", n);
-    exit (33);
+    Fail (33, "Out of memory (malloc (%lu))\n", (unsigned long)n);
     return NULL;
 }
 
+/* the last emalloc made bigger */
+static void *egrow (void *p, size_t old, size_t n)
+{
+    p = Ar ? ArenaGrow (Ar, p, old, n) : realloc (p, n);
+    if (p) return p;
+    Fail (33, "Out of memory (malloc (%lu))\n", (unsigned long)n);
+    return NULL;
+}
+
+/* the buffer of a stream from the arena, instead of stdio's malloc */
+static void StreamBuf (FILE *f)
+{
+    setvbuf (f, emalloc (BUFSIZ), _IOFBF, BUFSIZ);
+}
+
 static FILE *efopen (const char *name, const char *mode)
 {
     FILE *f;
@@ -586,6 +1035,26 @@ static FILE *efopen (const char *name, const char *mode)
     return NULL;
 }
 
+static void Fail (int code, const char *fmt, ...)
+{
+    va_list ap;
+    size_t len;
+
+    va_start (ap, fmt);
+    if (Cv) {
+        Cv->code = code;
+        Cv->line = LineNo;
+        vsnprintf (Cv->msg, sizeof (Cv->msg), fmt, ap);
+        va_end (ap);
+        len = strlen (Cv->msg);
+        if (len>0 && Cv->msg[len-1]=='\n') Cv->msg[len-1] = '\0';
+        longjmp (Cv->stop, 1);
+    }
+    vfprintf (stderr, fmt, ap);
+    va_end (ap);
+    exit (code);
+}
+
 static void efread (FILE *f, void *buff, size_t len)
 {
     size_t rd;
@@ -593,6 +1062,7 @@ static void efread (FILE *f, void *buff, size_t len)
     errno = 0;
     rd = fread (buff, 1, len, f);
     if (rd==len) return;
+    if (Cv) Fail (32, "Not enough data (%u<%u)\n", (unsigned)rd, (unsigned)len);
     if (errno) {
         perror ("Error reading file");
     } else {
@@ -600,6 +1070,725 @@ static void efread (FILE *f, void *buff, size_t len)
     }
 }
 
+/* --serve: length-prefixed requests on a connection, answered in order
+   request:  op (1 byte: 'b' BAS->CAS, 'c' CAS->BAS), 3 bytes zero,
+             length (4 bytes), the input-file
+   response: status (1 byte: 0 ok, else the exit code of casbas), 3 bytes zero,
+             line (4 bytes, of the BAS-file, 0 if not known),
+             length (4 bytes), the output-file or the error message
+   the numbers are little endian */
+#define SERVE_MAXREQ (16L*1024*1024)
+
+/* the output is written into the arena, with room for the longest
+   possible conversion: a CAS-byte is at most 9 characters ("RECTANGLE"),
+   a BAS-line of n characters is at most n+3 bytes */
+#define SERVE_MAXOUT(op,len) ((op)=='c' ? \
+    16*((len) < 65536L+sizeof (CASHDR) ? (len) : 65536L+sizeof (CASHDR)) + 256 : \
+    4*(len) + sizeof (CASHDR) + 256)
+
+/* a client that doesn't take its response for so long is dropped */
+#define SERVE_TIMEOUT 5000  /* ms */
+
+typedef struct Conn {
+    int in, out;
+    unsigned char hdr [8];  /* of the request being read */
+    size_t got;             /* bytes of the request read: hdr, then buff */
+    unsigned long len;      /* of the input */
+    unsigned char *buff;    /* the input, kept for the next request */
+    size_t size;
+    Arena arena;            /* reset after each request */
+    FILE *f, *g;
+    char *res;              /* the output, in the arena */
+    size_t reslen;
+    int busy;               /* queued or being served */
+    int err;                /* a bad request: answered with it, then closed */
+    const char *errmsg;
+    struct Conn *next;      /* in the queue */
+} Conn;
+
+/* a socket is non-blocking: it is waited for, SERVE_TIMEOUT at most */
+static int WriteFull (int fd, const void *buff, size_t len)
+{
+    struct pollfd pf;
+    ssize_t wr;
+    size_t put;
+
+    for (put=0; put<len; put += wr) {
+        wr = write (fd, (const char *)buff+put, len-put);
+        if (wr<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+            pf.fd = fd;
+            pf.events = POLLOUT;
+            if (poll (&pf, 1, SERVE_TIMEOUT)<=0 && errno!=EINTR) return -1;
+            wr = 0;
+        } else if (wr<0 && errno==EINTR) wr = 0;
+        else if (wr<=0) return -1;
+    }
+    return 0;
+}
+
+static int Respond (Conn *c, int status, int line, const void *data, size_t len)
+{
+    unsigned char hdr [12];
+
+    memset (hdr, 0, sizeof (hdr));
+    hdr[0] = (unsigned char)status;
+    POKE4 (hdr+4, line);
+    POKE4 (hdr+8, len);
+    if (WriteFull (c->out, hdr, sizeof (hdr))) return -1;
+    return WriteFull (c->out, data, len);
+}
+
+/* the request, as far as it has arrived (a socket is non-blocking, so
+   a slow client doesn't hold anything but its buffer): 1 it is all
+   there (or it is bad, c->err: the answer is written by ServeRequest,
+   not here), 0 not yet, -1 the end of the connection or an error */
+static int ServeRead (Conn *c)
+{
+    ssize_t rd;
+
+    while (1) {
+        if (c->got == sizeof (c->hdr) + c->len && c->got >= sizeof (c->hdr)) return 1;
+        if (c->got < sizeof (c->hdr)) {
+            rd = read (c->in, c->hdr + c->got, sizeof (c->hdr) - c->got);
+        } else {
+            rd = read (c->in, c->buff+BAS_BEFORE + (c->got - sizeof (c->hdr)),
+                       sizeof (c->hdr) + c->len - c->got);
+        }
+        if (rd<0 && errno==EINTR) continue;
+        if (rd<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 0;
+        if (rd<=0) return -1;
+        c->got += rd;
+        if (c->got < sizeof (c->hdr) || c->got > sizeof (c->hdr)) continue;
+
+        c->len = PEEK4 (c->hdr+4);
+        if ((c->hdr[0]!='b' && c->hdr[0]!='c') || c->len>(unsigned long)SERVE_MAXREQ) {
+            c->err = 4;
+            c->errmsg = "Bad request";
+            return 1;
+        }
+        if (c->len>c->size) {
+            free (c->buff);
+            c->buff = malloc (BAS_BEFORE + c->len + BAS_AFTER);
+            c->size = c->buff ? c->len : 0;
+            if (c->buff==NULL) {
+                c->err = 33;
+                c->errmsg = "Out of memory";
+                return 1;
+            }
+        }
+    }
+}
+
+/* the request read by ServeRead; 0: answered, -1: error */
+static int ServeRequest (Conn *c)
+{
+    unsigned long len;
+    Conv cv;
+    int rc, op;
+
+    if (c->err) {
+        Respond (c, c->err, 0, c->errmsg, strlen (c->errmsg));
+        return -1;
+    }
+    op = c->hdr[0];
+    len = c->len;
+    c->got = 0;
+    c->len = 0;
+
+    memset (&cv, 0, sizeof (cv));
+    c->f = c->g = NULL;
+    c->reslen = 0;
+    LineNo = 0;
+    Cv = &cv;
+    Ar = &c->arena;
+    if (setjmp (cv.stop)==0) {
+        if (len==0) Fail (32, "Empty input\n");
+        c->res = emalloc (SERVE_MAXOUT (op, len));
+        c->g = fmemopen (c->res, SERVE_MAXOUT (op, len), "wb");
+        if (c->g==NULL) Fail (33, "Out of memory\n");
+        StreamBuf (c->g);
+        if (op=='c') {
+            c->f = fmemopen (c->buff+BAS_BEFORE, len, "rb");
+            if (c->f==NULL) Fail (33, "Out of memory\n");
+            StreamBuf (c->f);
+            Cas2Bas (c->f, c->g);
+        } else {
+            Bas2CasMem ((char *)c->buff+BAS_BEFORE, len, c->g); /* in place */
+        }
+        if (fflush (c->g) || ferror (c->g)) Fail (33, "Output is too long\n");
+        c->reslen = ftell (c->g);
+    }
+    Cv = NULL;
+    if (c->f) fclose (c->f);
+    if (c->g) fclose (c->g);
+
+    if (cv.code) rc = Respond (c, cv.code, cv.line, cv.msg, strlen (cv.msg));
+    else         rc = Respond (c, 0, 0, c->res, c->reslen);
+    Ar = NULL;
+    ArenaReset (&c->arena);
+    return rc;
+}
+
+static void ServeConn (int in, int out)
+{
+    Conn c;
+
+    memset (&c, 0, sizeof (c));
+    c.in = in;
+    c.out = out;
+    while (ServeRead (&c)==1 && ServeRequest (&c)==0);
+    free (c.buff);
+    ArenaFree (&c.arena);
+}
+
+/* the listening socket and the connections between the requests are
+   watched by the main thread (poll), which reads the requests; a
+   connection with a whole request is queued for the workers, and given
+   back after the response */
+static int ServeSock = -1;
+static int ServeWake [2];               /* worker -> main: a connection is back */
+static Conn **ServeConns;
+static int ServeN, ServeMax;
+static Conn *ServeQ, *ServeQTail;
+static pthread_mutex_t ServeMx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ServeCv = PTHREAD_COND_INITIALIZER;
+
+static void *ServeThread (void *arg)
+{
+    Conn *c;
+    int rc, i;
+
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock (&ServeMx);
+        while (ServeQ==NULL) pthread_cond_wait (&ServeCv, &ServeMx);
+        c = ServeQ;
+        ServeQ = c->next;
+        pthread_mutex_unlock (&ServeMx);
+
+        rc = ServeRequest (c);
+
+        pthread_mutex_lock (&ServeMx);
+        if (rc) {
+            for (i=0; ServeConns[i]!=c; ++i);
+            ServeConns[i] = ServeConns[--ServeN];
+            close (c->in);
+            free (c->buff);
+            ArenaFree (&c->arena);
+            free (c);
+        } else {
+            c->busy = 0;
+        }
+        pthread_mutex_unlock (&ServeMx);
+        while (write (ServeWake[1], "", 1)<0 && errno==EINTR);
+    }
+    return NULL;
+}
+
+static void ServePoll (void)
+{
+    struct pollfd *pf;
+    Conn **pc, *c;
+    char drain [64];
+    int i, k, n, fd, rc;
+
+    pf = NULL;
+    pc = NULL;
+    while (1) {
+        pthread_mutex_lock (&ServeMx);
+        pf = realloc (pf, (ServeN+2) * sizeof (*pf));
+        pc = realloc (pc, (ServeN+2) * sizeof (*pc));
+        if (pf==NULL || pc==NULL) Fail (33, "Out of memory\n");
+        pf[0].fd = ServeSock;
+        pf[1].fd = ServeWake[0];
+        for (n=2, i=0; i<ServeN; ++i) {
+            if (ServeConns[i]->busy) continue;
+            pc[n] = ServeConns[i];
+            pf[n++].fd = ServeConns[i]->in;
+        }
+        pthread_mutex_unlock (&ServeMx);
+        for (i=0; i<n; ++i) pf[i].events = POLLIN;
+
+        if (poll (pf, n, -1)<0) {
+            if (errno==EINTR) continue;
+            perror ("poll");
+            exit (32);
+        }
+        if (pf[1].revents) {
+            while (read (ServeWake[0], drain, sizeof (drain))==(ssize_t)sizeof (drain));
+        }
+        pthread_mutex_lock (&ServeMx);
+        for (i=2; i<n; ++i) {
+            if (pf[i].revents==0) continue;
+            c = pc[i];
+            rc = ServeRead (c);
+            if (rc<0) {
+                for (k=0; ServeConns[k]!=c; ++k);
+                ServeConns[k] = ServeConns[--ServeN];
+                close (c->in);
+                free (c->buff);
+                ArenaFree (&c->arena);
+                free (c);
+                continue;
+            }
+            if (rc==0) continue;
+            c->busy = 1;
+            c->next = NULL;
+            if (ServeQ) ServeQTail->next = c;
+            else        ServeQ = c;
+            ServeQTail = c;
+            pthread_cond_signal (&ServeCv);
+        }
+        if (pf[0].revents && (fd = accept (ServeSock, NULL, NULL))>=0) {
+            if (ServeN==ServeMax) {
+                ServeMax = ServeMax ? 2*ServeMax : 16;
+                ServeConns = realloc (ServeConns, ServeMax * sizeof (*ServeConns));
+                if (ServeConns==NULL) Fail (33, "Out of memory\n");
+            }
+            fcntl (fd, F_SETFL, O_NONBLOCK);
+            c = emalloc (sizeof (*c));
+            memset (c, 0, sizeof (*c));
+            c->in = c->out = fd;
+            ServeConns[ServeN++] = c;
+        }
+        pthread_mutex_unlock (&ServeMx);
+    }
+}
+
+static void Serve (void)
+{
+    struct sockaddr_un sa;
+    struct stat st;
+    pthread_t th;
+    int i, n;
+
+    signal (SIGPIPE, SIG_IGN);
+    if (*opt.serve=='\0') {
+        ServeConn (0, 1);
+        return;
+    }
+
+    if (strlen (opt.serve) >= sizeof (sa.sun_path)) {
+        fprintf (stderr, "Socket name '%s' is too long\n", opt.serve);
+        exit (16);
+    }
+    memset (&sa, 0, sizeof (sa));
+    sa.sun_family = AF_UNIX;
+    strcpy (sa.sun_path, opt.serve);
+    if (stat (opt.serve, &st)==0 && S_ISSOCK (st.st_mode)) unlink (opt.serve);
+
+    ServeSock = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (ServeSock<0 ||
+        bind (ServeSock, (struct sockaddr *)&sa, sizeof (sa)) ||
+        listen (ServeSock, 64)) {
+        fprintf (stderr, "Error listening on '%s", opt.serve);
+        perror ("'");
+        exit (32);
+    }
+    if (pipe (ServeWake) || fcntl (ServeWake[0], F_SETFL, O_NONBLOCK)) {
+        perror ("pipe");
+        exit (32);
+    }
+
+    n = opt.jobs;
+    if (n<=0) n = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (n<=0) n = 1;
+    fprintf (stderr, "serving on '%s', %d threads\n", opt.serve, n);
+    for (i=0; i<n; ++i) {
+        if (pthread_create (&th, NULL, ServeThread, NULL)) {
+            fprintf (stderr, "pthread_create failed\n");
+            exit (33);
+        }
+    }
+    ServePoll ();
+}
+
+/* --check: the files are taken by --jobs threads, the reports are
+   written in the order of the files */
+static Check *CheckList;
+static int CheckN, CheckMax, CheckNext;
+static pthread_mutex_t CheckMx = PTHREAD_MUTEX_INITIALIZER;
+
+static void CheckFile (Check *c)
+{
+    Conv cv;
+    char *buf;
+    size_t size;
+
+    c->out = open_memstream (&c->report, &c->reportlen);
+    if (c->out==NULL) {
+        perror ("open_memstream");
+        exit (33);
+    }
+    memset (&cv, 0, sizeof (cv));
+    LineNo = 0;
+    Cv = &cv;
+    Ck = c;
+    BasName = c->name;
+    if (setjmp (cv.stop)==0) {
+        c->f = fopen (c->name, "rb");
+        if (c->f==NULL) Fail (32, "Error opening file: %s\n", strerror (errno));
+        buf = ReadAll (c->f, &size);
+        Bas2CasMem (buf, size, NULL);
+    } else {
+        /* not an error of a line: the rest of the file is not checked */
+        if (cv.line) fprintf (c->out, "%s:%d: error: %s\n", c->name, cv.line, cv.msg);
+        else         fprintf (c->out, "%s: error: %s\n", c->name, cv.msg);
+        ++c->errors;
+        if (cv.code > c->code) c->code = cv.code;
+    }
+    Cv = NULL;
+    Ck = NULL;
+    BasName = NULL;
+    if (c->f) fclose (c->f);
+    c->f = NULL;
+    fclose (c->out);
+}
+
+static void *CheckThread (void *arg)
+{
+    Arena arena;
+    Check *c;
+
+    (void)arg;
+    memset (&arena, 0, sizeof (arena));
+    Ar = &arena;
+    while (1) {
+        pthread_mutex_lock (&CheckMx);
+        c = CheckNext < CheckN ? &CheckList [CheckNext++] : NULL;
+        pthread_mutex_unlock (&CheckMx);
+        if (c==NULL) break;
+        CheckFile (c);
+        ArenaReset (&arena);
+    }
+    Ar = NULL;
+    ArenaFree (&arena);
+    return NULL;
+}
+
+static int CmpName (const void *a, const void *b)
+{
+    return strcmp (*(char * const *)a, *(char * const *)b);
+}
+
+/* a directory: the *.bas files in it and below, sorted */
+static void CheckAdd (const char *path, int top)
+{
+    struct stat st;
+    DIR *d;
+    struct dirent *de;
+    char **names, *full;
+    size_t len, nnames, maxnames, i;
+
+    len = strlen (path);
+    if (stat (path, &st) || !S_ISDIR (st.st_mode)) {
+        if (!top && (len<4 || strcasecmp (path+len-4, ".bas")!=0)) return;
+        if (CheckN == CheckMax) {
+            CheckMax = CheckMax ? 2*CheckMax : 256;
+            CheckList = realloc (CheckList, CheckMax * sizeof (*CheckList));
+            if (CheckList==NULL) Fail (33, "Out of memory\n");
+        }
+        memset (&CheckList[CheckN], 0, sizeof (*CheckList));
+        CheckList[CheckN++].name = strdup (path);
+        return;
+    }
+    d = opendir (path);
+    if (d==NULL) {
+        fprintf (stderr, "Error reading directory '%s", path);
+        perror ("'");
+        exit (32);
+    }
+    names = NULL;
+    nnames = maxnames = 0;
+    while ((de = readdir (d)) != NULL) {
+        if (de->d_name[0]=='.') continue;
+        if (nnames == maxnames) {
+            maxnames = maxnames ? 2*maxnames : 64;
+            names = realloc (names, maxnames * sizeof (*names));
+            if (names==NULL) Fail (33, "Out of memory\n");
+        }
+        full = malloc (len+1+strlen (de->d_name)+1);
+        if (full==NULL) Fail (33, "Out of memory\n");
+        sprintf (full, "%s/%s", path, de->d_name);
+        names [nnames++] = full;
+    }
+    closedir (d);
+    qsort (names, nnames, sizeof (*names), CmpName);
+    for (i=0; i<nnames; ++i) {
+        CheckAdd (names[i], 0);
+        free (names[i]);
+    }
+    free (names);
+}
+
+/* the exit code: the highest of the errors, 0 if there are none */
+static int CheckFiles (int n, char **names)
+{
+    pthread_t *th;
+    int i, nth, code, errors, warnings, bad;
+
+    for (i=0; i<n; ++i) {
+        CheckAdd (names[i], 1);
+    }
+    nth = opt.jobs;
+    if (nth<=0) nth = (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (nth<=0) nth = 1;
+    if (nth > CheckN) nth = CheckN;
+    th = malloc ((nth ? nth : 1) * sizeof (*th));
+    if (th==NULL) Fail (33, "Out of memory\n");
+    for (i=0; i<nth; ++i) {
+        if (pthread_create (&th[i], NULL, CheckThread, NULL)) {
+            fprintf (stderr, "pthread_create failed\n");
+            exit (33);
+        }
+    }
+    for (i=0; i<nth; ++i) {
+        pthread_join (th[i], NULL);
+    }
+    free (th);
+
+    code = errors = warnings = bad = 0;
+    for (i=0; i<CheckN; ++i) {
+        fwrite (CheckList[i].report, 1, CheckList[i].reportlen, stdout);
+        free (CheckList[i].report);
+        errors += CheckList[i].errors;
+        warnings += CheckList[i].warnings;
+        if (CheckList[i].errors) ++bad;
+        if (CheckList[i].code > code) code = CheckList[i].code;
+    }
+    printf ("%d files, %d with errors, %d errors, %d warnings\n",
+            CheckN, bad, errors, warnings);
+    return code;
+}
+
+/* --watch: a *.bas or *.cas file written into the directory (closed
+   after writing, or moved there) is converted to the other one, as
+   TipVizsg names it. The events of a file are collected for --debounce
+   ms, so a save in more writes is converted once. The output is written
+   into a temporary file and renamed, so the emulator never sees half of
+   it; the file written so is remembered (inode and time), and its own
+   event doesn't convert it back. One arena is reset after each file.
+   The BAS-file is the source: a CAS-file is converted only with
+   --watch=cas or =both, and only if the BAS-file is older or missing.
+   A BAS-file is checked as by --check: all the errors are reported, and
+   there is no output if there are any. */
+#define WATCH_BAS 1         /* *.bas -> *.cas */
+#define WATCH_CAS 2         /* *.cas -> *.bas */
+
+typedef struct WatchFile {
+    char *name;             /* in the directory */
+    double due;             /* the time to convert it, 0: nothing to do */
+    ino_t ino;              /* written by us, 0: no */
+    struct timespec mtime;
+} WatchFile;
+
+static WatchFile *WatchList;
+static int WatchN, WatchMax;
+
+static WatchFile *WatchGet (const char *name)
+{
+    int i;
+
+    for (i=0; i<WatchN; ++i) {
+        if (strcmp (WatchList[i].name, name)==0) return &WatchList[i];
+    }
+    if (WatchN == WatchMax) {
+        WatchMax = WatchMax ? 2*WatchMax : 64;
+        WatchList = realloc (WatchList, WatchMax * sizeof (*WatchList));
+        if (WatchList==NULL) Fail (33, "Out of memory\n");
+    }
+    memset (&WatchList[WatchN], 0, sizeof (*WatchList));
+    WatchList[WatchN].name = strdup (name);
+    if (WatchList[WatchN].name==NULL) Fail (33, "Out of memory\n");
+    return &WatchList[WatchN++];
+}
+
+/* *.bas, *.cas, or in upper case *.BAS, *.CAS (as TipVizsg names
+   them); WatchConvert keeps the case for the output, mixed is ignored */
+static int WatchType (const char *name)
+{
+    size_t len;
+
+    len = strlen (name);
+    if (len<5 || name[0]=='.' || name[len-4]!='.') return 0;
+    if (strcmp (name+len-3, "cas")==0 || strcmp (name+len-3, "CAS")==0) return TYPE_CAS;
+    if (strcmp (name+len-3, "bas")==0 || strcmp (name+len-3, "BAS")==0) return TYPE_BAS;
+    return 0;
+}
+
+static void WatchConvert (const char *dir, WatchFile *w, Arena *arena, mode_t mode)
+{
+    static Stats stats;
+    struct stat st;
+    struct stat ost;
+    WatchFile *o;
+    Conv cv;
+    Check ck;
+    FILE *f, *g;
+    char *iname, *oname, *tname;
+    size_t dlen, len;
+    int type, fd;
+    double t0;
+
+    t0 = Now ();
+    type = WatchType (w->name);
+    dlen = strlen (dir);
+    len = strlen (w->name);
+    iname = ArenaAlloc (arena, dlen+1+len+1);
+    oname = ArenaAlloc (arena, dlen+1+len+1);
+    tname = ArenaAlloc (arena, dlen+1+len+8);
+    if (iname==NULL || oname==NULL || tname==NULL) Fail (33, "Out of memory\n");
+    sprintf (iname, "%s/%s", dir, w->name);
+    strcpy (oname, iname);
+    memcpy (oname+dlen+1+len-3, type==TYPE_CAS ? "bas" : "cas", 3);
+    if (w->name[len-1]=='S') memcpy (oname+dlen+1+len-3, type==TYPE_CAS ? "BAS" : "CAS", 3);
+    sprintf (tname, "%s.XXXXXX", oname);
+
+    if (stat (iname, &st) || !S_ISREG (st.st_mode)) return;
+    if (w->ino && st.st_ino==w->ino &&
+        st.st_mtim.tv_sec==w->mtime.tv_sec && st.st_mtim.tv_nsec==w->mtime.tv_nsec) {
+        return;                             /* written by us */
+    }
+    w->ino = 0;
+    if (type==TYPE_CAS && stat (oname, &ost)==0 &&
+        (ost.st_mtim.tv_sec > st.st_mtim.tv_sec ||
+         (ost.st_mtim.tv_sec == st.st_mtim.tv_sec && ost.st_mtim.tv_nsec >= st.st_mtim.tv_nsec))) {
+        fprintf (stderr, "%s: not converted, '%s' is newer\n", iname, oname);
+        return;
+    }
+
+    memset (&cv, 0, sizeof (cv));
+    memset (&ck, 0, sizeof (ck));
+    ck.name = iname;
+    ck.out = stderr;
+    f = g = NULL;
+    fd = -1;
+    LineNo = 0;
+    Cv = &cv;
+    Ar = arena;
+    if (opt.stats) {
+        memset (&stats, 0, sizeof (stats));
+        St = &stats;
+        St->t0 = t0;
+    }
+    if (setjmp (cv.stop)==0) {
+        f = fopen (iname, "rb");
+        if (f==NULL) Fail (32, "Error opening file: %s\n", strerror (errno));
+        fd = mkstemp (tname);
+        if (fd<0) Fail (32, "Error creating '%s': %s\n", tname, strerror (errno));
+        fchmod (fd, mode);
+        g = fdopen (fd, "wb");
+        if (g==NULL) Fail (33, "Out of memory\n");
+        StreamBuf (f);
+        StreamBuf (g);
+        BasName = type==TYPE_BAS ? iname : oname;
+        if (opt.bin && type==TYPE_CAS) BinName = BinFor (oname);
+        if (type==TYPE_CAS) {
+            Cas2Bas (f, g);
+        } else {
+            Ck = &ck;
+            Bas2Cas (f, g);
+            Ck = NULL;
+            if (ck.errors) Fail (ck.code, "%d errors, not converted\n", ck.errors);
+        }
+        if (fflush (g) || ferror (g)) Fail (32, "Error writing '%s': %s\n", tname, strerror (errno));
+        if (fstat (fd, &st)) Fail (32, "Error writing '%s': %s\n", tname, strerror (errno));
+        if (rename (tname, oname)) Fail (32, "Error renaming to '%s': %s\n", oname, strerror (errno));
+        fd = -1;
+    }
+    Cv = NULL;
+    Ck = NULL;
+    if (f) fclose (f);
+    if (g) fclose (g);
+    else if (fd>=0) close (fd);
+    if (cv.code) {
+        if (fd>=0) unlink (tname);
+        if (cv.line) fprintf (stderr, "%s:%d: error: %s\n", iname, cv.line, cv.msg);
+        else         fprintf (stderr, "%s: error: %s\n", iname, cv.msg);
+    } else {
+        o = WatchGet (oname+dlen+1);
+        o->ino = st.st_ino;
+        o->mtime = st.st_mtim;
+        o->due = 0;
+        fprintf (stderr, "%s -> %s %.3f ms\n", iname, oname, (Now ()-t0)*1000);
+        if (St) {
+            Lap (PH_WRITE);
+            PutStats (stderr, St, iname, type);
+        }
+    }
+    St = NULL;
+    BasName = BinName = NULL;
+    Ar = NULL;
+    ArenaReset (arena);
+}
+
+static void Watch (const char *dir)
+{
+    static Arena arena;
+    char buf [4096] __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+    const struct inotify_event *ev;
+    struct pollfd pf;
+    ssize_t len;
+    double now, next;
+    mode_t mode;
+    int fd, i, timeout, type;
+
+    mode = umask (0);
+    umask (mode);
+    mode = 0666 & ~mode;
+
+    fd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+    if (fd<0) {
+        perror ("inotify_init1");
+        exit (32);
+    }
+    if (inotify_add_watch (fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+        fprintf (stderr, "Error watching directory '%s", dir);
+        perror ("'");
+        exit (32);
+    }
+    fprintf (stderr, "watching '%s'\n", dir);
+
+    pf.fd = fd;
+    pf.events = POLLIN;
+    while (1) {
+        now = Now ();
+        next = 0;
+        for (i=0; i<WatchN; ++i) {
+            if (WatchList[i].due && (next==0 || WatchList[i].due < next)) next = WatchList[i].due;
+        }
+        timeout = next==0 ? -1 : next<=now ? 0 : (int)((next-now)*1000) + 1;
+        if (poll (&pf, 1, timeout) < 0 && errno!=EINTR) {
+            perror ("poll");
+            exit (32);
+        }
+        while ((len = read (fd, buf, sizeof (buf))) > 0) {
+            now = Now ();
+            for (i=0; i<len; i += sizeof (*ev) + ev->len) {
+                ev = (const struct inotify_event *)(buf+i);
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    fprintf (stderr, "watch: events are lost\n");
+                }
+                if (ev->len==0) continue;
+                type = WatchType (ev->name);
+                if (type==0 || !(opt.watch & (type==TYPE_CAS ? WATCH_CAS : WATCH_BAS))) continue;
+                WatchGet (ev->name)->due = now + opt.debounce/1000.0;
+            }
+        }
+        if (len<0 && errno!=EAGAIN && errno!=EINTR) {
+            perror ("read inotify");
+            exit (32);
+        }
+        now = Now ();
+        for (i=0; i<WatchN; ++i) {
+            if (WatchList[i].due && WatchList[i].due <= now) {
+                WatchList[i].due = 0;
+                WatchConvert (dir, &WatchList[i], &arena, mode);
+            }
+        }
+    }
+}
+
 static const char *charmap[2][256] = {
 {
   "", "", "",  "", "", "", "", "", "", "\\t89", "\\t8a", "\\t8b", "\\t8c", "\\t8d", "\\t8e", "\\t8f",
@@ -615,34 +1804,8 @@ static const char *charmap[2][256] = {
   "\\x80", "\\x81", "\\x82", "\\x83", "\\x84", "\\x85", "\\x86", "\\x87",
   "\\x88", "\\x89", "\\x8a", "\\x8b", "\\x8c", "\\x8d", "\\x8e", "\\x8f",
 
-  "Cannot ",   "No ",       "Bad ",     "rgument",
-  " missing",  ")",         "(",        "&",
-  "+",         "<",         "=",        "<=",
-  ">",         "<>",        ">=",       "^",
-  ";",         "/",         "-",        "=<",
-  ",",         "><",        "=>",       "#",
-  "*",         "TOKEN#A9",  "TOKEN#AA", "POLIGON",
-  "RECTANGLE", "ELLIPSE",   "BORDER",   "USING",
-  "AT",        "ATN",       "XOR",      "VOLUME",
-  "TO",        "THEN",      "TAB",      "STYLE",
-  "STEP",      "RATE",      "PROMPT",   "PITCH",
-  "PAPER",     "PALETTE",   "PAINT",    "OR",
-  "ORD",       "OFF",       "NOT",      "MODE",
-  "INK",       "INKEY$",    "DURATION", "DELAY",
-  "CHARACTER", "AND",       "TOKEN#CA", "TOKEN#CB",
-  "EXCEPTION", "RENUMBER",  "FKEY",     "AUTO",
-  "LPRINT",    "EXT",       "VERIFY",   "TRACE",
-  "STOP",      "SOUND",     "SET",      "SAVE",
-  "RUN",       "RETURN",    "RESTORE",  "READ",
-  "RANDOMIZE", "PRINT",     "POKE",     "PLOT",
-  "OUT",       "OUTPUT",    "OPEN",     "ON",
-  "OK",        "NEXT",      "NEW",      "LOMEM",
-  "LOAD",      "LLIST",     "LIST",     "LET",
-  "INPUT",     "IF",        "GRAPHICS", "GOTO",
-  "GOSUB",     "GET",       "FOR",      "END",
-  "ELSE",      "DIM",       "DELETE",   "DEF",
-  "CONTINUE",  "CLS",       "CLOSE",    "DATA",
-  "REM",       ":",         "!",        "\\xff"
+  BASIC_TOKEN_NAMES,                            /* tokens.def */
+  "\\xff"
 }, {
   "", "", "",  "", "", "", "", "", "", "\\t89", "\\t8a", "\\t8b", "\\t8c", "\\t8d", "\\t8e", "\t8f",
   "", "", "",  "", "", "", "", "", "", "\\t99", "\\t9a", "\\t9b", "\\t9c", "\\t9d", "\\t9e", "\t9f",
@@ -652,7 +1815,7 @@ static const char *charmap[2][256] = {
   "@", "A", "B",  "C", "D", "E", "F", "G", "H", "I", "J", "K", "L",    "M", "N", "O",
   "P", "Q", "R",  "S", "T", "U", "V", "W", "X", "Y", "Z", "[", "\\\\", "]", "^", "_",
   "`", "a", "b",  "c", "d", "e", "f", "g", "h", "i", "j", "k", "l",    "m", "n", "o",
-  "p", "q", "r",  "s", "t", "u", "v", "w", "x", "y", "z", "{", "|",    "}", "~", "\t7f",
+  "p", "q", "r",  "s", "t", "u", "v", "w", "x", "y", "z", "{", "|",    "}", "~", "\\t7f",
 
   "\\x80", "\\x81", "\\x82", "\\x83", "\\x84", "\\x85", "\\x86", "\\x87",
   "\\x88", "\\x89", "\\x8a", "\\x8b", "\\x8c", "\\x8d", "\\x8e", "\\x8f",
@@ -675,6 +1838,20 @@ static const char *charmap[2][256] = {
   "\\xf8", "\\xf9", "\\xfa", "\\xfb", "\\xfc", "\\xfd", "\\xfe", "\\xff"
 }};
 
+/* the TVC codes of the accented letters (tvc_accent_utf8) in UTF-8, the
+   rest as in charmap */
+static void MakeUtf8Map (void)
+{
+    int i, c;
+
+    for (i=0; i<2; ++i) {
+        for (c=0; c<256; ++c) {
+            charmap_utf8 [i][c] = c < 0x19 && tvc_accent_utf8 [c][0] ?
+                                  tvc_accent_utf8 [c] : charmap [i][c];
+        }
+    }
+}
+
 static void ParseArgs (int *pargc, char ***pargv)
 {
     int argc;
@@ -697,9 +1874,39 @@ static void ParseArgs (int *pargc, char ***pargv)
         case 'o': case 'O':
              opt.overw = 1;
              break;
-        case 0: case '-': parse_arg = 0; break;
+        case '-':
+             if (argv[0][2]=='\0') {
+                 parse_arg = 0;
+             } else if (strncmp (*argv, "--serve", 7)==0 &&
+                        (argv[0][7]=='\0' || argv[0][7]=='=')) {
+                 opt.serve = argv[0][7] ? *argv+8 : "";
+             } else if (strncmp (*argv, "--jobs=", 7)==0) {
+                 opt.jobs = atoi (*argv+7);
+             } else if (strcmp (*argv, "--stats")==0 ||
+                        strcmp (*argv, "--stats=text")==0) {
+                 opt.stats = 1;
+             } else if (strcmp (*argv, "--stats=json")==0) {
+                 opt.stats = 2;
+             } else if (strcmp (*argv, "--check")==0) {
+                 opt.check = 1;
+             } else if (strcmp (*argv, "--watch")==0 ||
+                        strcmp (*argv, "--watch=bas")==0) {
+                 opt.watch = WATCH_BAS;
+             } else if (strcmp (*argv, "--watch=cas")==0) {
+                 opt.watch = WATCH_CAS;
+             } else if (strcmp (*argv, "--watch=both")==0) {
+                 opt.watch = WATCH_BAS | WATCH_CAS;
+             } else if (strncmp (*argv, "--debounce=", 11)==0) {
+                 opt.debounce = atoi (*argv+11);
+             } else if (strcmp (*argv, "--bin")==0) {
+                 opt.bin = 1;
+             } else if (strcmp (*argv, "--utf8")==0) {
+                 opt.utf8 = 1;
+             } else goto UNKOPT;
+             break;
+        case 0: parse_arg = 0; break;
         default:
-            fprintf (stderr, "Unknown option '%s'\n", *argv);
+UNKOPT:     fprintf (stderr, "Unknown option '%s'\n", *argv);
             exit (4);
         }
     }
@@ -0,0 +1,537 @@
+/* casclone.c */
+
+/* clone detection over a collection of CAS-files: which programs share
+   code (a common subroutine, the port of the same game). The programs
+   are read as BASLINE-streams (no detokenizing); the body of each line
+   is hashed, without its line number and with the line numbers after
+   GOTO, GOSUB, THEN, RESTORE and RUN left out, so a renumbered copy
+   hashes the same. A program is the set of its line hashes.
+
+   The sets are compared through MinHash signatures (bands*rows minimums
+   of as many hash functions), the signatures are bucketed by band (LSH):
+   the programs sharing a bucket in any band are the candidates, their
+   similarity (Jaccard: common lines / all lines) is computed exactly from
+   the sets. So the work is near linear in the number of programs, not
+   quadratic. The files are mapped and hashed in parallel.
+
+   The programs with the same set (copies of the same file) are
+   collapsed into the first of them before the LSH: the copies are
+   reported once each, with the first, and only the first one is
+   compared to the others. A bucket still having more than -maxbucket
+   programs is paired with its first program only, so the pairs don't
+   grow quadratically with it. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
+#endif
+
+#include "tvc.h"
+#include "casfile.h"
+
+#define MH_MAX      512         /* bands*rows */
+
+static struct {
+    const char *progname;
+    int jobs;           /* 0: number of CPUs */
+    double threshold;   /* the similarity reported from */
+    int bands, rows;
+    unsigned minlen;    /* shorter line bodies are not counted (END, RETURN) */
+    unsigned maxbucket; /* a bigger bucket is paired with its first program */
+    int verbose;
+} opt = {
+    NULL, 0, 0.5, 32, 4, 4, 256, 0
+};
+
+typedef struct Prog {
+    const char *name;
+    unsigned long long *set;    /* the line hashes, sorted, unique */
+    unsigned nset;
+    unsigned nlines;
+    unsigned long long *sig;    /* bands*rows */
+    unsigned long long sethash;
+    unsigned rep;               /* the first program with the same set */
+} Prog;
+
+typedef struct Bucket {
+    unsigned long long key;
+    unsigned prog;
+} Bucket;
+
+typedef struct Pair {
+    unsigned a, b;
+    unsigned common;
+    double sim;
+} Pair;
+
+static struct {
+    Prog *prog;
+    unsigned nprogs, maxprogs;
+    unsigned next;
+    pthread_mutex_t mx;
+    unsigned char jump [256];   /* a line number may follow the token */
+    unsigned ncopies;           /* programs collapsed into an other one */
+    unsigned long nbig;         /* buckets above -maxbucket */
+} C = {
+    NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, {0}, 0, 0
+};
+
+static void ParseArgs (int *pargc, char ***pargv);
+
+static void AddFile (const char *name);
+static void *ScanThread (void *arg);
+static void ScanCas (Prog *pg);
+static void Collapse (void);
+static Pair *Candidates (unsigned long *npairs);
+static double Now (void);
+
+int main (int argc, char **argv)
+{
+    static const char *const jumps[] = { "GOTO", "GOSUB", "THEN", "RESTORE", "RUN" };
+    pthread_t *th;
+    Pair *pr;
+    unsigned long npairs, n, i;
+    double start, tscan;
+    int k, nth;
+
+    ParseArgs (&argc, &argv);
+    if (argc<2) {
+        fprintf (stderr, "usage: casclone [options] <file.cas>|<dir>...\n"
+            "options: -threshold=0.5  the similarity reported from\n"
+            "         -bands=32 -rows=4  LSH: fewer rows find less similar pairs\n"
+            "         -minlen=4  shorter lines (bytes) are not counted\n"
+            "         -maxbucket=256  a bigger LSH bucket is paired with its first file\n"
+            "         -jobs=N  -v (counts to stderr)\n"
+            "output:  similarity, common lines, lines of both, the two files\n");
+        exit (8);
+    }
+    for (i=0; i<sizeof jumps / sizeof jumps[0]; ++i) {
+        for (k=0; k<=BASIC_TOKEN_END-BASIC_TOKEN_START; ++k) {
+            if (strcmp (basic_token_names[k], jumps[i])==0) C.jump [BASIC_TOKEN_START+k]= 1;
+        }
+    }
+    for (k=1; k<argc; ++k) {
+        AddPath (argv[k], 1, AddFile);
+    }
+
+    start= Now ();
+    nth= opt.jobs;
+    if (nth<=0) nth= (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (nth<=0) nth= 1;
+    if ((unsigned)nth > C.nprogs) nth= C.nprogs ? (int)C.nprogs : 1;
+    th= emalloc (nth * sizeof *th);
+    for (k=0; k<nth; ++k) {
+        if (pthread_create (&th[k], NULL, ScanThread, NULL)) {
+            fprintf (stderr, "pthread_create failed\n");
+            exit (33);
+        }
+    }
+    for (k=0; k<nth; ++k) {
+        pthread_join (th[k], NULL);
+    }
+    tscan= Now () - start;
+
+    Collapse ();
+    pr= Candidates (&npairs);
+    n= 0;
+    if (opt.threshold <= 1.0) {
+        for (i=0; i<C.nprogs; ++i) {
+            if (C.prog[i].rep == i) continue;
+            printf ("%.3f %u %u %u %s %s\n", 1.0, C.prog[i].nset,
+                    C.prog[i].nset, C.prog[i].nset,
+                    C.prog [C.prog[i].rep].name, C.prog[i].name);
+            ++n;
+        }
+    }
+    for (i=0; i<npairs; ++i) {
+        if (pr[i].sim >= opt.threshold) {
+            printf ("%.3f %u %u %u %s %s\n", pr[i].sim, pr[i].common,
+                    C.prog [pr[i].a].nset, C.prog [pr[i].b].nset,
+                    C.prog [pr[i].a].name, C.prog [pr[i].b].name);
+            ++n;
+        }
+    }
+    if (opt.verbose) {
+        fprintf (stderr, "%u files, %u copies, %lu candidates, %lu big buckets,"
+                 " %lu pairs; %d threads, scan %.3fs, total %.3fs\n",
+                 C.nprogs, C.ncopies, npairs, C.nbig, n, nth, tscan, Now () - start);
+    }
+    return n ? 0 : 1;
+}
+
+/* ---------------------------------------------------------------- files */
+
+static void AddFile (const char *name)
+{
+    if (C.nprogs == C.maxprogs) {
+        C.maxprogs= C.maxprogs ? 2*C.maxprogs : 256;
+        C.prog= erealloc (C.prog, C.maxprogs * sizeof *C.prog);
+    }
+    memset (&C.prog [C.nprogs], 0, sizeof *C.prog);
+    C.prog [C.nprogs].rep= C.nprogs;
+    C.prog [C.nprogs++].name= strcpy (emalloc (strlen (name)+1), name);
+}
+
+/* ---------------------------------------------------------------- hashing */
+
+/* the finalizer of splitmix64: one hash function per seed */
+static unsigned long long Mix (unsigned long long x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/* FNV-1a 64 of the body; the state as in Cas2Bas: the tokens count
+   outside of strings, comments and DATA only */
+static unsigned long long HashLine (const unsigned char *p, const unsigned char *pend)
+{
+    unsigned long long h= 0xcbf29ce484222325ULL;
+    int state= 0, jump= 0, c;
+
+    for (; p<pend; ++p) {
+        c= *p;
+        if (jump) {
+            if ((c>='0' && c<='9') || c==' ' || c==',') continue;
+            jump= 0;
+        }
+        h ^= c;
+        h *= 0x100000001b3ULL;
+        if (c=='"') state ^= 1;
+        else if (state==0) {
+            if (c==BASIC_TOKEN_DATA) state= 2;
+            else if (c==BASIC_TOKEN_COMMENT || c==BASIC_TOKEN_REM) state= 4;
+            else if (C.jump[c]) jump= 1;
+        } else if (state==2 && c==BASIC_TOKEN_COLON) state= 0;
+    }
+    return h;
+}
+
+static int CmpHash (const void *a, const void *b)
+{
+    unsigned long long x= *(const unsigned long long *)a, y= *(const unsigned long long *)b;
+
+    return x<y ? -1 : x>y;
+}
+
+static void *ScanThread (void *arg)
+{
+    Prog *pg;
+
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock (&C.mx);
+        pg= C.next < C.nprogs ? &C.prog [C.next++] : NULL;
+        pthread_mutex_unlock (&C.mx);
+        if (!pg) break;
+        ScanCas (pg);
+    }
+    return NULL;
+}
+
+static void ScanCas (Prog *pg)
+{
+    const CASHDR *ch;
+    const unsigned char *map, *prg, *prglim, *p;
+    CasLine l;
+    unsigned long long *set, m;
+    unsigned prgsize, n, i, k, nsig;
+    struct stat st;
+    int fd, rc;
+
+    fd= open (pg->name, O_RDONLY);
+    if (fd<0 || fstat (fd, &st)) {
+        fprintf (stderr, "Error opening file '%s': %s\n", pg->name, strerror (errno));
+        if (fd>=0) close (fd);
+        return;
+    }
+    if ((size_t)st.st_size < sizeof (CASHDR)) {
+        fprintf (stderr, "%s: not a CAS-file with a program, skipped\n", pg->name);
+        close (fd);
+        return;
+    }
+    map= mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map==MAP_FAILED) {
+        fprintf (stderr, "%s: mmap: %s\n", pg->name, strerror (errno));
+        return;
+    }
+    ch= (const CASHDR *)map;
+    if (ch->cph.magic != CPMHDR_MAGIC || ch->pfh.magic != PRGFILE_MAGIC ||
+        ch->pfh.type != PRGFILE_TYPE_PROG) {
+        fprintf (stderr, "%s: not a CAS-file with a program, skipped\n", pg->name);
+        munmap ((void *)map, st.st_size);
+        return;
+    }
+    prgsize= PEEK2 (ch->pfh.prgsize);
+    prg= map + sizeof (CASHDR);
+    if (prgsize > st.st_size - sizeof (CASHDR)) prgsize= st.st_size - sizeof (CASHDR);
+    prglim= prg + prgsize;
+
+    set= emalloc ((prgsize / sizeof (BASLINE) + 1) * sizeof *set);
+    n= 0;
+    p= prg;
+    while ((rc= NextLine (&p, prglim, &l)) > 0) {
+        ++pg->nlines;
+        if (l.len < opt.minlen) continue;
+        set [n++]= HashLine (l.p, l.p + l.len);
+    }
+    if (rc<0) fprintf (stderr, "%s: broken BASIC program after %u lines\n", pg->name, pg->nlines);
+    munmap ((void *)map, st.st_size);
+
+    qsort (set, n, sizeof *set, CmpHash);
+    for (k=0, i=0; i<n; ++i) {
+        if (k==0 || set[i] != set[k-1]) set [k++]= set[i];
+    }
+    pg->set= set;
+    pg->nset= k;
+    if (k==0) return;
+    pg->sethash= FnvHash ((const unsigned char *)set, k * sizeof *set);
+
+    /* the signature: the minimum of each hash function over the set */
+    nsig= opt.bands * opt.rows;
+    pg->sig= emalloc (nsig * sizeof *pg->sig);
+    for (i=0; i<nsig; ++i) pg->sig[i]= ~0ULL;
+    for (k=0; k<pg->nset; ++k) {
+        for (i=0; i<nsig; ++i) {
+            m= Mix (set[k] ^ (0x9e3779b97f4a7c15ULL * (i+1)));
+            if (m < pg->sig[i]) pg->sig[i]= m;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------- pairs */
+
+static int CmpBucket (const void *x, const void *y)
+{
+    const Bucket *a= x, *b= y;
+
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    return a->prog < b->prog ? -1 : a->prog > b->prog;
+}
+
+static int CmpPairIdx (const void *x, const void *y)
+{
+    const Pair *a= x, *b= y;
+
+    if (a->a != b->a) return a->a < b->a ? -1 : 1;
+    return a->b < b->b ? -1 : a->b > b->b;
+}
+
+static int CmpPairSim (const void *x, const void *y)
+{
+    const Pair *a= x, *b= y;
+
+    if (a->sim != b->sim) return a->sim > b->sim ? -1 : 1;
+    return CmpPairIdx (x, y);
+}
+
+/* the common elements of two sorted sets */
+static unsigned Common (const Prog *a, const Prog *b)
+{
+    unsigned i, j, n;
+
+    for (n=i=j=0; i<a->nset && j<b->nset; ) {
+        if (a->set[i] < b->set[j]) ++i;
+        else if (a->set[i] > b->set[j]) ++j;
+        else { ++n; ++i; ++j; }
+    }
+    return n;
+}
+
+static int CmpSet (const void *x, const void *y)
+{
+    const Prog *a= &C.prog [*(const unsigned *)x], *b= &C.prog [*(const unsigned *)y];
+    int d;
+
+    if (a->sethash != b->sethash) return a->sethash < b->sethash ? -1 : 1;
+    if (a->nset != b->nset) return a->nset < b->nset ? -1 : 1;
+    d= memcmp (a->set, b->set, a->nset * sizeof *a->set);
+    if (d) return d;
+    return *(const unsigned *)x < *(const unsigned *)y ? -1 : 1;
+}
+
+static int SameSet (const Prog *a, const Prog *b)
+{
+    return a->sethash == b->sethash && a->nset == b->nset &&
+           memcmp (a->set, b->set, a->nset * sizeof *a->set)==0;
+}
+
+/* the programs with the same set get the first of them as rep */
+static void Collapse (void)
+{
+    unsigned *idx, n, i, j;
+
+    idx= emalloc ((C.nprogs ? C.nprogs : 1) * sizeof *idx);
+    for (n=0, i=0; i<C.nprogs; ++i) {
+        if (C.prog[i].nset) idx [n++]= i;
+    }
+    qsort (idx, n, sizeof *idx, CmpSet);
+    for (i=0; i<n; i= j) {
+        for (j= i+1; j<n && SameSet (&C.prog[idx[j]], &C.prog[idx[i]]); ++j) {
+            C.prog [idx[j]].rep= idx[i];
+            ++C.ncopies;
+        }
+    }
+    free (idx);
+}
+
+/* the pairs sharing a bucket in a band, with their similarity, the most
+   similar first; only the first of the copies (rep) is in the buckets */
+static Pair *Candidates (unsigned long *npairs)
+{
+    Bucket *bk;
+    Pair *pr;
+    unsigned long nbk, npr, maxpr, i, j, k, m;
+    unsigned long long key;
+    unsigned p;
+    int band, r;
+
+    bk= emalloc ((C.nprogs ? C.nprogs : 1) * sizeof *bk);
+    pr= NULL;
+    npr= maxpr= 0;
+    for (band=0; band<opt.bands; ++band) {
+        for (nbk=0, p=0; p<C.nprogs; ++p) {
+            if (C.prog[p].nset==0 || C.prog[p].rep != p) continue;
+            key= 0xcbf29ce484222325ULL ^ band;
+            for (r=0; r<opt.rows; ++r) {
+                key= Mix (key ^ C.prog[p].sig [band*opt.rows + r]);
+            }
+            bk[nbk].key= key;
+            bk[nbk++].prog= p;
+        }
+        qsort (bk, nbk, sizeof *bk, CmpBucket);
+        for (i=0; i<nbk; i= j) {
+            for (j= i+1; j<nbk && bk[j].key==bk[i].key; ++j);
+            if (j-i > opt.maxbucket) ++C.nbig;
+            for (k=i; k < (j-i > opt.maxbucket ? i+1 : j); ++k) {
+                for (m=k+1; m<j; ++m) {
+                    if (npr == maxpr) {
+                        maxpr= maxpr ? 2*maxpr : 1024;
+                        pr= erealloc (pr, maxpr * sizeof *pr);
+                    }
+                    pr[npr].a= bk[k].prog;
+                    pr[npr++].b= bk[m].prog;
+                }
+            }
+        }
+        /* the same pair is found in several bands */
+        qsort (pr, npr, sizeof *pr, CmpPairIdx);
+        for (k=0, i=0; i<npr; ++i) {
+            if (k==0 || pr[i].a != pr[k-1].a || pr[i].b != pr[k-1].b) pr [k++]= pr[i];
+        }
+        npr= k;
+    }
+    free (bk);
+
+    for (i=0; i<npr; ++i) {
+        const Prog *a= &C.prog [pr[i].a], *b= &C.prog [pr[i].b];
+
+        pr[i].common= Common (a, b);
+        pr[i].sim= (double)pr[i].common / (a->nset + b->nset - pr[i].common);
+    }
+    if (npr) qsort (pr, npr, sizeof *pr, CmpPairSim);
+    *npairs= npr;
+    return pr;
+}
+
+/* ---------------------------------------------------------------- misc */
+
+static double Now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static void ParseArgs (int *pargc, char ***pargv)
+{
+    int argc;
+    char **argv;
+    int parse_arg;
+    char *arg;
+
+    argc = *pargc;
+    argv = *pargv;
+    parse_arg = 1;
+    opt.progname = argv[0];
+
+    while (--argc && **++argv=='-' && parse_arg) {
+        arg= strchr (argv[0], '=');
+        arg= arg ? arg+1 : "";
+        switch (argv[0][1]) {
+        case 'b': case 'B':
+            if (strncasecmp (argv[0], "-bands=", 7)==0) {
+                opt.bands= atoi (arg);
+                if (opt.bands<=0) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 'j': case 'J':
+            if (strncasecmp (argv[0], "-jobs=", 6)==0) {
+                opt.jobs= atoi (arg);
+                if (opt.jobs<=0) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 'm': case 'M':
+            if (strncasecmp (argv[0], "-minlen=", 8)==0) {
+                opt.minlen= (unsigned)atoi (arg);
+                break;
+            }
+            if (strncasecmp (argv[0], "-maxbucket=", 11)==0) {
+                opt.maxbucket= (unsigned)atoi (arg);
+                if (opt.maxbucket<2) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 'r': case 'R':
+            if (strncasecmp (argv[0], "-rows=", 6)==0) {
+                opt.rows= atoi (arg);
+                if (opt.rows<=0) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 't': case 'T':
+            if (strncasecmp (argv[0], "-threshold=", 11)==0) {
+                opt.threshold= atof (arg);
+                break;
+            } goto UNKOPT;
+
+        case 'v': case 'V':
+            if (strcasecmp (argv[0], "-v")==0) {
+                opt.verbose= 1;
+                break;
+            } goto UNKOPT;
+
+        case 0: case '-': parse_arg = 0; break;
+        default:
+UNKOPT:
+            fprintf (stderr, "Unknown option '%s'\n", *argv);
+            exit (4);
+        }
+    }
+    if (opt.bands * opt.rows > MH_MAX) {
+        fprintf (stderr, "-bands * -rows should be at most %d\n", MH_MAX);
+        exit (4);
+    }
+    ++argc;
+    *--argv = (char *)opt.progname;
+    *pargc = argc;
+    *pargv = argv;
+}
@@ -0,0 +1,592 @@
+/* casdiff.c */
+
+/* structural diff of two versions of a BASIC program (CAS-files), on the
+   BASLINE-streams, without detokenizing all of them: the lines are
+   matched by content (so renumbering is told as such), the lines not
+   matched are paired by line number (changed, shown token by token),
+   the rest are inserted or deleted. The BYTES after the program are
+   compared as binary.
+
+   The matching is a patience diff: the common head and tail, then the
+   lines found once on both sides as anchors (longest increasing
+   sequence), then the same between the anchors. */
+
+#include <errno.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
+#endif
+
+#include "tvc.h"
+#include "casfile.h"
+
+static struct {
+    const char *progname;
+    int quiet;          /* -q: the summary line only */
+    const char *pairs;  /* -pairs=FILE: "old new" per line */
+} opt = {
+    NULL, 0, NULL
+};
+
+typedef struct Line {
+    unsigned no;
+    const unsigned char *p; /* after the BASLINE, without the BASIC_LINEND */
+    unsigned len;
+    unsigned long long hash;
+    long match;             /* the line on the other side, -1: none */
+} Line;
+
+typedef struct Prog {
+    const char *name;
+    unsigned char *buf;
+    long size;
+    CASHDR_DATA cd;
+    Line *lines;
+    long nlines;
+    const unsigned char *bytes; /* after the program end */
+    long nbytes;
+    long bytesoff;              /* offset of bytes in the program */
+} Prog;
+
+typedef struct Stats {
+    long changed, inserted, deleted, renumbered;
+    int header, bytes;
+} Stats;
+
+static void ParseArgs (int *pargc, char ***pargv);
+
+static int LoadProg (Prog *pg, const char *name);
+static void FreeProg (Prog *pg);
+static int Diff (const char *oldname, const char *newname);
+static int Pairs (const char *list);
+
+int main (int argc, char **argv)
+{
+    ParseArgs (&argc, &argv);
+    if (opt.pairs && argc==1) {
+        return Pairs (opt.pairs);
+    }
+    if (argc!=3) {
+        fprintf (stderr, "usage: casdiff [-q] <old.cas> <new.cas>\n"
+            "       casdiff [-q] -pairs=<list>   (\"old new\" per line, - is stdin)\n"
+            "exit: 0 same, 1 different, >=2 error\n");
+        exit (8);
+    }
+    return Diff (argv[1], argv[2]);
+}
+
+/* ---------------------------------------------------------------- load */
+
+/* 0: ok; else an error is reported */
+static int LoadProg (Prog *pg, const char *name)
+{
+    const CASHDR *ch;
+    const unsigned char *p, *prg, *prglim;
+    CasLine cl;
+    Line *l;
+    int rc;
+    long max;
+    FILE *f;
+
+    memset (pg, 0, sizeof *pg);
+    pg->name= name;
+    f= fopen (name, "rb");
+    if (f==NULL) {
+        fprintf (stderr, "Error opening file '%s", name);
+        perror ("'");
+        return -1;
+    }
+    fseek (f, 0, SEEK_END);
+    pg->size= ftell (f);
+    fseek (f, 0, SEEK_SET);
+    pg->buf= emalloc (pg->size > 0 ? pg->size : 1);
+    if (pg->size < (long)sizeof (CASHDR) ||
+        fread (pg->buf, 1, pg->size, f) != (size_t)pg->size) {
+        fclose (f);
+        fprintf (stderr, "%s: not a CAS-file\n", name);
+        return -1;
+    }
+    fclose (f);
+    ch= (const CASHDR *)pg->buf;
+    if (ch->cph.magic != CPMHDR_MAGIC || ch->pfh.magic != PRGFILE_MAGIC) {
+        fprintf (stderr, "%s: Bad CAS-header\n", name);
+        return -1;
+    }
+    pg->cd.blocknum= PEEK2 (ch->cph.blocknum);
+    pg->cd.lastblock= PEEK2 (ch->cph.lastblock);
+    pg->cd.prgsize= PEEK2 (ch->pfh.prgsize);
+    pg->cd.type= ch->pfh.type;
+    pg->cd.autorun= ch->pfh.autorun;
+    pg->cd.version= ch->pfh.version;
+
+    prg= pg->buf + sizeof (CASHDR);
+    prglim= prg + pg->cd.prgsize;
+    if (prglim > pg->buf + pg->size) prglim= pg->buf + pg->size;
+
+    max= (prglim-prg) / sizeof (BASLINE) + 1;
+    pg->lines= emalloc (max * sizeof *pg->lines);
+    p= prg;
+    while ((rc= NextLine (&p, prglim, &cl)) > 0) {
+        l= &pg->lines [pg->nlines++];
+        l->no= cl.no;
+        l->p= cl.p;
+        l->len= cl.len;
+        l->hash= FnvHash (l->p, l->len);
+        l->match= -1;
+    }
+    if (rc<0) fprintf (stderr, "%s: Broken BASIC program after %ld lines\n", name, pg->nlines);
+    if (p<prglim && *p==BASIC_PRGEND) ++p;
+    pg->bytes= p;
+    pg->bytesoff= p-prg;
+    pg->nbytes= prglim-p;
+    return 0;
+}
+
+static void FreeProg (Prog *pg)
+{
+    free (pg->buf);
+    free (pg->lines);
+    pg->buf= NULL;
+    pg->lines= NULL;
+}
+
+/* ---------------------------------------------------------------- match */
+
+static int SameLine (const Line *a, const Line *b)
+{
+    return a->hash==b->hash && a->len==b->len && memcmp (a->p, b->p, a->len)==0;
+}
+
+typedef struct HashIdx {
+    unsigned long long hash;
+    long i;
+    int side;
+} HashIdx;
+
+static int CmpHashIdx (const void *x, const void *y)
+{
+    const HashIdx *a= x, *b= y;
+
+    if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+    if (a->side != b->side) return a->side - b->side;
+    return a->i < b->i ? -1 : a->i > b->i;
+}
+
+static void Match (Line *a, long alo, long ahi, Line *b, long blo, long bhi);
+
+/* the lines found once on each side, in the longest order they agree in */
+static void MatchUnique (Line *a, long alo, long ahi, Line *b, long blo, long bhi)
+{
+    HashIdx *h;
+    long n, i, k, na, *pa, *pb, *tail, *prev, len, lo, hi, mid, pai, pbj;
+
+    n= (ahi-alo) + (bhi-blo);
+    h= emalloc (n * sizeof *h);
+    for (k=0, i=alo; i<ahi; ++i, ++k) {
+        h[k].hash= a[i].hash; h[k].i= i; h[k].side= 0;
+    }
+    for (i=blo; i<bhi; ++i, ++k) {
+        h[k].hash= b[i].hash; h[k].i= i; h[k].side= 1;
+    }
+    qsort (h, n, sizeof *h, CmpHashIdx);
+
+    /* pairs (a, b), in the order of a */
+    pa= emalloc ((n/2+1) * sizeof *pa);
+    pb= emalloc ((n/2+1) * sizeof *pb);
+    for (na=0, i=0; i<n; i= k) {
+        for (k= i+1; k<n && h[k].hash==h[i].hash; ++k);
+        if (k-i==2 && h[i].side==0 && h[i+1].side==1 &&
+            SameLine (&a [h[i].i], &b [h[i+1].i])) {
+            pa[na]= h[i].i;
+            pb[na++]= h[i+1].i;
+        }
+    }
+    free (h);
+    /* sorted by a: insertion, they are nearly in order */
+    for (i=1; i<na; ++i) {
+        pai= pa[i]; pbj= pb[i];
+        for (k=i; k>0 && pa[k-1]>pai; --k) {
+            pa[k]= pa[k-1]; pb[k]= pb[k-1];
+        }
+        pa[k]= pai; pb[k]= pbj;
+    }
+
+    /* the longest increasing sequence of b (patience sorting) */
+    tail= emalloc ((na+1) * sizeof *tail);
+    prev= emalloc ((na+1) * sizeof *prev);
+    for (len=0, i=0; i<na; ++i) {
+        for (lo=0, hi=len; lo<hi; ) {
+            mid= (lo+hi)/2;
+            if (pb [tail[mid]] < pb[i]) lo= mid+1;
+            else hi= mid;
+        }
+        prev[i]= lo ? tail[lo-1] : -1;
+        tail[lo]= i;
+        if (lo==len) ++len;
+    }
+    if (len==0) {
+        free (pa); free (pb); free (tail); free (prev);
+        return;
+    }
+    /* the anchors, from the back */
+    for (k= tail[len-1], i= len; k>=0; k= prev[k]) {
+        tail[--i]= k;
+    }
+    for (i=0; i<len; ++i) {
+        k= tail[i];
+        a [pa[k]].match= pb[k];
+        b [pb[k]].match= pa[k];
+    }
+    /* between the anchors */
+    Match (a, alo, pa [tail[0]], b, blo, pb [tail[0]]);
+    for (i=1; i<len; ++i) {
+        Match (a, pa [tail[i-1]]+1, pa [tail[i]], b, pb [tail[i-1]]+1, pb [tail[i]]);
+    }
+    Match (a, pa [tail[len-1]]+1, ahi, b, pb [tail[len-1]]+1, bhi);
+    free (pa); free (pb); free (tail); free (prev);
+}
+
+static void Match (Line *a, long alo, long ahi, Line *b, long blo, long bhi)
+{
+    while (alo<ahi && blo<bhi && SameLine (&a[alo], &b[blo])) {
+        a[alo].match= blo;
+        b[blo].match= alo;
+        ++alo; ++blo;
+    }
+    while (alo<ahi && blo<bhi && SameLine (&a[ahi-1], &b[bhi-1])) {
+        --ahi; --bhi;
+        a[ahi].match= bhi;
+        b[bhi].match= ahi;
+    }
+    if (alo<ahi && blo<bhi) MatchUnique (a, alo, ahi, b, blo, bhi);
+}
+
+/* ---------------------------------------------------------------- output */
+
+/* a piece of a line: a token, an identifier, a number, a string, the
+   rest after REM/!, or one character */
+typedef struct Unit {
+    const unsigned char *p;
+    unsigned len;
+} Unit;
+
+static unsigned Units (const unsigned char *p, unsigned len, Unit *u)
+{
+    unsigned i, j, n;
+    int c;
+
+    for (n=0, i=0; i<len; i=j, ++n) {
+        c= p[i];
+        j= i+1;
+        if (c==BASIC_TOKEN_REM || c==BASIC_TOKEN_COMMENT) {
+            u[n].p= p+i;
+            u[n].len= 1;
+            if (j<len) {
+                ++n;
+                u[n].p= p+j;
+                u[n].len= len-j;
+            }
+            return n+1;
+        } else if (c=='"') {
+            while (j<len && p[j]!='"') ++j;
+            if (j<len) ++j;
+        } else if (isalpha (c)) {
+            while (j<len && isalnum (p[j])) ++j;
+            if (j<len && p[j]=='$') ++j;
+        } else if (isdigit (c) || c=='.') {
+            while (j<len && (isdigit (p[j]) || p[j]=='.')) ++j;
+        }
+        u[n].p= p+i;
+        u[n].len= j-i;
+    }
+    return n;
+}
+
+static int SameUnit (const Unit *a, const Unit *b)
+{
+    return a->len==b->len && memcmp (a->p, b->p, a->len)==0;
+}
+
+/* the bytes of a line, the tokens as keywords (not in strings, comments
+   and DATA: the state as in Cas2Bas); g==NULL: the state only */
+static void PutText (FILE *g, const unsigned char *p, unsigned len, int *state)
+{
+    unsigned i;
+    int c;
+
+    for (i=0; i<len; ++i) {
+        c= p[i];
+        if (g==NULL) {
+        } else if (*state==0 && c>=BASIC_TOKEN_START && c<=BASIC_TOKEN_END) {
+            fputs (basic_token_names [c-BASIC_TOKEN_START], g);
+        } else if (c>=0x20 && c<0x7f && c!='\\') {
+            putc (c, g);
+        } else if (c=='\\') {
+            fputs ("\\\\", g);
+        } else {
+            fprintf (g, "\\x%02x", c);
+        }
+        if (c=='"') *state ^= 1;
+        else if ((*state&1)==0) {
+            if (c==BASIC_TOKEN_DATA) *state |= 2;
+            else if (c==BASIC_TOKEN_COLON) *state &= ~2;
+            else if (c==BASIC_TOKEN_COMMENT || c==BASIC_TOKEN_REM) *state |= 4;
+        }
+    }
+}
+
+static void PutLine (char mark, const Line *l)
+{
+    int state= 0;
+
+    printf ("%c %4u ", mark, l->no);
+    PutText (stdout, l->p, l->len, &state);
+    putchar ('\n');
+}
+
+/* a changed line: [-old-]{+new+}, by the longest common sequence of units */
+static void PutChanged (const Line *a, const Line *b)
+{
+    static unsigned short lcs [257][257];
+    Unit ua [256], ub [256];
+    unsigned na, nb, i, j;
+    int sa, sb;
+
+    na= Units (a->p, a->len, ua);
+    nb= Units (b->p, b->len, ub);
+    for (i=na+1; i-->0; ) {
+        for (j=nb+1; j-->0; ) {
+            if (i==na || j==nb) lcs[i][j]= 0;
+            else if (SameUnit (&ua[i], &ub[j])) lcs[i][j]= lcs[i+1][j+1]+1;
+            else lcs[i][j]= lcs[i+1][j] > lcs[i][j+1] ? lcs[i+1][j] : lcs[i][j+1];
+        }
+    }
+    if (a->no==b->no) printf ("~ %4u ", a->no);
+    else              printf ("~ %4u>%u ", a->no, b->no);
+    for (sa=sb=0, i=j=0; i<na || j<nb; ) {
+        if (i<na && j<nb && SameUnit (&ua[i], &ub[j])) {
+            PutText (stdout, ua[i].p, ua[i].len, &sa);
+            PutText (NULL, ub[j].p, ub[j].len, &sb);
+            ++i; ++j;
+        } else if (i<na && (j==nb || lcs[i+1][j] >= lcs[i][j+1])) {
+            fputs ("[-", stdout);
+            PutText (stdout, ua[i].p, ua[i].len, &sa);
+            fputs ("-]", stdout);
+            ++i;
+        } else {
+            fputs ("{+", stdout);
+            PutText (stdout, ub[j].p, ub[j].len, &sb);
+            fputs ("+}", stdout);
+            ++j;
+        }
+    }
+    putchar ('\n');
+}
+
+static void PutHex (const unsigned char *p, long len)
+{
+    long i;
+
+    for (i=0; i<len && i<16; ++i) printf ("%s%02x", i ? " " : "", p[i]);
+    if (len>16) printf (" ...");
+    if (len==0) printf ("(none)");
+}
+
+/* the BYTES: the differing ranges of the common length, then the rest;
+   an insertion or deletion in the middle is found by the common tail */
+static int BytesDiff (const Prog *a, const Prog *b)
+{
+    long head, tail, i, j, na, nb;
+
+    if (a->nbytes==b->nbytes && memcmp (a->bytes, b->bytes, a->nbytes)==0) return 0;
+    if (opt.quiet) return 1;
+    printf ("# BYTES: %ld -> %ld bytes\n", a->nbytes, b->nbytes);
+    na= a->nbytes;
+    nb= b->nbytes;
+    for (head=0; head<na && head<nb && a->bytes[head]==b->bytes[head]; ++head);
+    for (tail=0; tail<na-head && tail<nb-head &&
+                 a->bytes[na-1-tail]==b->bytes[nb-1-tail]; ++tail);
+    if (na==nb) {
+        /* the same length: the ranges that differ */
+        for (i=head; i<na-tail; i=j) {
+            for (; i<na-tail && a->bytes[i]==b->bytes[i]; ++i);
+            if (i>=na-tail) break;
+            for (j=i; j<na-tail && a->bytes[j]!=b->bytes[j]; ++j);
+            printf ("@ %04lx: ", (unsigned long)(BASIC_PROGBASE + a->bytesoff + i));
+            PutHex (a->bytes+i, j-i);
+            printf (" -> ");
+            PutHex (b->bytes+i, j-i);
+            putchar ('\n');
+        }
+    } else {
+        printf ("@ %04lx: ", (unsigned long)(BASIC_PROGBASE + a->bytesoff + head));
+        PutHex (a->bytes+head, na-tail-head);
+        printf (" -> ");
+        PutHex (b->bytes+head, nb-tail-head);
+        putchar ('\n');
+    }
+    return 1;
+}
+
+static int HeaderDiff (const Prog *a, const Prog *b)
+{
+    int n= 0;
+
+    if (a->cd.autorun != b->cd.autorun) {
+        if (!opt.quiet) printf ("# autorun: %02x -> %02x\n", a->cd.autorun, b->cd.autorun);
+        ++n;
+    }
+    if (a->cd.type != b->cd.type) {
+        if (!opt.quiet) printf ("# type: %02x -> %02x\n", a->cd.type, b->cd.type);
+        ++n;
+    }
+    if (a->cd.version != b->cd.version) {
+        if (!opt.quiet) printf ("# version: %02x -> %02x\n", a->cd.version, b->cd.version);
+        ++n;
+    }
+    return n;
+}
+
+/* the lines between two matched ones: paired by number, or inserted/deleted */
+static void Gap (Prog *a, long alo, long ahi, Prog *b, long blo, long bhi, Stats *st)
+{
+    long i, j;
+
+    for (i=alo, j=blo; i<ahi || j<bhi; ) {
+        if (i<ahi && j<bhi && a->lines[i].no==b->lines[j].no) {
+            if (!opt.quiet) PutChanged (&a->lines[i], &b->lines[j]);
+            ++st->changed;
+            ++i; ++j;
+        } else if (j<bhi && (i==ahi || b->lines[j].no < a->lines[i].no)) {
+            if (!opt.quiet) PutLine ('+', &b->lines[j]);
+            ++st->inserted;
+            ++j;
+        } else {
+            if (!opt.quiet) PutLine ('-', &a->lines[i]);
+            ++st->deleted;
+            ++i;
+        }
+    }
+}
+
+/* 0 same, 1 different, 2 error */
+static int Diff (const char *oldname, const char *newname)
+{
+    Prog a, b;
+    Stats st;
+    long i, j, ni, nj;
+    int rc;
+
+    if (LoadProg (&a, oldname)) {
+        FreeProg (&a);
+        return 2;
+    }
+    if (LoadProg (&b, newname)) {
+        FreeProg (&a);
+        FreeProg (&b);
+        return 2;
+    }
+    memset (&st, 0, sizeof st);
+    Match (a.lines, 0, a.nlines, b.lines, 0, b.nlines);
+
+    if (!opt.quiet) printf ("--- %s\n+++ %s\n", oldname, newname);
+    st.header= HeaderDiff (&a, &b);
+    for (i=0, j=0; i<a.nlines || j<b.nlines; i= ni+1, j= nj+1) {
+        /* the next matched pair (the matches are in order: a moved line
+           is deleted and inserted) */
+        for (ni=i; ni<a.nlines && a.lines[ni].match < 0; ++ni);
+        nj= ni<a.nlines ? a.lines[ni].match : b.nlines;
+        Gap (&a, i, ni, &b, j, nj, &st);
+        if (ni<a.nlines && a.lines[ni].no != b.lines[nj].no) {
+            if (!opt.quiet) printf ("= %4u>%u\n", a.lines[ni].no, b.lines[nj].no);
+            ++st.renumbered;
+        }
+    }
+    st.bytes= BytesDiff (&a, &b);
+
+    rc= st.header || st.bytes || st.changed || st.inserted || st.deleted || st.renumbered;
+    printf ("%s %s: %s, %ld changed, %ld inserted, %ld deleted, %ld renumbered%s%s\n",
+        oldname, newname, rc ? "differ" : "same",
+        st.changed, st.inserted, st.deleted, st.renumbered,
+        st.header ? ", header differs" : "", st.bytes ? ", BYTES differ" : "");
+    FreeProg (&a);
+    FreeProg (&b);
+    return rc;
+}
+
+/* -pairs: the worst of the results */
+static int Pairs (const char *list)
+{
+    char line [2048], *o, *n, *e;
+    FILE *f;
+    int rc, r;
+
+    f= strcmp (list, "-")==0 ? stdin : efopen (list, "r");
+    rc= 0;
+    while (fgets (line, sizeof line, f)) {
+        for (e= line+strlen (line); e>line && isspace ((unsigned char)e[-1]); --e);
+        *e= '\0';
+        for (o= line; isspace ((unsigned char)*o); ++o);
+        if (*o=='\0' || *o=='#') continue;
+        for (n= o; *n && !isspace ((unsigned char)*n); ++n);
+        if (*n) *n++= '\0';
+        while (isspace ((unsigned char)*n)) ++n;
+        if (*n=='\0') {
+            fprintf (stderr, "%s: a pair is needed: '%s'\n", list, o);
+            rc= 2;
+            continue;
+        }
+        r= Diff (o, n);
+        if (r > rc) rc= r;
+    }
+    if (f != stdin) fclose (f);
+    return rc;
+}
+
+/* ---------------------------------------------------------------- misc */
+
+static void ParseArgs (int *pargc, char ***pargv)
+{
+    int argc;
+    char **argv;
+    int parse_arg;
+    char *arg;
+
+    argc = *pargc;
+    argv = *pargv;
+    parse_arg = 1;
+    opt.progname = argv[0];
+
+    while (--argc && **++argv=='-' && parse_arg) {
+        arg= strchr (argv[0], '=');
+        arg= arg ? arg+1 : "";
+        switch (argv[0][1]) {
+        case 'p': case 'P':
+            if (strncasecmp (argv[0], "-pairs=", 7)==0) {
+                opt.pairs= arg;
+                break;
+            } goto UNKOPT;
+
+        case 'q': case 'Q':
+            if (strcasecmp (argv[0], "-q")==0) {
+                opt.quiet= 1;
+                break;
+            } goto UNKOPT;
+
+        case 0: case '-': parse_arg = 0; break;
+        default:
+UNKOPT:
+            fprintf (stderr, "Unknown option '%s'\n", *argv);
+            exit (4);
+        }
+    }
+    ++argc;
+    *--argv = (char *)opt.progname;
+    *pargc = argc;
+    *pargv = argv;
+}
@@ -0,0 +1,132 @@
+/* casfile.c */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#endif
+
+#include "tvc.h"
+#include "casfile.h"
+
+FILE *efopen (const char *name, const char *mode)
+{
+    FILE *f;
+
+    f = fopen (name, mode);
+    if (f) return f;
+    fprintf (stderr, "Error opening file '%s' mode '%s",
+             name, mode);
+    perror ("'");
+    exit (32);
+    return NULL;
+}
+
+void *emalloc (size_t n)
+{
+    void *p;
+
+    p = malloc (n);
+    if (p) return p;
+    fprintf (stderr, "Out of memory (malloc (%lu))\n", (unsigned long)n);
+    exit (33);
+    return NULL;
+}
+
+void *erealloc (void *p, size_t n)
+{
+    p = realloc (p, n);
+    if (p) return p;
+    fprintf (stderr, "Out of memory (realloc (%lu))\n", (unsigned long)n);
+    exit (33);
+    return NULL;
+}
+
+int CmpStr (const void *a, const void *b)
+{
+    return strcmp (*(char * const *)a, *(char * const *)b);
+}
+
+int IsCasName (const char *name)
+{
+    size_t len= strlen (name);
+
+    return len>4 && strcasecmp (name+len-4, ".cas")==0;
+}
+
+void AddPath (const char *path, int top, void (*add) (const char *name))
+{
+    struct stat st;
+    DIR *d;
+    struct dirent *de;
+    char **names, *full;
+    size_t nnames, maxnames, i;
+
+    if (stat (path, &st)) {
+        fprintf (stderr, "Error reading '%s", path);
+        perror ("'");
+        exit (32);
+    }
+    if (!S_ISDIR (st.st_mode)) {
+        if (top || IsCasName (path)) add (path);
+        return;
+    }
+    d= opendir (path);
+    if (!d) {
+        fprintf (stderr, "Error reading directory '%s", path);
+        perror ("'");
+        exit (32);
+    }
+    names= NULL;
+    nnames= maxnames= 0;
+    while ((de= readdir (d)) != NULL) {
+        if (de->d_name[0]=='.') continue;
+        if (nnames == maxnames) {
+            maxnames= maxnames ? 2*maxnames : 64;
+            names= erealloc (names, maxnames * sizeof *names);
+        }
+        full= emalloc (strlen (path)+1+strlen (de->d_name)+1);
+        sprintf (full, "%s/%s", path, de->d_name);
+        names [nnames++]= full;
+    }
+    closedir (d);
+    qsort (names, nnames, sizeof *names, CmpStr);
+    for (i=0; i<nnames; ++i) {
+        AddPath (names[i], 0, add);
+        free (names[i]);
+    }
+    free (names);
+}
+
+unsigned long long FnvHash (const unsigned char *p, unsigned long len)
+{
+    unsigned long long h= 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+int NextLine (const unsigned char **pp, const unsigned char *prglim, CasLine *l)
+{
+    const unsigned char *p= *pp;
+    const BASLINE *bl;
+
+    if (p+sizeof (BASLINE) > prglim || *p == BASIC_PRGEND) return 0;
+    bl= (const BASLINE *)p;
+    if (bl->len < sizeof (BASLINE) || p + bl->len > prglim) return -1;
+    l->no= bl->no[0] + (bl->no[1] << 8);
+    l->line= p;
+    l->next= p + bl->len;
+    l->p= p + sizeof (BASLINE);
+    l->len= bl->len - sizeof (BASLINE);
+    if (l->len && l->p[l->len-1]==BASIC_LINEND) --l->len;
+    *pp= l->next;
+    return 1;
+}
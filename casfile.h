@@ -0,0 +1,41 @@
+/* casfile.h */
+
+#ifndef CASFILE_H
+#define CASFILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* what the tools reading many CAS-files share (casidx, casarc, casdiff,
+   casclone): the files of the arguments, the lines of a program, and
+   the functions exiting on an error */
+
+FILE *efopen (const char *name, const char *mode);     /* exit (32) */
+void *emalloc (size_t n);                               /* exit (33) */
+void *erealloc (void *p, size_t n);
+
+int CmpStr (const void *a, const void *b);              /* qsort of char * */
+int IsCasName (const char *name);                       /* *.cas, any case */
+
+/* a file is given to add; a directory: the *.cas files in it and below,
+   sorted, top is 0 for them (a file given by name is added whatever its
+   name is) */
+void AddPath (const char *path, int top, void (*add) (const char *name));
+
+/* FNV-1a, 64 bit */
+unsigned long long FnvHash (const unsigned char *p, unsigned long len);
+
+/* a line of a program in a CAS-file (BASLINE-stream, not detokenized) */
+typedef struct CasLine {
+    unsigned no;
+    const unsigned char *line;  /* the BASLINE */
+    const unsigned char *p;     /* the body, without the BASIC_LINEND */
+    unsigned len;
+    const unsigned char *next;  /* the next BASLINE */
+} CasLine;
+
+/* the line at *pp, then *pp is the next one: 1 a line, 0 the end of the
+   program (BASIC_PRGEND or prglim), -1 a broken line (*pp stays) */
+int NextLine (const unsigned char **pp, const unsigned char *prglim, CasLine *l);
+
+#endif
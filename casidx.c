@@ -0,0 +1,642 @@
+/* casidx.c */
+
+/* inverted index over a collection of CAS-files: the programs are read
+   as BASLINE-streams (no detokenizing), and the tokens, the identifiers
+   and the integer literals are indexed with the (file, line number)
+   where they are found; strings, comments and DATA are skipped the same
+   way as in Cas2Bas (casbas.c). The index is a single file, queried
+   through mmap.
+
+   index-file (the numbers are little endian, 4 bytes):
+     header   magic "CASIDX1\0", nfiles, nkeys, npost, nstr,
+              offset of files, keys, postings, strings
+     files    nfiles * (offset of the name in strings)
+     keys     nkeys * (kind, value, first posting, number of postings),
+              sorted by kind, then value (identifiers: by name)
+     postings npost * (file, line number), sorted
+     strings  the names, '\0'-terminated
+   value: the token (KIND_TOKEN), the number (KIND_NUMBER), the offset
+   of the name in strings (KIND_IDENT) */
+
+#include <errno.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
+#endif
+
+#include "tvc.h"
+#include "casfile.h"
+
+#define KIND_TOKEN  1
+#define KIND_NUMBER 2
+#define KIND_IDENT  3
+
+#define IDX_MAGIC   "CASIDX1"
+#define IDX_HDRSIZE 40
+#define IDX_KEYSIZE 16
+#define IDX_MAXID   64          /* longer identifiers are cut */
+#define IDX_IDLEN   (IDX_MAXID-2)   /* the characters kept, then the '$' and a '\0' */
+
+static struct {
+    const char *progname;
+    const char *build;  /* -build=INDEX */
+    int files;          /* -files: the files only, a term anywhere in the file */
+    int verbose;
+} opt = {
+    NULL, NULL, 0, 0
+};
+
+/* building: one entry per occurrence, sorted and made unique at the end */
+typedef struct Occ {
+    unsigned kind;
+    unsigned long val;  /* KIND_IDENT: the number of the identifier (Ident) */
+    unsigned file;
+    unsigned line;
+} Occ;
+
+static struct {
+    char **files;
+    unsigned nfiles, maxfiles;
+    Occ *occ;
+    unsigned long nocc, maxocc;
+    char **ident;       /* the identifiers, in the order they are found */
+    unsigned long nident, maxident;
+    unsigned long *hash;    /* open addressing, identifier+1 (0: empty) */
+    unsigned long hashsize;
+    unsigned long *rank;    /* identifier -> place in the sorted order */
+} B;
+
+/* querying */
+typedef struct Index {
+    const unsigned char *map;
+    size_t size;
+    unsigned long nfiles, nkeys, npost, nstr;
+    const unsigned char *files, *keys, *post;
+    const char *str;
+} Index;
+
+static void ParseArgs (int *pargc, char ***pargv);
+
+static void Build (int n, char **paths);
+static void AddFile (const char *name);
+static void ScanCas (const char *name, unsigned file);
+static void WriteIndex (const char *name);
+
+static void OpenIndex (Index *ix, const char *name);
+static int Query (const Index *ix, int nterm, char **terms);
+
+int main (int argc, char **argv)
+{
+    Index ix;
+
+    ParseArgs (&argc, &argv);
+    if (opt.build) {
+        if (argc<2) goto USAGE;
+        Build (argc-1, argv+1);
+        return 0;
+    }
+    if (argc<3) {
+USAGE:  fprintf (stderr, "usage: casidx -build=<index> <file.cas>|<dir>...\n"
+            "       casidx [-files] [-v] <index> <term>...\n"
+            "term:  a keyword (POKE), an identifier (A$), a number (16384)\n"
+            "       or a range of numbers (2000-2100); the lines (-files: the\n"
+            "       files) having all the terms are listed\n");
+        exit (8);
+    }
+    OpenIndex (&ix, argv[1]);
+    return Query (&ix, argc-2, argv+2) ? 0 : 1;
+}
+
+/* ---------------------------------------------------------------- build */
+
+static void Build (int n, char **paths)
+{
+    unsigned i;
+    int k;
+
+    for (k=0; k<n; ++k) {
+        AddPath (paths[k], 1, AddFile);
+    }
+    /* the files of a directory are sorted, the order of the arguments is kept */
+    for (i=0; i<B.nfiles; ++i) {
+        ScanCas (B.files[i], i);
+    }
+    WriteIndex (opt.build);
+}
+
+static void AddFile (const char *name)
+{
+    if (B.nfiles == B.maxfiles) {
+        B.maxfiles= B.maxfiles ? 2*B.maxfiles : 256;
+        B.files= erealloc (B.files, B.maxfiles * sizeof *B.files);
+    }
+    B.files [B.nfiles++]= strcpy (emalloc (strlen (name)+1), name);
+}
+
+static void AddOcc (unsigned kind, unsigned long val, unsigned file, unsigned line)
+{
+    Occ *o;
+
+    if (B.nocc == B.maxocc) {
+        B.maxocc= B.maxocc ? 2*B.maxocc : 65536;
+        B.occ= erealloc (B.occ, B.maxocc * sizeof *B.occ);
+    }
+    o= &B.occ [B.nocc++];
+    o->kind= kind;
+    o->val= val;
+    o->file= file;
+    o->line= line;
+}
+
+static unsigned long HashStr (const char *s, size_t len)
+{
+    unsigned long h= 5381;
+
+    while (len--) h= h*33 + (unsigned char)*s++;
+    return h;
+}
+
+/* the number of the identifier, a new one if it isn't known yet */
+static unsigned long Ident (const char *s, size_t len)
+{
+    unsigned long h, i, *old, oldsize, id;
+
+    if (2*(B.nident+1) > B.hashsize) {
+        old= B.hash;
+        oldsize= B.hashsize;
+        B.hashsize= oldsize ? 2*oldsize : 1024;
+        B.hash= emalloc (B.hashsize * sizeof *B.hash);
+        memset (B.hash, 0, B.hashsize * sizeof *B.hash);
+        for (i=0; i<oldsize; ++i) {
+            if (old[i]==0) continue;
+            id= old[i]-1;
+            h= HashStr (B.ident[id], strlen (B.ident[id])) & (B.hashsize-1);
+            while (B.hash[h]) h= (h+1) & (B.hashsize-1);
+            B.hash[h]= id+1;
+        }
+        free (old);
+    }
+    for (h= HashStr (s, len) & (B.hashsize-1); B.hash[h]; h= (h+1) & (B.hashsize-1)) {
+        id= B.hash[h]-1;
+        if (strncmp (B.ident[id], s, len)==0 && B.ident[id][len]=='\0') return id;
+    }
+    if (B.nident == B.maxident) {
+        B.maxident= B.maxident ? 2*B.maxident : 1024;
+        B.ident= erealloc (B.ident, B.maxident * sizeof *B.ident);
+    }
+    B.ident [B.nident]= emalloc (len+1);
+    memcpy (B.ident [B.nident], s, len);
+    B.ident [B.nident][len]= '\0';
+    B.hash[h]= B.nident+1;
+    return B.nident++;
+}
+
+#define IS_IDSTART(c) (((c)>='A' && (c)<='Z') || ((c)>='a' && (c)<='z'))
+#define IS_IDCHAR(c)  (IS_IDSTART(c) || ((c)>='0' && (c)<='9'))
+
+/* the tokens, identifiers and numbers of one line, outside of the
+   strings, comments and DATA (see Cas2Bas) */
+static void ScanLine (const unsigned char *p, const unsigned char *pend,
+                      unsigned file, unsigned line)
+{
+    const unsigned char *q;
+    char id [IDX_MAXID];
+    unsigned long num;
+    size_t len;
+    int state, c, over;
+
+    for (state= 0; p<pend; ) {
+        c= *p;
+        if (state!=0) {
+            ++p;
+            if (c=='"') state ^= 1;
+            else if ((state&1)==0 && (state&2) && c==BASIC_TOKEN_COLON) state &= ~2;
+            continue;
+        }
+        if (c>=BASIC_TOKEN_START && c<=BASIC_TOKEN_END) {
+            AddOcc (KIND_TOKEN, c, file, line);
+            ++p;
+            if (c==BASIC_TOKEN_DATA) state |= 2;
+            else if (c==BASIC_TOKEN_COMMENT || c==BASIC_TOKEN_REM) state |= 4;
+            continue;
+        }
+        if (c=='"') {
+            state ^= 1;
+            ++p;
+            continue;
+        }
+        if (IS_IDSTART (c)) {
+            for (q= p, len= 0; q<pend && IS_IDCHAR (*q); ++q) {
+                if (len < IDX_IDLEN) id [len++]= (char)toupper (*q);
+            }
+            if (q<pend && *q=='$') {
+                id [len++]= '$';
+                ++q;
+            }
+            AddOcc (KIND_IDENT, Ident (id, len), file, line);
+            p= q;
+            continue;
+        }
+        if (isdigit (c)) {
+            for (num= 0, over= 0; p<pend && isdigit (*p); ++p) {
+                if (num > (0xffffffffUL - (*p-'0')) / 10) over= 1;
+                else num= num*10 + (*p-'0');
+            }
+            /* 1.5, 1E3: not an integer */
+            if (p<pend && (*p=='.' || *p=='E' || *p=='e')) {
+                while (p<pend && (isalnum (*p) || *p=='.')) ++p;
+                continue;
+            }
+            if (!over) AddOcc (KIND_NUMBER, num, file, line);
+            continue;
+        }
+        ++p;
+    }
+}
+
+static void ScanCas (const char *name, unsigned file)
+{
+    CASHDR ch;
+    unsigned char *prg;
+    const unsigned char *prglim, *p;
+    CasLine l;
+    unsigned prgsize, n;
+    int rc;
+    FILE *f;
+
+    f= efopen (name, "rb");
+    if (fread (&ch, 1, sizeof ch, f) != sizeof ch ||
+        ch.cph.magic != CPMHDR_MAGIC || ch.pfh.magic != PRGFILE_MAGIC ||
+        ch.pfh.type != PRGFILE_TYPE_PROG) {
+        fprintf (stderr, "%s: not a CAS-file with a program, skipped\n", name);
+        fclose (f);
+        return;
+    }
+    prgsize= PEEK2 (ch.pfh.prgsize);
+    prg= emalloc (prgsize ? prgsize : 1);
+    prgsize= fread (prg, 1, prgsize, f);
+    fclose (f);
+
+    prglim= prg + prgsize;
+    n= 0;
+    p= prg;
+    while ((rc= NextLine (&p, prglim, &l)) > 0) {
+        ScanLine (l.p, l.p + l.len, file, l.no);
+        ++n;
+    }
+    if (rc<0) fprintf (stderr, "%s: broken BASIC program after %u lines\n", name, n);
+    free (prg);
+    if (opt.verbose) fprintf (stderr, "%s: %u lines\n", name, n);
+}
+
+static int CmpIdent (const void *a, const void *b)
+{
+    return strcmp (B.ident [*(const unsigned long *)a], B.ident [*(const unsigned long *)b]);
+}
+
+static int CmpOcc (const void *a, const void *b)
+{
+    const Occ *x= a, *y= b;
+    unsigned long vx, vy;
+
+    if (x->kind != y->kind) return x->kind < y->kind ? -1 : 1;
+    vx= x->kind==KIND_IDENT ? B.rank [x->val] : x->val;
+    vy= y->kind==KIND_IDENT ? B.rank [y->val] : y->val;
+    if (vx != vy) return vx < vy ? -1 : 1;
+    if (x->file != y->file) return x->file < y->file ? -1 : 1;
+    if (x->line != y->line) return x->line < y->line ? -1 : 1;
+    return 0;
+}
+
+static void Put4 (FILE *g, unsigned long v)
+{
+    unsigned char b [4];
+
+    POKE4 (b, v);
+    fwrite (b, 1, 4, g);
+}
+
+static void WriteIndex (const char *name)
+{
+    unsigned long *order, *stroff, i, j, k, nkeys, npost, nstr, pos;
+    unsigned long offfiles, offkeys, offpost, offstr;
+    FILE *g;
+
+    /* identifiers: sorted by name, so are the keys */
+    order= emalloc ((B.nident ? B.nident : 1) * sizeof *order);
+    B.rank= emalloc ((B.nident ? B.nident : 1) * sizeof *B.rank);
+    stroff= emalloc ((B.nident ? B.nident : 1) * sizeof *stroff);
+    for (i=0; i<B.nident; ++i) order[i]= i;
+    qsort (order, B.nident, sizeof *order, CmpIdent);
+    for (i=0; i<B.nident; ++i) B.rank [order[i]]= i;
+
+    qsort (B.occ, B.nocc, sizeof *B.occ, CmpOcc);
+    for (i=0, j=0; i<B.nocc; ++i) {     /* a line once per key */
+        if (j && CmpOcc (&B.occ[j-1], &B.occ[i])==0) continue;
+        B.occ[j++]= B.occ[i];
+    }
+    npost= B.nocc= j;
+    for (i=0, nkeys=0; i<npost; ++i) {
+        if (i==0 || B.occ[i].kind != B.occ[i-1].kind || B.occ[i].val != B.occ[i-1].val) ++nkeys;
+    }
+
+    nstr= 0;
+    for (i=0; i<B.nfiles; ++i) nstr += strlen (B.files[i])+1;
+    for (i=0; i<B.nident; ++i) {
+        stroff [order[i]]= nstr;
+        nstr += strlen (B.ident [order[i]])+1;
+    }
+
+    offfiles= IDX_HDRSIZE;
+    offkeys= offfiles + 4*B.nfiles;
+    offpost= offkeys + IDX_KEYSIZE*nkeys;
+    offstr= offpost + 8*npost;
+
+    g= efopen (name, "wb");
+    fwrite (IDX_MAGIC, 1, 8, g);
+    Put4 (g, B.nfiles);
+    Put4 (g, nkeys);
+    Put4 (g, npost);
+    Put4 (g, nstr);
+    Put4 (g, offfiles);
+    Put4 (g, offkeys);
+    Put4 (g, offpost);
+    Put4 (g, offstr);
+
+    for (i=0, pos=0; i<B.nfiles; ++i) {
+        Put4 (g, pos);
+        pos += strlen (B.files[i])+1;
+    }
+    for (i=0; i<npost; i= k) {
+        for (k= i+1; k<npost && B.occ[k].kind==B.occ[i].kind && B.occ[k].val==B.occ[i].val; ++k);
+        Put4 (g, B.occ[i].kind);
+        Put4 (g, B.occ[i].kind==KIND_IDENT ? stroff [B.occ[i].val] : B.occ[i].val);
+        Put4 (g, i);
+        Put4 (g, k-i);
+    }
+    for (i=0; i<npost; ++i) {
+        Put4 (g, B.occ[i].file);
+        Put4 (g, B.occ[i].line);
+    }
+    for (i=0; i<B.nfiles; ++i) fwrite (B.files[i], 1, strlen (B.files[i])+1, g);
+    for (i=0; i<B.nident; ++i) fwrite (B.ident [order[i]], 1, strlen (B.ident [order[i]])+1, g);
+    if (fclose (g)) {
+        fprintf (stderr, "Error writing '%s", name);
+        perror ("'");
+        exit (32);
+    }
+    fprintf (stderr, "%s: %u files, %lu keys (%lu identifiers), %lu postings, %lu bytes\n",
+        name, B.nfiles, nkeys, B.nident, npost, offstr+nstr);
+    free (order);
+    free (stroff);
+}
+
+/* ---------------------------------------------------------------- query */
+
+static void OpenIndex (Index *ix, const char *name)
+{
+    struct stat st;
+    const unsigned char *m;
+    unsigned long offfiles, offkeys, offpost, offstr;
+    int fd;
+
+    fd= open (name, O_RDONLY);
+    if (fd<0 || fstat (fd, &st)) {
+        fprintf (stderr, "Error opening file '%s", name);
+        perror ("'");
+        exit (32);
+    }
+    ix->size= st.st_size;
+    if (ix->size < IDX_HDRSIZE) goto BAD;
+    ix->map= mmap (NULL, ix->size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (ix->map==MAP_FAILED) {
+        perror ("mmap");
+        exit (32);
+    }
+    m= ix->map;
+    if (memcmp (m, IDX_MAGIC, 8)) goto BAD;
+    ix->nfiles= PEEK4 (m+8);
+    ix->nkeys= PEEK4 (m+12);
+    ix->npost= PEEK4 (m+16);
+    ix->nstr= PEEK4 (m+20);
+    offfiles= PEEK4 (m+24);
+    offkeys= PEEK4 (m+28);
+    offpost= PEEK4 (m+32);
+    offstr= PEEK4 (m+36);
+    if (offfiles + 4*ix->nfiles > ix->size || offkeys + IDX_KEYSIZE*ix->nkeys > ix->size ||
+        offpost + 8*ix->npost > ix->size || offstr + ix->nstr != ix->size ||
+        (ix->nstr && m[ix->size-1] != '\0')) goto BAD;
+    ix->files= m + offfiles;
+    ix->keys= m + offkeys;
+    ix->post= m + offpost;
+    ix->str= (const char *)m + offstr;
+    return;
+
+BAD:
+    fprintf (stderr, "%s: not an index made by casidx\n", name);
+    exit (16);
+}
+
+/* <0, 0, >0: the key k is before, at, after (kind, val/name) */
+static int CmpKey (const Index *ix, unsigned long k, unsigned kind,
+                   unsigned long val, const char *name)
+{
+    const unsigned char *p= ix->keys + IDX_KEYSIZE*k;
+    unsigned long kk= PEEK4 (p), kv= PEEK4 (p+4);
+
+    if (kk != kind) return kk < kind ? -1 : 1;
+    if (kind==KIND_IDENT) return strcmp (ix->str + kv, name);
+    return kv < val ? -1 : kv > val;
+}
+
+/* the first key not before (kind, val/name) */
+static unsigned long LowerKey (const Index *ix, unsigned kind, unsigned long val, const char *name)
+{
+    unsigned long lo= 0, hi= ix->nkeys, mid;
+
+    while (lo < hi) {
+        mid= lo + (hi-lo)/2;
+        if (CmpKey (ix, mid, kind, val, name) < 0) lo= mid+1;
+        else hi= mid;
+    }
+    return lo;
+}
+
+/* a posting as one number: file and line, in the order of the postings */
+typedef unsigned long long Hit;
+
+static int CmpHit (const void *a, const void *b)
+{
+    Hit x= *(const Hit *)a, y= *(const Hit *)b;
+
+    return x<y ? -1 : x>y;
+}
+
+/* the postings of a term, sorted, unique; -files: the line is 0 */
+static Hit *TermHits (const Index *ix, const char *term, unsigned long *nhits)
+{
+    unsigned long k, kfirst, klim, i, n, max, lo, hi;
+    const unsigned char *p;
+    const char *dash;
+    char name [IDX_MAXID], *e;
+    unsigned kind;
+    Hit *h, x;
+    int t;
+    size_t len, j;
+
+    kind= 0;
+    lo= hi= 0;
+    name[0]= '\0';
+    if (isdigit ((unsigned char)term[0])) {
+        kind= KIND_NUMBER;
+        lo= hi= strtoul (term, &e, 10);
+        dash= e;
+        if (*dash=='-') hi= strtoul (dash+1, &e, 10);
+        if (*e != '\0' || hi < lo) {
+            fprintf (stderr, "Bad number or range '%s'\n", term);
+            exit (8);
+        }
+    } else {
+        /* a keyword (the spaces around it don't count), else an identifier */
+        for (len= strlen (term); len && term[len-1]==' '; --len);
+        for (t= BASIC_TOKEN_START; t<=BASIC_TOKEN_END; ++t) {
+            const char *kw= basic_token_names [t-BASIC_TOKEN_START];
+            size_t kl;
+
+            while (*kw==' ') ++kw;
+            for (kl= strlen (kw); kl && kw[kl-1]==' '; --kl);
+            if (kl==len && strncasecmp (kw, term, len)==0) break;
+        }
+        if (t<=BASIC_TOKEN_END) {
+            kind= KIND_TOKEN;
+            lo= hi= t;
+        } else {
+            kind= KIND_IDENT;
+            /* cut as in ScanLine: the '$' is kept */
+            for (len=0, j=0; term[j] && (term[j]!='$' || term[j+1]); ++j) {
+                if (len < IDX_IDLEN) name[len++]= (char)toupper ((unsigned char)term[j]);
+            }
+            if (term[j]=='$') name[len++]= '$';
+            name[len]= '\0';
+        }
+    }
+
+    k= LowerKey (ix, kind, lo, name);
+    if (kind==KIND_IDENT) klim= k < ix->nkeys && CmpKey (ix, k, kind, 0, name)==0 ? k+1 : k;
+    else                  klim= LowerKey (ix, kind, hi+1, name);
+    if (hi==0xffffffffUL && kind==KIND_NUMBER) klim= LowerKey (ix, KIND_NUMBER+1, 0, name);
+
+    kfirst= k;
+    for (n= 0, i= k; i<klim; ++i) n += PEEK4 (ix->keys + IDX_KEYSIZE*i + 12);
+    max= n;
+    h= emalloc ((max ? max : 1) * sizeof *h);
+    for (n= 0; k<klim; ++k) {
+        p= ix->keys + IDX_KEYSIZE*k;
+        for (i= PEEK4 (p+8); i < PEEK4 (p+8) + PEEK4 (p+12) && i < ix->npost; ++i) {
+            x= (Hit)PEEK4 (ix->post + 8*i) << 32;
+            if (!opt.files) x |= PEEK4 (ix->post + 8*i + 4);
+            h [n++]= x;
+        }
+    }
+    /* a range: the postings of more keys, merged */
+    if (klim - kfirst > 1 || opt.files) qsort (h, n, sizeof *h, CmpHit);
+    for (i=0, max=0; i<n; ++i) {
+        if (max && h[max-1]==h[i]) continue;
+        h[max++]= h[i];
+    }
+    *nhits= max;
+    return h;
+}
+
+static int Query (const Index *ix, int nterm, char **terms)
+{
+    Hit *res, *h;
+    unsigned long nres, nh, i, j, r;
+    unsigned long file;
+    int t;
+
+    res= TermHits (ix, terms[0], &nres);
+    for (t=1; t<nterm && nres; ++t) {
+        h= TermHits (ix, terms[t], &nh);
+        for (i=0, j=0, r=0; i<nres && j<nh; ) {
+            if (res[i] < h[j]) ++i;
+            else if (res[i] > h[j]) ++j;
+            else {
+                res[r++]= res[i];
+                ++i;
+                ++j;
+            }
+        }
+        nres= r;
+        free (h);
+    }
+    for (i=0; i<nres; ++i) {
+        file= (unsigned long)(res[i] >> 32);
+        if (file >= ix->nfiles) continue;
+        if (opt.files) printf ("%s\n", ix->str + PEEK4 (ix->files + 4*file));
+        else printf ("%s %lu\n", ix->str + PEEK4 (ix->files + 4*file),
+                     (unsigned long)(res[i] & 0xffffffffUL));
+    }
+    if (opt.verbose) fprintf (stderr, "%lu hits\n", nres);
+    free (res);
+    return nres > 0;
+}
+
+/* ---------------------------------------------------------------- misc */
+
+static void ParseArgs (int *pargc, char ***pargv)
+{
+    int argc;
+    char **argv;
+    int parse_arg;
+    char *arg;
+
+    argc = *pargc;
+    argv = *pargv;
+    parse_arg = 1;
+    opt.progname = argv[0];
+
+    while (--argc && **++argv=='-' && parse_arg) {
+        arg= strchr (argv[0], '=');
+        arg= arg ? arg+1 : "";
+        switch (argv[0][1]) {
+        case 'b': case 'B':
+            if (strncasecmp (argv[0], "-build=", 7)==0) {
+                opt.build= arg;
+                break;
+            } goto UNKOPT;
+
+        case 'f': case 'F':
+            if (strcasecmp (argv[0], "-files")==0) {
+                opt.files= 1;
+                break;
+            } goto UNKOPT;
+
+        case 'v': case 'V':
+            if (strcasecmp (argv[0], "-v")==0) {
+                opt.verbose= 1;
+                break;
+            } goto UNKOPT;
+
+        case 0: case '-': parse_arg = 0; break;
+        default:
+UNKOPT:
+            fprintf (stderr, "Unknown option '%s'\n", *argv);
+            exit (4);
+        }
+    }
+    ++argc;
+    *--argv = (char *)opt.progname;
+    *pargc = argc;
+    *pargv = argv;
+}
@@ -0,0 +1,371 @@
+/* casload.c */
+
+/* client and load-test of the conversion server (casbas --serve): the
+   files are converted over a number of connections, each sending its
+   requests one after the other; reported: the latency percentiles and
+   the requests per second. With -out the output of the first file is
+   written too, so it can be used as a simple client. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
+#endif
+
+#include "tvc.h"
+
+static struct {
+    const char *progname;
+    int conns;          /* concurrent connections */
+    long requests;      /* per connection */
+    const char *out;    /* output of the first file */
+} opt = {
+    NULL, 4, 100, NULL
+};
+
+typedef struct Input {
+    const char *name;
+    int op;             /* 'b' BAS->CAS, 'c' CAS->BAS */
+    unsigned char *data;
+    size_t len;
+} Input;
+
+static const char *Sock;
+static Input *In;
+static int NIn;
+
+typedef struct Client {
+    pthread_t thread;
+    int id;
+    double *lat;        /* msec, per request */
+    long nreq;
+    long nerr;
+} Client;
+
+static void ParseArgs (int *pargc, char ***pargv);
+static FILE *efopen (const char *name, const char *mode);
+static void *emalloc (size_t n);
+static void LoadInput (Input *in, const char *name);
+static int Connect (void);
+static int Request (int fd, const Input *in, int *status, int *line,
+                    unsigned char **res, size_t *reslen);
+static void *ClientThread (void *arg);
+static double Now (void);
+static int CmpDouble (const void *a, const void *b);
+
+int main (int argc, char **argv)
+{
+    Client *cl;
+    double start, wall, *all;
+    long n, nerr;
+    int i;
+
+    ParseArgs (&argc, &argv);
+    if (argc<3) {
+        fprintf (stderr, "usage: casload [options] <socket> <file.bas>|<file.cas>...\n"
+            "options: -conns=N -requests=N (per connection) -out=FILE\n");
+        exit (8);
+    }
+    Sock= argv[1];
+    NIn= argc-2;
+    In= emalloc (NIn * sizeof *In);
+    for (i=0; i<NIn; ++i) {
+        LoadInput (&In[i], argv[2+i]);
+    }
+
+    if (opt.out) {
+        unsigned char *res;
+        size_t reslen;
+        int fd, status, line;
+        FILE *g;
+
+        fd= Connect ();
+        if (Request (fd, &In[0], &status, &line, &res, &reslen)) {
+            fprintf (stderr, "%s: no response\n", In[0].name);
+            exit (32);
+        }
+        close (fd);
+        if (status) {
+            fprintf (stderr, "%s: error %d (line %d): %.*s\n", In[0].name,
+                     status, line, (int)reslen, res);
+            exit (status);
+        }
+        g= efopen (opt.out, "wb");
+        fwrite (res, 1, reslen, g);
+        fclose (g);
+        free (res);
+        if (opt.requests==0) return 0;
+    }
+    if (opt.requests<=0 || opt.conns<=0) return 0;
+
+    cl= emalloc (opt.conns * sizeof *cl);
+    start= Now ();
+    for (i=0; i<opt.conns; ++i) {
+        memset (&cl[i], 0, sizeof cl[i]);
+        cl[i].id= i;
+        cl[i].lat= emalloc (opt.requests * sizeof *cl[i].lat);
+        if (pthread_create (&cl[i].thread, NULL, ClientThread, &cl[i])) {
+            fprintf (stderr, "pthread_create failed\n");
+            exit (33);
+        }
+    }
+    for (i=0; i<opt.conns; ++i) {
+        pthread_join (cl[i].thread, NULL);
+    }
+    wall= Now () - start;
+
+    all= emalloc (opt.conns * opt.requests * sizeof *all);
+    for (n=0, nerr=0, i=0; i<opt.conns; ++i) {
+        memcpy (all+n, cl[i].lat, cl[i].nreq * sizeof *all);
+        n += cl[i].nreq;
+        nerr += cl[i].nerr;
+    }
+    if (n==0) {
+        fprintf (stderr, "no requests were answered\n");
+        exit (32);
+    }
+    qsort (all, n, sizeof *all, CmpDouble);
+    printf ("requests=%ld errors=%ld conns=%d wall=%.3fs req/s=%.0f\n",
+            n, nerr, opt.conns, wall, wall>0 ? n/wall : 0.0);
+    printf ("latency ms: p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+            all[(n-1)*50/100], all[(n-1)*90/100], all[(n-1)*99/100], all[n-1]);
+    return nerr ? 1 : 0;
+}
+
+static void *ClientThread (void *arg)
+{
+    Client *c= arg;
+    const Input *in;
+    unsigned char *res;
+    size_t reslen;
+    int fd, status, line;
+    double t;
+    long i;
+
+    fd= Connect ();
+    for (i=0; i<opt.requests; ++i) {
+        in= &In [(c->id+i) % NIn];
+        t= Now ();
+        if (Request (fd, in, &status, &line, &res, &reslen)) {
+            fprintf (stderr, "%s: connection lost\n", in->name);
+            ++c->nerr;
+            break;
+        }
+        c->lat [c->nreq++]= (Now () - t) * 1000;
+        if (status) {
+            /* reported once, by the first connection */
+            if (c->nerr++==0 && c->id==0) {
+                fprintf (stderr, "%s: error %d (line %d): %.*s\n", in->name,
+                         status, line, (int)reslen, res);
+            }
+        }
+        free (res);
+    }
+    close (fd);
+    return NULL;
+}
+
+/* the server may just be starting: it is waited for a few seconds */
+static int Connect (void)
+{
+    struct sockaddr_un sa;
+    struct timespec ts;
+    int fd, try;
+
+    if (strlen (Sock) >= sizeof sa.sun_path) {
+        fprintf (stderr, "Socket name '%s' is too long\n", Sock);
+        exit (16);
+    }
+    memset (&sa, 0, sizeof sa);
+    sa.sun_family= AF_UNIX;
+    strcpy (sa.sun_path, Sock);
+    for (try=0; ; ++try) {
+        fd= socket (AF_UNIX, SOCK_STREAM, 0);
+        if (fd<0) break;
+        if (connect (fd, (struct sockaddr *)&sa, sizeof sa)==0) return fd;
+        close (fd);
+        if ((errno!=ENOENT && errno!=ECONNREFUSED) || try>=50) break;
+        ts.tv_sec= 0;
+        ts.tv_nsec= 100000000L;
+        nanosleep (&ts, NULL);
+    }
+    fprintf (stderr, "Error connecting to '%s", Sock);
+    perror ("'");
+    exit (32);
+    return -1;
+}
+
+static int ReadFull (int fd, void *buff, size_t len)
+{
+    ssize_t rd;
+    size_t got;
+
+    for (got=0; got<len; got += rd) {
+        rd= read (fd, (char *)buff+got, len-got);
+        if (rd<0 && errno==EINTR) rd= 0;
+        else if (rd<=0) return -1;
+    }
+    return 0;
+}
+
+static int WriteFull (int fd, const void *buff, size_t len)
+{
+    ssize_t wr;
+    size_t put;
+
+    for (put=0; put<len; put += wr) {
+        wr= write (fd, (const char *)buff+put, len-put);
+        if (wr<0 && errno==EINTR) wr= 0;
+        else if (wr<=0) return -1;
+    }
+    return 0;
+}
+
+/* the protocol is described at Serve in casbas.c */
+static int Request (int fd, const Input *in, int *status, int *line,
+                    unsigned char **res, size_t *reslen)
+{
+    unsigned char hdr [12];
+
+    memset (hdr, 0, 8);
+    hdr[0]= (unsigned char)in->op;
+    POKE4 (hdr+4, in->len);
+    if (WriteFull (fd, hdr, 8) || WriteFull (fd, in->data, in->len)) return -1;
+
+    if (ReadFull (fd, hdr, 12)) return -1;
+    *status= hdr[0];
+    *line= (int)PEEK4 (hdr+4);
+    *reslen= PEEK4 (hdr+8);
+    *res= emalloc (*reslen ? *reslen : 1);
+    if (ReadFull (fd, *res, *reslen)) {
+        free (*res);
+        return -1;
+    }
+    return 0;
+}
+
+static void LoadInput (Input *in, const char *name)
+{
+    FILE *f;
+    size_t len;
+    long size;
+
+    len= strlen (name);
+    if (len>4 && strcasecmp (name+len-4, ".cas")==0) in->op= 'c';
+    else if (len>4 && strcasecmp (name+len-4, ".bas")==0) in->op= 'b';
+    else {
+        fprintf (stderr, "input filename '%s' should be *.cas or *.bas\n", name);
+        exit (16);
+    }
+    in->name= name;
+    f= efopen (name, "rb");
+    fseek (f, 0, SEEK_END);
+    size= ftell (f);
+    fseek (f, 0, SEEK_SET);
+    if (size<0) {
+        perror (name);
+        exit (32);
+    }
+    in->len= (size_t)size;
+    in->data= emalloc (in->len ? in->len : 1);
+    if (fread (in->data, 1, in->len, f) != in->len) {
+        fprintf (stderr, "%s: read error\n", name);
+        exit (32);
+    }
+    fclose (f);
+}
+
+static double Now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int CmpDouble (const void *a, const void *b)
+{
+    double x= *(const double *)a, y= *(const double *)b;
+
+    return x<y ? -1 : x>y;
+}
+
+static FILE *efopen (const char *name, const char *mode)
+{
+    FILE *f;
+
+    f = fopen (name, mode);
+    if (f) return f;
+    fprintf (stderr, "Error opening file '%s' mode '%s",
+             name, mode);
+    perror ("'");
+    exit (32);
+    return NULL;
+}
+
+static void *emalloc (size_t n)
+{
+    void *p;
+
+    p = malloc (n);
+    if (p) return p;
+    fprintf (stderr, "Out of memory (malloc (%lu))\n", (unsigned long)n);
+    exit (33);
+    return NULL;
+}
+
+static void ParseArgs (int *pargc, char ***pargv)
+{
+    int argc;
+    char **argv;
+    int parse_arg;
+    char *arg;
+
+    argc = *pargc;
+    argv = *pargv;
+    parse_arg = 1;
+    opt.progname = argv[0];
+
+    while (--argc && **++argv=='-' && parse_arg) {
+        arg= strchr (argv[0], '=');
+        arg= arg ? arg+1 : "";
+        switch (argv[0][1]) {
+        case 'c': case 'C':
+            if (strncasecmp (argv[0], "-conns=", 7)==0) {
+                opt.conns= atoi (arg);
+                break;
+            } goto UNKOPT;
+
+        case 'o': case 'O':
+            if (strncasecmp (argv[0], "-out=", 5)==0) {
+                opt.out= arg;
+                break;
+            } goto UNKOPT;
+
+        case 'r': case 'R':
+            if (strncasecmp (argv[0], "-requests=", 10)==0) {
+                opt.requests= atol (arg);
+                break;
+            } goto UNKOPT;
+
+        case 0: case '-': parse_arg = 0; break;
+        default:
+UNKOPT:
+            fprintf (stderr, "Unknown option '%s'\n", *argv);
+            exit (4);
+        }
+    }
+    ++argc;
+    *--argv = (char *)opt.progname;
+    *pargc = argc;
+    *pargv = argv;
+}
@@ -0,0 +1,236 @@
+/* mktokens.c */
+
+/* makes tokens.h from tokens.def (the format is described there):
+     BASIC_TOKEN_START, _END, _DATA, _REM, _COMMENT, _COLON
+     BASIC_TOKEN_NAMES    the texts, as an initializer list
+     basic_token_class    TOK_CLASS_* of each code
+     basic_token_text     the texts, length-prefixed ("\004GOTO")
+     basic_token_root     the trie of the texts: the node of the first
+     basic_token_trie     character, then the children of each node
+   so tokenizing is a walk of the trie, without setup at run time.
+
+   usage: mktokens tokens.def tokens.h */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAXTEXT 32
+#define MAXNODE 4096
+
+#define TOK_CLASS_DATA    1
+#define TOK_CLASS_REM     2
+#define TOK_CLASS_COMMENT 4
+#define TOK_CLASS_COLON   8
+
+typedef struct Token {
+    int defined;
+    unsigned char text [MAXTEXT];
+    unsigned len;
+    int cls;
+} Token;
+
+typedef struct Node {
+    unsigned char ch;
+    unsigned char tok;      /* the token ending here, 0: none */
+    unsigned short child;   /* the first child, 0: none */
+    unsigned short next;    /* the next sibling, 0: none */
+} Node;
+
+static const char *DefName;
+static int DefLine;
+static Token Tok [256];
+static Node Trie [MAXNODE];
+static unsigned NNode = 1;  /* 0 is "none" */
+static unsigned short Root [256];
+
+static void Error (const char *msg)
+{
+    fprintf (stderr, "%s:%d: %s\n", DefName, DefLine, msg);
+    exit (8);
+}
+
+static int HexVal (int c)
+{
+    return isdigit (c) ? c-'0' : toupper (c)-'A'+10;
+}
+
+/* "text" with C escapes; the rest of the line after it */
+static char *ParseText (char *p, Token *t)
+{
+    int c;
+
+    if (*p++ != '"') Error ("the text should be quoted");
+    for (t->len=0; *p!='"'; ++p) {
+        if (*p=='\0' || *p=='\n') Error ("unterminated text");
+        c = (unsigned char)*p;
+        if (c=='\\') {
+            c = (unsigned char)*++p;
+            if (c=='x' && isxdigit ((unsigned char)p[1]) && isxdigit ((unsigned char)p[2])) {
+                c = HexVal (p[1])*16 + HexVal (p[2]);
+                p += 2;
+            } else if (c!='\\' && c!='"') {
+                Error ("bad escape");
+            }
+        }
+        if (t->len==MAXTEXT) Error ("the text is too long");
+        t->text [t->len++] = (unsigned char)c;
+    }
+    if (t->len==0) Error ("empty text");
+    return p+1;
+}
+
+static void ReadDef (FILE *f)
+{
+    static const char *const classes[] = { "data", "rem", "comment", "colon" };
+    char line [256], word [32], *p;
+    unsigned code;
+    int n, i;
+
+    while (fgets (line, sizeof line, f)) {
+        ++DefLine;
+        for (p=line; isspace ((unsigned char)*p); ++p);
+        if (*p=='\0' || *p=='#') continue;
+        if (sscanf (p, "%x%n", &code, &n) != 1) Error ("a hex code is expected");
+        if (code < 0x80 || code > 0xfe) Error ("the code should be 80..fe");
+        if (Tok[code].defined) Error ("the code is defined twice");
+        for (p += n; isspace ((unsigned char)*p); ++p);
+        p = ParseText (p, &Tok[code]);
+        Tok[code].defined = 1;
+        if (sscanf (p, "%31s", word) == 1 && word[0] != '#') {
+            for (i=0; i<4 && strcmp (word, classes[i]); ++i);
+            if (i==4) Error ("unknown class");
+            Tok[code].cls = 1<<i;
+        }
+    }
+}
+
+static void AddTrie (unsigned code)
+{
+    const Token *t = &Tok[code];
+    unsigned short *link;
+    unsigned k, n;
+
+    link = &Root [t->text[0]];
+    for (k=0; ; ) {
+        n = *link;
+        if (n==0) {
+            if (NNode==MAXNODE) Error ("too many trie nodes");
+            n = *link = (unsigned short)NNode++;
+            Trie[n].ch = t->text[k];
+        }
+        if (++k == t->len) break;
+        for (link = &Trie[n].child; *link && Trie[*link].ch != t->text[k];
+             link = &Trie[*link].next);
+    }
+    Trie[n].tok = (unsigned char)code;
+}
+
+static void PutText (FILE *g, const Token *t, int prefix)
+{
+    unsigned k;
+    int c;
+
+    putc ('"', g);
+    if (prefix) fprintf (g, "\\%03o", t->len);
+    for (k=0; k<t->len; ++k) {
+        c = t->text[k];
+        if (c=='"' || c=='\\') fprintf (g, "\\%c", c);
+        else if (c>=0x20 && c<0x7f) putc (c, g);
+        else fprintf (g, "\\%03o", c);
+    }
+    putc ('"', g);
+}
+
+int main (int argc, char **argv)
+{
+    static const char *const clsname[] = { "DATA", "REM", "COMMENT", "COLON" };
+    unsigned start, end, c, n;
+    int i, have;
+    FILE *f, *g;
+
+    if (argc!=3) {
+        fprintf (stderr, "usage: mktokens <tokens.def> <tokens.h>\n");
+        exit (8);
+    }
+    DefName = argv[1];
+    f = fopen (argv[1], "r");
+    if (f==NULL) {
+        perror (argv[1]);
+        exit (32);
+    }
+    ReadDef (f);
+    fclose (f);
+
+    DefLine = 0;
+    for (start=0x80; start<0xff && !Tok[start].defined; ++start);
+    for (end=0xfe; end>start && !Tok[end].defined; --end);
+    if (start==0xff) Error ("no tokens");
+    for (c=start; c<=end; ++c) {
+        if (!Tok[c].defined) Error ("the codes should be contiguous");
+        AddTrie (c);
+    }
+
+    g = fopen (argv[2], "w");
+    if (g==NULL) {
+        perror (argv[2]);
+        exit (32);
+    }
+    fprintf (g, "/* %s: made by mktokens from %s, not to be edited */\n\n", argv[2], argv[1]);
+    fprintf (g, "#ifndef TOKENS_H\n#define TOKENS_H\n\n");
+    fprintf (g, "#define BASIC_TOKEN_START   0x%02x\n", start);
+    fprintf (g, "#define BASIC_TOKEN_END     0x%02x\n", end);
+    for (i=0; i<4; ++i) {
+        for (have=0, c=start; c<=end; ++c) {
+            if (Tok[c].cls != 1<<i) continue;
+            if (have++) Error ("a class is given to more than one token");
+            fprintf (g, "#define BASIC_TOKEN_%-8s0x%02x\n", clsname[i], c);
+        }
+        if (!have) {
+            fprintf (stderr, "%s: no token has the class '%s'\n", DefName, clsname[i]);
+            exit (8);
+        }
+    }
+    fprintf (g, "\n#define TOK_CLASS_DATA    %d\n#define TOK_CLASS_REM     %d\n"
+                "#define TOK_CLASS_COMMENT %d\n#define TOK_CLASS_COLON   %d\n",
+             TOK_CLASS_DATA, TOK_CLASS_REM, TOK_CLASS_COMMENT, TOK_CLASS_COLON);
+
+    fprintf (g, "\n/* BASIC_TOKEN_START..BASIC_TOKEN_END */\n#define BASIC_TOKEN_NAMES");
+    for (c=start; c<=end; ++c) {
+        fprintf (g, " \\\n    ");
+        PutText (g, &Tok[c], 0);
+        if (c<end) putc (',', g);
+    }
+
+    fprintf (g, "\n\nstatic const unsigned char basic_token_class [256] = {");
+    for (c=0; c<256; ++c) fprintf (g, "%s%d,", c%16 ? " " : "\n    ", Tok[c].cls);
+
+    fprintf (g, "\n};\n\nstatic const char *const basic_token_text [256] = {");
+    for (c=0; c<256; ++c) {
+        fprintf (g, "\n    ");
+        if (Tok[c].defined) PutText (g, &Tok[c], 1);
+        else fprintf (g, "\"\"");
+        putc (',', g);
+    }
+
+    fprintf (g, "\n};\n\ntypedef struct TOKNODE {\n"
+                "    unsigned char ch;       /* the character leading here */\n"
+                "    unsigned char tok;      /* the token ending here, 0: none */\n"
+                "    unsigned short child;   /* the first child, 0: none */\n"
+                "    unsigned short next;    /* the next sibling, 0: none */\n"
+                "} TOKNODE;\n");
+    fprintf (g, "\nstatic const unsigned short basic_token_root [256] = {");
+    for (c=0; c<256; ++c) fprintf (g, "%s%u,", c%16 ? " " : "\n    ", Root[c]);
+    fprintf (g, "\n};\n\nstatic const TOKNODE basic_token_trie [%u] = {", NNode);
+    for (n=0; n<NNode; ++n) {
+        fprintf (g, "\n    { 0x%02x, 0x%02x, %u, %u },",
+                 Trie[n].ch, Trie[n].tok, Trie[n].child, Trie[n].next);
+    }
+    fprintf (g, "\n};\n\n#endif\n");
+    if (fclose (g)) {
+        perror (argv[2]);
+        exit (32);
+    }
+    return 0;
+}
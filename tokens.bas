@@ -0,0 +1,43 @@
+AUTORUN
+   1 REM tokens.bas: every token of tokens.def, lower case, accents, DATA/REM/!
+   2 REM and escapes; make tokens_proba converts it and compares with tokens.cas
+10 Cannot  No  Bad  rgument  missing ) ( &
+20 + < = <= > <> >= ^
+30 ; / - =< , >< => #
+40 * TOKEN#A9 TOKEN#AA POLIGON RECTANGLE ELLIPSE BORDER USING
+50 AT ATN XOR VOLUME TO THEN TAB STYLE
+60 STEP RATE PROMPT PITCH PAPER PALETTE PAINT OR
+70 ORD OFF NOT MODE INK INKEY$ DURATION DELAY
+80 CHARACTER AND TOKEN#CA TOKEN#CB EXCEPTION RENUMBER FKEY AUTO
+90 LPRINT EXT VERIFY TRACE STOP SOUND SET SAVE
+100 RUN RETURN RESTORE READ RANDOMIZE PRINT POKE PLOT
+110 OUT OUTPUT OPEN ON OK NEXT NEW LOMEM
+120 LOAD LLIST LIST LET INPUT IF GRAPHICS GOTO
+130 GOSUB GET FOR END ELSE DIM DELETE DEF
+140 CONTINUE CLS CLOSE
+150 cannot  no  bad  rgument  missing ) ( &
+160 + < = <= > <> >= ^
+170 ; / - =< , >< => #
+180 * token#a9 token#aa poligon rectangle ellipse border using
+190 at atn xor volume to then tab style
+200 step rate prompt pitch paper palette paint or
+210 ord off not mode ink inkey$ duration delay
+220 character and token#ca token#cb exception renumber fkey auto
+230 lprint ext verify trace stop sound set save
+240 run return restore read randomize print poke plot
+250 out output open on ok next new lomem
+260 load llist list let input if graphics goto
+270 gosub get for end else dim delete def
+280 continue cls close
+290 PRINT "PRINT rvztr tkrfrgp RVZTR TKRFRGP":GOTO 10
+300 LET OT=HAT:let ot=hat:LET =
+310 DATA PRINT,rvz,"a:b",goto: PRINT 1
+320 data print,RVZ : print 2
+330 REM PRINT GOTO : PRINT rvz "
+340 rem print goto : print RVZ
+350 PRINT 1 ! PRINT : GOTO rvz
+360 print 2 ! print "
+370 PRINT "\x01\x7f\\\t41\t85\xe0\xff":PRINT \x41\t42
+380 print "\\ \\x41"
+BYTES \x00\x01\xfe\xff
+BYTES 'PRINT rvz\x0d\x0a'
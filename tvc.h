@@ -13,6 +13,15 @@
     ((unsigned char *)(ptr))[1] = (unsigned char)(((unsigned short)(value))>>8); \
     }
 
+#define PEEK4(ptr) (unsigned long)\
+                    (PEEK2(ptr) + ((unsigned long)PEEK2((unsigned char *)(ptr)+2) << 16))
+
+#define POKE4(ptr,value) \
+    { \
+    POKE2 ((ptr), (unsigned long)(value) & 0xffff); \
+    POKE2 ((unsigned char *)(ptr)+2, (unsigned long)(value) >> 16); \
+    }
+
 /* tape block-header */
 typedef struct TBLOCKHDR {
     unsigned char magic1;       /* offset: 0x00, length: 1, value: 0x00 */
@@ -40,6 +49,22 @@ typedef struct TSECTEND {
     unsigned char crc [2];       /* offset: 0x01, length: 2 */
 } TSECTEND;
 
+/* crc: CRC-16 (x^16+x^12+x^5+1, initial value 0) of the sector from
+   TSECTHDR up to and including TSECTEND.eof, the bits taken in the order
+   they are on the tape (LSB first); stored little endian */
+#define TAPECRC_POLY 0x1021
+
+#define TAPECRC_BYTE(crc,byte) \
+    { \
+    unsigned tcb_b = (unsigned char)(byte); \
+    int tcb_i; \
+    for (tcb_i=0; tcb_i<8; ++tcb_i, tcb_b >>= 1) { \
+        if ((((crc) >> 15) ^ tcb_b) & 1) \
+             (crc) = (unsigned short)(((crc) << 1) ^ TAPECRC_POLY); \
+        else (crc) = (unsigned short)((crc) << 1); \
+    } \
+    }
+
 /* sector layout:
    TSECTHDR 2 bytes
    data     1..256 bytes
@@ -117,11 +142,99 @@ typedef struct BASLINE {
 
 #define BASIC_PROGBASE 6639 /* BASIC program begins here */
 
-#define BASIC_TOKEN_START   0x90
-#define BASIC_TOKEN_END     0xfe /* 0xff is the terminator, not a token */
-#define BASIC_TOKEN_DATA    0xfb /* should not tokenize within DATA */
-#define BASIC_TOKEN_COMMENT 0xfe /* should not tokenize after '!' */
-#define BASIC_TOKEN_REM     0xfc /* should not tokenize after REM */
-#define BASIC_TOKEN_COLON   0xfd /* should tokenize after ':' (if not in comment) */
+/* the tokens: BASIC_TOKEN_START..BASIC_TOKEN_END, BASIC_TOKEN_DATA etc.,
+   the tables of the tokenizer; made of tokens.def by mktokens */
+#include "tokens.h"
+
+/* the keywords of the tokens BASIC_TOKEN_START..BASIC_TOKEN_END */
+static const char *const basic_token_names [BASIC_TOKEN_END-BASIC_TOKEN_START+1] = {
+    BASIC_TOKEN_NAMES
+};
+
+/* the characters of a BAS-file, one lookup each (TrLine, TokLine in
+   casbas.c), the table is made by the compiler:
+     tr  the TVC code: the accented letters (latin2) are 0x00..0x08 (capital)
+         and 0x10..0x18 (small), the rest is the same
+     up  the character as the tokenizer compares it (a-z -> A-Z)
+     cc  TVC_CC_* */
+#define TVC_CC_QUOTE   0x01 /* '"' */
+#define TVC_CC_ESCAPE  0x02 /* '\\' */
+#define TVC_CC_COLON   0x04 /* ':' */
+#define TVC_CC_COMMENT 0x08 /* '!' */
+#define TVC_CC_ACCENT  0x10 /* an accented letter (latin2) */
+#define TVC_CC_SPACE   0x20 /* isspace */
+#define TVC_CC_DIGIT   0x40 /* 0-9 */
+#define TVC_CC_XDIGIT  0x80 /* 0-9, A-F, a-f */
+
+typedef struct TVCCHAR {
+    unsigned char tr;
+    unsigned char up;
+    unsigned char cc;
+} TVCCHAR;
+
+/* latin2 -> TVC: A' E' I' O' O: O" U' U: U", then the same in small */
+#define TVC_ACCENT(c) \
+    ((c)==0xc1 ? 0x00 : (c)==0xc9 ? 0x01 : (c)==0xcd ? 0x02 : \
+     (c)==0xd3 ? 0x03 : (c)==0xd6 ? 0x04 : (c)==0xd5 ? 0x05 : \
+     (c)==0xda ? 0x06 : (c)==0xdc ? 0x07 : (c)==0xdb ? 0x08 : \
+     (c)==0xe1 ? 0x10 : (c)==0xe9 ? 0x11 : (c)==0xed ? 0x12 : \
+     (c)==0xf3 ? 0x13 : (c)==0xf6 ? 0x14 : (c)==0xf5 ? 0x15 : \
+     (c)==0xfa ? 0x16 : (c)==0xfc ? 0x17 : (c)==0xfb ? 0x18 : -1)
+
+#define TVC_CHAR(c) { \
+    (unsigned char)(TVC_ACCENT (c) >= 0 ? TVC_ACCENT (c) : (c)), \
+    (unsigned char)((c)>='a' && (c)<='z' ? (c)-0x20 : (c)), \
+    (unsigned char)(((c)=='"' ? TVC_CC_QUOTE : 0) | \
+                    ((c)=='\\' ? TVC_CC_ESCAPE : 0) | \
+                    ((c)==':' ? TVC_CC_COLON : 0) | \
+                    ((c)=='!' ? TVC_CC_COMMENT : 0) | \
+                    (TVC_ACCENT (c) >= 0 ? TVC_CC_ACCENT : 0) | \
+                    ((c)==' ' || ((c)>='\t' && (c)<='\r') ? TVC_CC_SPACE : 0) | \
+                    ((c)>='0' && (c)<='9' ? TVC_CC_DIGIT | TVC_CC_XDIGIT : 0) | \
+                    (((c)>='A' && (c)<='F') || ((c)>='a' && (c)<='f') ? TVC_CC_XDIGIT : 0)) },
+
+#define TVC_CHAR4(c)   TVC_CHAR (c) TVC_CHAR ((c)+1) TVC_CHAR ((c)+2) TVC_CHAR ((c)+3)
+#define TVC_CHAR16(c)  TVC_CHAR4 (c) TVC_CHAR4 ((c)+4) TVC_CHAR4 ((c)+8) TVC_CHAR4 ((c)+12)
+#define TVC_CHAR64(c)  TVC_CHAR16 (c) TVC_CHAR16 ((c)+16) TVC_CHAR16 ((c)+32) TVC_CHAR16 ((c)+48)
+
+static const TVCCHAR tvc_chars [256] = {
+    TVC_CHAR64 (0) TVC_CHAR64 (64) TVC_CHAR64 (128) TVC_CHAR64 (192)
+};
+
+/* UTF-8 (casbas --utf8): the accented letters are two bytes, U+0080..U+017F
+   is a first byte 0xc2..0xc5 and a second one 0x80..0xbf;
+   tvc_utf8 [(first-0xc2)*64 + (second&0x3f)] is the TVC code, or
+   TVC_UTF8_NONE if it is not an accented letter */
+#define TVC_UTF8_FIRST 0xc2
+#define TVC_UTF8_LAST  0xc5
+#define TVC_UTF8_NONE  0xff
+
+/* Unicode -> TVC: the same letters as TVC_ACCENT */
+#define TVC_UNI_ACCENT(u) \
+    ((u)==0xc1 ? 0x00 : (u)==0xc9 ? 0x01 : (u)==0xcd ? 0x02 : \
+     (u)==0xd3 ? 0x03 : (u)==0xd6 ? 0x04 : (u)==0x150 ? 0x05 : \
+     (u)==0xda ? 0x06 : (u)==0xdc ? 0x07 : (u)==0x170 ? 0x08 : \
+     (u)==0xe1 ? 0x10 : (u)==0xe9 ? 0x11 : (u)==0xed ? 0x12 : \
+     (u)==0xf3 ? 0x13 : (u)==0xf6 ? 0x14 : (u)==0x151 ? 0x15 : \
+     (u)==0xfa ? 0x16 : (u)==0xfc ? 0x17 : (u)==0x171 ? 0x18 : -1)
+
+#define TVC_UTF8(u) \
+    (unsigned char)(TVC_UNI_ACCENT (u) >= 0 ? TVC_UNI_ACCENT (u) : TVC_UTF8_NONE),
+#define TVC_UTF8_4(u)  TVC_UTF8 (u) TVC_UTF8 ((u)+1) TVC_UTF8 ((u)+2) TVC_UTF8 ((u)+3)
+#define TVC_UTF8_16(u) TVC_UTF8_4 (u) TVC_UTF8_4 ((u)+4) TVC_UTF8_4 ((u)+8) TVC_UTF8_4 ((u)+12)
+#define TVC_UTF8_64(u) TVC_UTF8_16 (u) TVC_UTF8_16 ((u)+16) TVC_UTF8_16 ((u)+32) TVC_UTF8_16 ((u)+48)
+
+static const unsigned char tvc_utf8 [256] = {
+    TVC_UTF8_64 (0x80) TVC_UTF8_64 (0xc0) TVC_UTF8_64 (0x100) TVC_UTF8_64 (0x140)
+};
+
+/* TVC -> UTF-8: the accented letters by the TVC code, "" between them */
+static const char *const tvc_accent_utf8 [0x19] = {
+    "\303\201", "\303\211", "\303\215", "\303\223", "\303\226",
+    "\305\220", "\303\232", "\303\234", "\305\260",
+    "", "", "", "", "", "", "",
+    "\303\241", "\303\251", "\303\255", "\303\263", "\303\266",
+    "\305\221", "\303\272", "\303\274", "\305\261"
+};
 
 #endif
@@ -0,0 +1,490 @@
+/* wavgen.c */
+
+/* renders CAS-files into a WAV-file the way the TVC writes them to the
+   tape (see the timing-table in wavread.c), with impairments: noise,
+   speed drift, wow/flutter, DC-offset, dropouts, polarity inversion.
+   For testing and benchmarking wavread (make bench-wav). */
+
+#include <errno.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_Windows)
+#define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
+#endif
+
+#include "tvc.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static struct {
+    const char *progname;
+    unsigned long rate;
+    int bits;         /* 8 or 16 */
+    double amp;       /* peak, in 8-bit sample units */
+    double snr;       /* dB, 0 = no noise */
+    double speed;     /* tape speed factor */
+    double drift;     /* speed change per minute */
+    double wow;       /* depth of the 0.5 Hz speed modulation */
+    double flutter;   /* depth of the 8 Hz speed modulation */
+    double dc;        /* offset, in 8-bit sample units */
+    double dropouts;  /* per second of data (not in the leaders) */
+    double droplen;   /* msec */
+    int invert;       /* polarity */
+    unsigned long seed;
+    int buffered;     /* data-files (TBLOCKHDR_FILE_BUFF) instead of programs */
+} opt = {
+    "wavgen",
+    44100,
+    8,
+    100.0,
+    0.0,
+    1.0,
+    0.0,
+    0.0,
+    0.0,
+    0.0,
+    0.0,
+    1.0,
+    0,
+    1,
+    0
+};
+
+/* SIGN | usec */
+#define USEC_LEAD 470.0
+#define USEC_SYNC 736.0
+#define USEC_BIT0 552.0
+#define USEC_BIT1 388.0
+
+#define LEAD_HEAD  10240  /* pulses before the header-block */
+#define LEAD_DATA   5120  /* pulses before the data-block */
+#define LEAD_OFF       5  /* pulses after the blocks */
+#define SILENCE   100000.0 /* usec before the blocks and at the end */
+
+#define NAME_MAX_TVC 10
+
+static struct {
+    FILE *f;
+    long long n;      /* samples written */
+    double x;         /* tape-time within the current segment (usec) */
+    int indata;       /* dropouts are made only within the data */
+    long dropleft;    /* samples left of the current dropout */
+    double sigma;     /* of the noise */
+    unsigned long long rnd;
+} G;
+
+static FILE *efopen (const char *name, const char *mode);
+static void *emalloc (size_t n);
+static void ParseArgs (int *pargc, char ***pargv);
+
+static void WavStart (const char *name);
+static void WavFinish (void);
+static void Segment (double usec, int sound);
+static void Block (int nlead, const unsigned char *data, size_t len);
+static void RenderCas (const char *name);
+static void RenderBuffered (const char *name, const unsigned char *data, size_t len);
+
+int main (int argc, char **argv)
+{
+    int i;
+
+    ParseArgs (&argc, &argv);
+
+    if (argc<3) {
+        fprintf (stderr, "usage: wavgen [options] <out.wav> <file.cas>...\n"
+            "options: -rate=N -bits=8|16 -amp=N -snr=DB -speed=F -drift=F\n"
+            "         -wow=F -flutter=F -dc=N -dropouts=N -droplen=MS -invert -seed=N\n"
+            "         -buffered\n");
+        exit (8);
+    }
+    G.rnd= opt.seed ? opt.seed : 1;
+    G.sigma= opt.snr > 0 ? opt.amp/sqrt (2.0) / pow (10.0, opt.snr/20) : 0;
+    WavStart (argv[1]);
+    for (i=2; i<argc; ++i) {
+        RenderCas (argv[i]);
+    }
+    Segment (SILENCE, 0);
+    WavFinish ();
+    return 0;
+}
+
+static FILE *efopen (const char *name, const char *mode)
+{
+    FILE *f;
+
+    f = fopen (name, mode);
+    if (f) return f;
+    fprintf (stderr, "Error opening file '%s' mode '%s",
+             name, mode);
+    perror ("'");
+    exit (32);
+    return NULL;
+}
+
+static void *emalloc (size_t n)
+{
+    void *p;
+
+    p = malloc (n);
+    if (p) return p;
+    fprintf (stderr, "Out of memory (malloc (%lu))\n", (unsigned long)n);
+    exit (33);
+    return NULL;
+}
+
+static void ParseArgs (int *pargc, char ***pargv)
+{
+    int argc;
+    char **argv;
+    int parse_arg;
+    char *arg;
+
+    argc = *pargc;
+    argv = *pargv;
+    parse_arg = 1;
+    opt.progname = argv[0];
+
+    while (--argc && **++argv=='-' && parse_arg) {
+        arg= strchr (argv[0], '=');
+        arg= arg ? arg+1 : "";
+        switch (argv[0][1]) {
+        case 'a': case 'A':
+            if (strncasecmp (argv[0], "-amp=", 5)==0) {
+                opt.amp= atof (arg);
+                if (opt.amp <= 0 || opt.amp > 127) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 'b': case 'B':
+            if (strncasecmp (argv[0], "-bits=", 6)==0) {
+                opt.bits= atoi (arg);
+                if (opt.bits!=8 && opt.bits!=16) goto UNKOPT;
+                break;
+            } else if (strcasecmp (argv[0], "-buffered")==0) {
+                opt.buffered= 1;
+                break;
+            } goto UNKOPT;
+
+        case 'd': case 'D':
+            if (strncasecmp (argv[0], "-dc=", 4)==0) {
+                opt.dc= atof (arg);
+                break;
+            } else if (strncasecmp (argv[0], "-drift=", 7)==0) {
+                opt.drift= atof (arg);
+                break;
+            } else if (strncasecmp (argv[0], "-dropouts=", 10)==0) {
+                opt.dropouts= atof (arg);
+                break;
+            } else if (strncasecmp (argv[0], "-droplen=", 9)==0) {
+                opt.droplen= atof (arg);
+                break;
+            } goto UNKOPT;
+
+        case 'f': case 'F':
+            if (strncasecmp (argv[0], "-flutter=", 9)==0) {
+                opt.flutter= atof (arg);
+                break;
+            } goto UNKOPT;
+
+        case 'i': case 'I':
+            if (strcasecmp (argv[0], "-invert")==0) {
+                opt.invert= 1;
+                break;
+            } goto UNKOPT;
+
+        case 'r': case 'R':
+            if (strncasecmp (argv[0], "-rate=", 6)==0) {
+                opt.rate= strtoul (arg, NULL, 10);
+                if (opt.rate < 8000) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 's': case 'S':
+            if (strncasecmp (argv[0], "-snr=", 5)==0) {
+                opt.snr= atof (arg);
+                break;
+            } else if (strncasecmp (argv[0], "-speed=", 7)==0) {
+                opt.speed= atof (arg);
+                if (opt.speed <= 0) goto UNKOPT;
+                break;
+            } else if (strncasecmp (argv[0], "-seed=", 6)==0) {
+                opt.seed= strtoul (arg, NULL, 10);
+                break;
+            } goto UNKOPT;
+
+        case 'w': case 'W':
+            if (strncasecmp (argv[0], "-wow=", 5)==0) {
+                opt.wow= atof (arg);
+                break;
+            } goto UNKOPT;
+
+        case '-': parse_arg = 0; break;
+        default: UNKOPT:
+            fprintf (stderr, "Unknown option '%s'\n", *argv);
+            exit (4);
+        }
+    }
+    ++argc;
+    --argv;
+    *pargc = argc;
+    *pargv = argv;
+}
+
+/* xorshift64: reproducible with -seed on every platform */
+static double Rand01 (void)
+{
+    G.rnd ^= G.rnd << 13;
+    G.rnd ^= G.rnd >> 7;
+    G.rnd ^= G.rnd << 17;
+    return (double)(G.rnd >> 11) / 9007199254740992.0;
+}
+
+static double Gauss (void)
+{
+    double u1, u2;
+
+    do u1= Rand01 (); while (u1 <= 0);
+    u2= Rand01 ();
+    return sqrt (-2*log (u1)) * cos (2*M_PI*u2);
+}
+
+/* the instantaneous tape speed at time t (sec) */
+static double Speed (double t)
+{
+    return opt.speed * (1 + opt.drift*t/60)
+                     * (1 + opt.wow*sin (2*M_PI*0.5*t))
+                     * (1 + opt.flutter*sin (2*M_PI*8*t));
+}
+
+static void PutLE (unsigned long val, int n)
+{
+    for (; n>0; --n, val >>= 8) putc ((int)(val & 0xff), G.f);
+}
+
+/* the sizes are filled in by WavFinish */
+static void WavStart (const char *name)
+{
+    G.f= efopen (name, "wb");
+    fwrite ("RIFF", 1, 4, G.f);
+    PutLE (0, 4);
+    fwrite ("WAVEfmt ", 1, 8, G.f);
+    PutLE (16, 4);
+    PutLE (1, 2);                       /* PCM */
+    PutLE (1, 2);                       /* mono */
+    PutLE (opt.rate, 4);
+    PutLE (opt.rate*opt.bits/8, 4);
+    PutLE (opt.bits/8, 2);
+    PutLE (opt.bits, 2);
+    fwrite ("data", 1, 4, G.f);
+    PutLE (0, 4);
+}
+
+static void WavFinish (void)
+{
+    unsigned long len;
+
+    len= (unsigned long)(G.n * (opt.bits/8));
+    if (len & 1) putc (0, G.f);
+    fseek (G.f, 4, SEEK_SET);
+    PutLE (36 + len + (len & 1), 4);
+    fseek (G.f, 40, SEEK_SET);
+    PutLE (len, 4);
+    if (fclose (G.f)) {
+        perror ("wavgen: write error");
+        exit (32);
+    }
+}
+
+/* one sample: dropout, polarity, DC, noise, quantization */
+static void Put (double v)
+{
+    long q;
+
+    if (G.dropleft==0 && G.indata && opt.dropouts > 0 &&
+        Rand01 () < opt.dropouts/opt.rate) {
+        G.dropleft= (long)(opt.droplen/1000*opt.rate + 0.5);
+    }
+    if (G.dropleft > 0) {
+        --G.dropleft;
+        v= 0;
+    }
+    if (opt.invert) v= -v;
+    v += opt.dc;
+    if (G.sigma > 0) v += G.sigma*Gauss ();
+    if (opt.bits==8) {
+        q= (long)floor (v + 0.5) + 0x80;
+        putc ((int)(q < 0 ? 0 : q > 255 ? 255 : q), G.f);
+    } else {
+        q= (long)floor (v*256 + 0.5);
+        PutLE ((unsigned long)(q < -32768 ? -32768 : q > 32767 ? 32767 : q) & 0xffff, 2);
+    }
+    ++G.n;
+}
+
+/* 'usec' of tape-time: one period of a sine (a pulse), or silence;
+   the segments are not aligned to the samples */
+static void Segment (double usec, int sound)
+{
+    while (G.x < usec) {
+        Put (sound ? opt.amp*sin (2*M_PI*G.x/usec) : 0.0);
+        G.x += 1e6/opt.rate * Speed ((double)G.n/opt.rate);
+    }
+    G.x -= usec;
+}
+
+static void Block (int nlead, const unsigned char *data, size_t len)
+{
+    size_t i;
+    int j;
+
+    Segment (SILENCE, 0);
+    for (j=0; j<nlead; ++j) Segment (USEC_LEAD, 1);
+    Segment (USEC_SYNC, 1);
+    G.indata= 1;
+    for (i=0; i<len; ++i) {
+        for (j=0; j<8; ++j) {
+            Segment (data[i] >> j & 1 ? USEC_BIT1 : USEC_BIT0, 1);
+        }
+    }
+    G.indata= 0;
+    G.dropleft= 0;
+    for (j=0; j<LEAD_OFF; ++j) Segment (USEC_LEAD, 1);
+}
+
+/* TSECTHDR, data, TSECTEND (with the CRC) to 'to'; returns the length */
+static size_t Sector (unsigned char *to, int sectno, const unsigned char *data,
+                      size_t len, int eof)
+{
+    unsigned short crc= 0;
+    size_t i, n;
+
+    n= 0;
+    to[n++]= (unsigned char)sectno;
+    to[n++]= (unsigned char)(len & 0xff);    /* 0 => 256 */
+    memcpy (to+n, data, len);
+    n += len;
+    to[n++]= (unsigned char)(eof ? 0x00 : 0xff);
+    for (i=0; i<n; ++i) {
+        TAPECRC_BYTE (crc, to[i]);
+    }
+    POKE2 (to+n, crc);
+    return n+2;
+}
+
+static void RenderCas (const char *fname)
+{
+    FILE *f;
+    unsigned char *cas, *blk, sect [1+NAME_MAX_TVC+sizeof (PRGFILEHDR)];
+    const unsigned char *prg;
+    const char *base, *dot;
+    long size, prgsize;
+    size_t len, namelen, nsect, i, n;
+    TBLOCKHDR tbh;
+
+    f= efopen (fname, "rb");
+    fseek (f, 0, SEEK_END);
+    size= ftell (f);
+    fseek (f, 0, SEEK_SET);
+    if (size < (long)sizeof (CASHDR)) {
+        fprintf (stderr, "%s: too short for a CAS-file\n", fname);
+        exit (16);
+    }
+    cas= emalloc (size);
+    if (fread (cas, 1, size, f) != (size_t)size) {
+        fprintf (stderr, "%s: read error\n", fname);
+        exit (16);
+    }
+    fclose (f);
+
+    /* the program: PRGFILEHDR.prgsize bytes after the CASHDR (the rest is UPM-fill) */
+    prg= cas + sizeof (CASHDR);
+    prgsize= PEEK2 (((const CASHDR *)cas)->pfh.prgsize);
+    if (prgsize==0 || prgsize > size - (long)sizeof (CASHDR)) {
+        prgsize= size - (long)sizeof (CASHDR);
+    }
+
+    /* the name on the tape: the file name without directory and extension */
+    base= strrchr (fname, '/');
+    base= base ? base+1 : fname;
+    dot= strrchr (base, '.');
+    namelen= dot && dot!=base ? (size_t)(dot-base) : strlen (base);
+    if (namelen > NAME_MAX_TVC) namelen= NAME_MAX_TVC;
+    sect[0]= (unsigned char)namelen;
+    for (i=0; i<namelen; ++i) sect[1+i]= (unsigned char)toupper ((unsigned char)base[i]);
+
+    if (opt.buffered) {     /* everything after the CPMHDR is the data */
+        RenderBuffered ((const char *)sect, cas + sizeof (CPMHDR), size - sizeof (CPMHDR));
+        free (cas);
+        return;
+    }
+
+    /* header-block: TBLOCKHDR, sector 0 = name and PRGFILEHDR */
+    memcpy (sect+1+namelen, &((const CASHDR *)cas)->pfh, sizeof (PRGFILEHDR));
+    blk= emalloc (sizeof tbh + 2 + sizeof sect + 3);
+    tbh.magic1= TBLOCKHDR_MAGIC1;
+    tbh.magic2= TBLOCKHDR_MAGIC2;
+    tbh.blocktype= TBLOCKHDR_BLOCK_HEAD;
+    tbh.filetype= TBLOCKHDR_FILE_UNBUFF;
+    tbh.protect= 0;
+    tbh.nsect= 1;
+    memcpy (blk, &tbh, sizeof tbh);
+    len= sizeof tbh + Sector (blk+sizeof tbh, 0, sect, 1+namelen+sizeof (PRGFILEHDR), 1);
+    Block (LEAD_HEAD, blk, len);
+    free (blk);
+
+    /* data-block: TBLOCKHDR, sectors of 256 bytes (the last may be shorter) */
+    nsect= (prgsize+255)/256;
+    if (nsect==0 || nsect > 255) {
+        fprintf (stderr, "%s: program size %ld doesn't fit a data-block\n", fname, prgsize);
+        exit (16);
+    }
+    blk= emalloc (sizeof tbh + nsect*(2+256+3));
+    tbh.blocktype= TBLOCKHDR_BLOCK_DATA;
+    tbh.nsect= (unsigned char)nsect;
+    memcpy (blk, &tbh, sizeof tbh);
+    len= sizeof tbh;
+    for (i=0; i<nsect; ++i) {
+        n= prgsize - i*256 < 256 ? (size_t)(prgsize - i*256) : 256;
+        len += Sector (blk+len, (int)i+1, prg+i*256, n, i==nsect-1);
+    }
+    Block (LEAD_DATA, blk, len);
+    free (blk);
+    free (cas);
+}
+
+/* a data-file as PRINT# writes it: the header-block holds only the name,
+   then data-blocks of one 256 byte sector (the buffer) each; the last
+   sector is marked with TSECTEND.eof==0. 'name' is length-prefixed. */
+static void RenderBuffered (const char *name, const unsigned char *data, size_t len)
+{
+    unsigned char blk [sizeof (TBLOCKHDR) + 2 + 256 + 3];
+    TBLOCKHDR tbh;
+    size_t n, off, i;
+
+    tbh.magic1= TBLOCKHDR_MAGIC1;
+    tbh.magic2= TBLOCKHDR_MAGIC2;
+    tbh.blocktype= TBLOCKHDR_BLOCK_HEAD;
+    tbh.filetype= TBLOCKHDR_FILE_BUFF;
+    tbh.protect= 0;
+    tbh.nsect= 1;
+    memcpy (blk, &tbh, sizeof tbh);
+    n= sizeof tbh + Sector (blk+sizeof tbh, 0, (const unsigned char *)name,
+                            1+(unsigned char)name[0], 1);
+    Block (LEAD_HEAD, blk, n);
+
+    tbh.blocktype= TBLOCKHDR_BLOCK_DATA;
+    memcpy (blk, &tbh, sizeof tbh);
+    for (off=0, i=1; off < len || off==0; off += 256, ++i) {
+        n= len-off < 256 ? len-off : 256;
+        n= sizeof tbh + Sector (blk+sizeof tbh, (int)(i & 0xff), data+off, n, off+256 >= len);
+        Block (LEAD_DATA, blk, n);
+        if (len==0) break;
+    }
+}
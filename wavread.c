@@ -1,17 +1,27 @@
 /* wavread.c */
 
+#define _FILE_OFFSET_BITS 64    /* off_t: the -overview file may pass 2 GiB */
 #include <errno.h>
 #include <ctype.h>
+#include <dirent.h>
 #include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #if defined(_Windows)
 #define strcasecmp(s,t) strcmpi(s,t)
+#define strncasecmp(s,t,n) strncmpi(s,t,n)
 #endif
 
 #include "tvc.h"
+#include "arena.h"
 
 #define ACT_WAVREAD   1
 #define ACT_SEQREAD   2
@@ -23,13 +33,45 @@ static struct {
     int action;
     int debug;
     int nocache;
+    int stats;      /* 0/1/2 = none / text report on stderr / JSON on stdout */
+    int autocal;    /* derive the bit-windows from the pulse-histogram */
+    int chan;       /* CHAN_* */
+    int diversity;  /* decode both channels, merge per sector */
+    int interp;     /* zero-crossings interpolated between the samples */
+    int dc;         /* front-end: DC-offset tracking */
+    int hipass;     /* front-end: high-pass filter */
+    int band;       /* front-end: dead-band around zero (in 8-bit sample units) */
+    int matched;    /* bits by matched filters instead of zero-crossings */
+    int recover;    /* keep decoding after errors, write partial files with a map */
+    int batch;      /* the argument is a directory or a list of WAV-files */
+    int jobs;       /* -batch: number of worker-threads, 0 = number of CPUs */
+    const char *outdir; /* -batch: the output-directories are made here */
+    const char *overview; /* min/max pyramid of the signal is written here */
 } opt = {
     "wavread",
     0,
     0,
-    0
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    ".",
+    NULL
 };
 
+/* channel-selection: 0.. = channel number, or a mix of the first two */
+#define CHAN_SUM  (-1)  /* average */
+#define CHAN_BEST (-2)  /* weighted by the estimated signal/noise ratio */
+
 /* SIGN | usec | bytes (depending on Hertz) | factor to lead */
 /*      |      | 38400  44100  48000        | */
 /* -----+------+ ---------------------------+--------------- */
@@ -48,16 +90,26 @@ typedef struct lenrange {
     (((long)(val)) >= (long)(plenrange)->minv && \
      ((long)(val)) <= (long)(plenrange)->maxv)
 
-/* position and length in the WAV-file */
+/* sample positions and lengths: 64 bit, even where 'long' is 32 bit */
+typedef long long WavOff;
+
+/* position and length in the WAV-file (in samples from the start of the data) */
 typedef struct WavPos {
-    long pos, len;
+    WavOff pos, len;
 } WavPos;
 
 /* sequence-read */
-/* a sequence consist of consecutive positive/negative/zero bytes (here 0x80 is zero) */
+/* a sequence consist of consecutive positive/negative/zero samples; the signs
+   come from the front-end (FrontEnd): without options 0x80 is zero, everything
+   else is positive/negative */
+/* 'fx' is where the sequence begins: with -interp the zero-crossing
+   interpolated between its first sample and the one before it;
+   like all the fractional values, it is in 1/GB.frac samples */
+#define FRAC 16 /* GB.frac with -interp, 1 otherwise */
 typedef struct Seq {
     WavPos wp;
     int  sign;   /* -1/0/1 */
+    WavOff fx;
 } Seq;
 
 /* an impulse: a positive and a negative part together */
@@ -68,7 +120,8 @@ typedef struct Seq {
 #define MINZEROES 1000 /* minimum number of 0x80 bytes (silence) before the leader */
 typedef struct Pulse {
     WavPos wp;
-    long len1, len2;
+    WavOff len1, len2;
+    long flen;   /* length in 1/GB.frac samples: this is what the bits are told by */
 } Pulse;
 
 /* a Bit: reading bits is possible after having found a synchron-block */
@@ -98,17 +151,65 @@ typedef struct Byte {
 #define STA_EOF    (-1)
 #define STA_INIT   1
 
+/* WAV-formats: RIFF/WAVE, RF64 (ds64 chunk with 64-bit sizes), Sony Wave64;
+   anything else is taken as raw 8-bit unsigned mono after a 64-byte header */
+#define WAV_RAW  0
+#define WAV_RIFF 1
+#define WAV_RF64 2
+#define WAV_W64  3
+
+/* the samples (converted to 8-bit unsigned) go through a fixed-size ring,
+   so memory-usage doesn't depend on the length of the recording;
+   the last RING_SIZE-RAW_SIZE samples are always available for looking back */
+#define RING_SIZE 65536  /* samples, power of 2 */
+#define RAW_SIZE  16384  /* bytes read at once, at most RING_SIZE frames */
+
+#define MF_MAXLEN 256      /* samples: bit0 is 26.5 samples at 48 kHz */
+#define MF_BIT1  0
+#define MF_LEAD  1
+#define MF_BIT0  2
+#define MF_SYNC  3
+#define MF_NUM   4
+#define MF_MINSCORE 0.6    /* normalized correlation: less is not a bit */
+
+#define REC_MAXGUESS 8     /* -recover: more non-bits in a row end the block */
+
 typedef struct State {
 /* WAV-read */
     FILE *wfile;
-    struct {        /* WAV file-header: we ignore it, assuming 8bit unsigned @ 44100 Hz */
-        unsigned char bytes[64];
-        unsigned len;
+    struct {        /* WAV file-header */
+        int type;             /* WAV_RAW/WAV_RIFF/WAV_RF64/WAV_W64 */
+        unsigned channels;
+        unsigned bits;        /* 8 or 16 */
+        unsigned long rate;
+        WavOff datarem;       /* bytes remaining in the data-chunk, -1 = until EOF */
     } fh;
+    struct {
+        unsigned char buf [RAW_SIZE];
+        size_t len;           /* bytes in buf (incomplete frame at the end) */
+    } raw;
+    struct {
+        unsigned char buf [RING_SIZE];
+        short val [RING_SIZE];        /* front-end output, 1/256 units of buf */
+        signed char sign [RING_SIZE]; /* -1/0/1 */
+        WavOff head;          /* number of samples put into the ring so far */
+    } ring;
+    struct {
+        double dc;            /* estimated DC-offset, 1/256 units */
+        int  ndc;             /* number of blocks in the estimation */
+        double hpx, hpy;      /* high-pass: previous input/output */
+        int  last;            /* dead-band: the last non-zero sign... */
+        int  zrun;            /* ...and the number of samples in the band since */
+        int  hold;            /* shorter runs within the band keep the last sign */
+    } fe;
+    int chan;                 /* CHAN_*, from opt.chan or set by the diversity-thread */
+    int frac;                 /* FRAC or 1 */
+    double snr [2];           /* CHAN_BEST: smoothed estimations */
     struct {
         int  sta;             /* 0/-1/1 = next fields are filled / EOF / before the first read */
         unsigned char cache;  /* eloreolvasott byte */
-        long pos;             /* az elobbi pozicioja a file-ban */
+        int  sign;            /* -1/0/1: its sign from the front-end */
+        WavOff pos;           /* az elobbi pozicioja (sample-index) */
     } wav;
     struct {
         int sta;     /* 0/-1/1 = next field is filled / EOF / before the first read */
@@ -117,6 +218,7 @@ typedef struct State {
     struct {
         int sta;     /* 0/-1/1 = next field is filled / EOF / before the first read */
         Pulse p;
+        int sign;    /* of the first half of the pulses in this block */
     } pulse;
     struct {
         int sta;     /* 0/-1/1 = next field is filled / EOF / before the first read */
@@ -127,14 +229,96 @@ typedef struct State {
         Byte b;
     } byte;
     int state;
+/* matched filter engine (-matched): after the sync the bits are
+   told by correlating the signal with one period of bit1/lead/bit0;
+   the end of the leader and the sync are found the same way */
+    struct {
+        double t;             /* start of the next bit (samples) */
+        double len [MF_NUM];  /* period of bit1/lead/bit0/sync (samples) */
+        float tpl [MF_NUM][MF_MAXLEN];
+        double tplnorm [MF_NUM]; /* sqrt (sum tpl^2) */
+    } mf;
+    int guess;                /* -recover: non-bits taken as bits in a row */
+    int pend;                 /* -recover: GB.pulse is read ahead (RecLeadOff) */
+/* -recover: the rest of a block after a bad sector-header, kept bit by bit
+   to find the next sector-header at any bit-offset (ResyncSect) */
+    struct {
+        int on;               /* 0: GetBytes reads from ByteRead */
+        unsigned char *bits;  /* kept for the next resync (ThreadFree) */
+        WavOff *pos;
+        long cap, nbits, at;
+    } rs;
 /* the following values are calculated from the measured 'lead'-length */
+    double leadavg;           /* 1/GB.frac samples */
     lenrange lead;
     lenrange sync;
     lenrange bit0;
     lenrange bit1;
 } State;
 
-static State GB;
+/* the decoder-state is per thread: -diversity decodes the channels in parallel */
+static _Thread_local State GB;
+
+/* the byte at bit-offset k of GB.rs (LSB first, as on the tape) */
+#define RsByte(k) ((unsigned char)( \
+    GB.rs.bits[(k)]       | GB.rs.bits[(k)+1] << 1 | \
+    GB.rs.bits[(k)+2] << 2 | GB.rs.bits[(k)+3] << 3 | \
+    GB.rs.bits[(k)+4] << 4 | GB.rs.bits[(k)+5] << 5 | \
+    GB.rs.bits[(k)+6] << 6 | GB.rs.bits[(k)+7] << 7))
+
+/* instrumentation (-stats, -statsjson): counters and pulse-length histograms,
+   collected per block (from a PulseReadReset to the next) and for the whole file */
+#define HIST_SIZE 256 /* pulse-lengths (samples); longer ones are counted in the last bin */
+
+#define REJ_HALVES  0 /* the halves of the pulse doesn't match */
+#define REJ_HALFEOF 1 /* EOF after a half-pulse */
+#define REJ_ZEROES  2 /* zeroes after valid pulses (end of block) */
+#define REJ_NOLEAD  3 /* couldn't find the leader */
+#define REJ_NOSYNC  4 /* no sync after the leader */
+#define REJ_NONBIT  5 /* non-bit after valid bits */
+#define REJ_NUM     6
+
+static const char *RejName [REJ_NUM] = {
+    "halves", "halfeof", "zeroes", "nolead", "nosync", "nonbit"
+};
+
+#define STG_SEQ   0
+#define STG_PULSE 1
+#define STG_BIT   2
+#define STG_BYTE  3
+#define STG_WRITE 4
+#define STG_NUM   5
+
+static const char *StgName [STG_NUM] = {
+    "seq", "pulse", "bit", "byte", "write"
+};
+
+typedef struct Stats {
+    WavOff runs, pulses, bits, bytes;
+    unsigned long rejected [REJ_NUM];
+    double time [STG_NUM];   /* seconds, without the nested stages */
+    unsigned long hist [HIST_SIZE];
+} Stats;
+
+static _Thread_local struct {
+    Stats tot;       /* whole file */
+    Stats blk;       /* current block */
+    WavOff blkpos;   /* position of the first pulse in the current block */
+    int   nblk;      /* number of reported blocks */
+    int   stack [STG_NUM+1]; /* stages being timed (they call each other) */
+    int   depth;
+    double mark;     /* time of the last Enter/Leave */
+    double start;    /* WavOpen */
+} ST;
+
+static void StatEnter (int stg);
+static void StatLeave (void);
+static void StatReject (int rej);
+static void StatBlock (void);
+static void StatReport (void);
+static double Now (void);
+
+#define StatsOn() (opt.stats || opt.autocal)
 
 static FILE *efopen (const char *name, const char *mode);
 static void *emalloc (int n);
@@ -144,27 +328,63 @@ static void ParseArgs (int *pargc, char ***pargv);
 static void WavOpen (const char *name);
 static void WavClose(void);
 static int  WavRead (void);
-static size_t WavReadBytes (void *to, size_t len);
+static void WavParseHeader (void);
+static size_t WavFill (void);
+static void FrontEnd (WavOff from, size_t n);
 
 static int SeqRead (void);
+static int SeqRead1 (void);
 static int PulseRead (void);
+static int PulseRead1 (void);
 static int PulseReadReset (void);
 static int BitRead (void);
+static int BitRead1 (void);
 static int BitReadReset (void);
+static int RecLeadOff (void);
 static int ByteRead (void);
+static int ByteRead1 (void);
 static int ByteReadReset (void);
 
 /* 'wp' parameter: returns the position of the first bit in the block */
 static int GetBytes (void *to, int size, WavPos *wp);
 
-static void Dump (long pos, int n, const void *p);
+static void Dump (WavOff pos, int n, const void *p);
 
-static int BlockCheck (const TBLOCKHDR *tbh, int type, long pos);
+static int BlockCheck (const TBLOCKHDR *tbh, int type, WavOff pos);
 
 static void StartCas (size_t namelen, const char *name);
+static void StartJobCas (size_t namelen, const char *name);
 static void WriteCas (size_t len, const void *data);
+static void CrcCas (int sectno, int crcok);
 static void CloseCas (void);
 static void AbortCas (void);
+static void WriteMap (void);
+static long TellCas (void);
+static void ExpectCas (long len);
+static void DamageCas (long off, long len, WavOff pos, const char *why);
+static void FillCas (long len, WavOff pos, const char *why);
+static void RecoverCas (void);
+static void TruncCas (void);
+
+static int  ResyncSect (const TSECTHDR *tsh, int from, int nsect);
+static void ResyncEnd (void);
+
+static int MfSync (void);
+static int MfBit (void);
+
+static int SectCrcOk (const TSECTHDR *tsh, const void *data, int len, const TSECTEND *tse);
+
+static void DecodeTape (void);
+static void DecodeBlocks (void);
+static int Diversity (const char *name);
+static void ThreadStop (void);
+static void ThreadFree (void);
+
+static void OvwOpen (const char *name);
+static void OvwAdd (const short *val, size_t n);
+static void OvwClose (void);
+static void Annot (WavOff pos, const char *fmt, ...);
+static int Batch (const char *name);
 
 static void DumpWavBytes (void);
 static void DumpSequences (void);
@@ -174,19 +394,32 @@ static void DumpBytes (void);
 
 int main (int argc, char **argv)
 {
-    int ss, i;
-    TBLOCKHDR tbh;
-    TSECTHDR  tsh;
-    TSECTEND  tse;
-    char sect [280];
-
     ParseArgs (&argc, &argv);
 
     if (argc!=2) {
-        fprintf (stderr, "usage: wavread <file>\n");
+        fprintf (stderr, "usage: wavread [options] <file>|-\n"
+                         "       wavread -batch [-jobs=N] [-outdir=DIR] [options] <dir>|<list>|-\n");
+        exit (8);
+    }
+    if (opt.overview && (opt.batch || opt.diversity)) {
+        fprintf (stderr, "-overview is made of a single decoding\n");
         exit (8);
     }
+    if (opt.batch) {
+        return Batch (argv[1]);
+    }
+    if (opt.diversity) {
+        return Diversity (argv[1]);
+    }
+    GB.chan= opt.chan;
+    if (opt.overview) {
+        OvwOpen (opt.overview);
+        atexit (OvwClose);
+    }
     WavOpen(argv[1]);
+    if (opt.stats) {
+        atexit (StatReport); /* GetBytes exits on incomplete reads */
+    }
 
     if (opt.action==ACT_WAVREAD) {
         DumpWavBytes();
@@ -208,10 +441,50 @@ int main (int argc, char **argv)
         DumpBytes();
         goto VEGE;
     }
+    DecodeTape ();
+VEGE:
+    WavClose ();
+    return 0;
+}
+
+/* Recover: GetBytes jumps here instead of exiting (-recover) */
+static _Thread_local jmp_buf *Recover= NULL;
+
+static void DecodeTape (void)
+{
+    jmp_buf recover;
+
+    if (opt.recover) {
+        Recover= &recover;
+        if (setjmp (recover)) {
+            RecoverCas ();
+        }
+    }
+    DecodeBlocks ();
+    Recover= NULL;
+}
+
+/* a file: a header-block, then one data-block (TBLOCKHDR_FILE_UNBUFF, programs),
+   or data-blocks until a sector with TSECTEND.eof==0 (TBLOCKHDR_FILE_BUFF,
+   written by PRINT#); the sectors are counted through the blocks.
+   The buffered layout (sector numbers going on from block to block, mod 256,
+   and eof==0 on the last one) is checked only against wavgen, which is built
+   on the same assumptions, not against a tape written by a TVC. A tape that
+   doesn't follow it ends the file where it differs: the sectors read until
+   then are kept (TruncCas), so a wrong guess loses no data. */
+static void DecodeBlocks (void)
+{
+    int ss, i, s, buffered, nsect, want;
+    TBLOCKHDR tbh;
+    TSECTHDR  tsh;
+    TSECTEND  tse;
+    char sect [280];
+    PRGFILEHDR pfh;
 
     while (1) {
         WavPos wp;
 HEADWAIT:
+        ResyncEnd ();
         ByteReadReset();
         if (GB.wav.sta==STA_EOF) break;
 
@@ -221,59 +494,122 @@ HEADFOUND:
         GetBytes (&tsh, sizeof (tsh), NULL);
         if ((ss= tsh.size)==0) ss= 256;
         GetBytes (sect, ss, NULL);
-        fprintf (stderr,"name is \"%.*s\"\n", sect[0], sect+1);
+        buffered= tbh.filetype==TBLOCKHDR_FILE_BUFF;
+        nsect= 0;
+        fprintf (stderr,"name is \"%.*s\"%s%s\n", sect[0], sect+1,
+            buffered ? " (buffered)" : "", tbh.protect ? " (protected)" : "");
+        Annot (wp.pos, "head \"%.*s\"", sect[0], sect+1);
         StartCas (sect[0], sect+1);
         WriteCas (ss-1-sect[0], sect+1+sect[0]);
+        if (tbh.filetype==TBLOCKHDR_FILE_UNBUFF && ss-1-sect[0]==sizeof (pfh)) {
+            memcpy (&pfh, sect+1+sect[0], sizeof (pfh));
+            ExpectCas (sizeof (pfh) + PEEK2 (pfh.prgsize));
+        }
 
         GetBytes (&tse, sizeof (tse), &wp);
-        fprintf (stderr,"%lx -----HEAD----END----\n", wp.pos);
+        if (!SectCrcOk (&tsh, sect, ss, &tse)) {
+            DamageCas (0, ss-1-sect[0], wp.pos, "crc");
+        }
+        CrcCas (0, SectCrcOk (&tsh, sect, ss, &tse));
+        Annot (wp.pos, "sector-end 0 %s", SectCrcOk (&tsh, sect, ss, &tse) ? "ok" : "crc-error");
+        fprintf (stderr,"%llx -----HEAD----END----\n", wp.pos);
 
+DATAWAIT:
         ByteReadReset();
 
         GetBytes (&tbh, sizeof (tbh), &wp);
         if (BlockCheck (&tbh, TBLOCKHDR_BLOCK_DATA, wp.pos)) {
-            AbortCas ();
+            if (opt.recover) {
+                RecoverCas ();
+            } else if (buffered && nsect) {
+                TruncCas ();
+            } else {
+                AbortCas ();
+            }
             if (BlockCheck (&tbh, TBLOCKHDR_BLOCK_HEAD, wp.pos) == 0)
                 goto HEADFOUND;
             else
                 continue;
         }
+        Annot (wp.pos, "data %d", tbh.nsect);
         for (i=0; i<tbh.nsect; ++i) {
             GetBytes (&tsh, sizeof (tsh), &wp);
-            if (tsh.sectno != i+1) {
-                fprintf (stderr,"Bad sector number %d (waited=%d), aborting\n",
-                        tsh.sectno, i+1);
-                AbortCas ();
-                goto HEADWAIT;
+            /* the sectors of a buffered file are numbered through the blocks */
+            want= buffered ? (nsect+1) & 0xff : i+1;
+            if (tsh.sectno != want) {
+                fprintf (stderr,"Bad sector number %d (waited=%d), %s\n",
+                        tsh.sectno, want, opt.recover && !buffered ? "resynchronizing" :
+                        opt.recover || (buffered && nsect) ? "keeping the sectors read" : "aborting");
+                Annot (wp.pos, "bad-sector-number %d %d", tsh.sectno, want);
+                if (!opt.recover) {
+                    if (buffered && nsect) {
+                        TruncCas ();
+                    } else {
+                        AbortCas ();
+                    }
+                    goto HEADWAIT;
+                }
+                if (buffered || (s= ResyncSect (&tsh, i+1, tbh.nsect)) < 0) {
+                    RecoverCas ();
+                    goto HEADWAIT;
+                }
+                FillCas (256L*(s-i-1), wp.pos, "lost");
+                nsect += s-i-1;
+                i= s-1;
+                GetBytes (&tsh, sizeof (tsh), &wp);
             }
-            fprintf (stderr,"%lx -----SECTOR-%d-BEGIN---\n", wp.pos, i+1);
+            ++nsect;
+            fprintf (stderr,"%llx -----SECTOR-%d-BEGIN---\n", wp.pos, nsect);
+            Annot (wp.pos, "sector %d", nsect);
             if ((ss= tsh.size)==0) ss= 256;
             GetBytes (sect, ss, &wp);
             WriteCas (ss, sect);
             GetBytes (&tse, sizeof (tse), &wp);
-            fprintf (stderr,"%lx -----SECTOR-%d-END---\n", wp.pos, i+1);
+            if (!SectCrcOk (&tsh, sect, ss, &tse)) {
+                DamageCas (TellCas ()-ss, ss, wp.pos, "crc");
+            }
+            CrcCas (nsect, SectCrcOk (&tsh, sect, ss, &tse));
+            Annot (wp.pos, "sector-end %d %s", nsect, SectCrcOk (&tsh, sect, ss, &tse) ? "ok" : "crc-error");
+            fprintf (stderr,"%llx -----SECTOR-%d-END---\n", wp.pos, nsect);
+        }
+        fprintf (stderr,"%llx -----DATA-END---\n", wp.pos);
+        if (buffered && tbh.nsect && tse.eof != 0) {
+            goto DATAWAIT;      /* the file goes on in the next data-block */
         }
-        fprintf (stderr,"%lx -----DATA-END---\n", wp.pos);
         CloseCas ();
     }
-VEGE:
-    WavClose ();
-    return 0;
 }
 
-static int BlockCheck (const TBLOCKHDR *tbh, int type, long pos)
+static int SectCrcOk (const TSECTHDR *tsh, const void *data, int len, const TSECTEND *tse)
+{
+    unsigned short crc= 0;
+    const unsigned char *p= data;
+    int i;
+
+    TAPECRC_BYTE (crc, tsh->sectno);
+    TAPECRC_BYTE (crc, tsh->size);
+    for (i=0; i<len; ++i) {
+        TAPECRC_BYTE (crc, p[i]);
+    }
+    TAPECRC_BYTE (crc, tse->eof);
+    return crc == PEEK2 (tse->crc);
+}
+
+static int BlockCheck (const TBLOCKHDR *tbh, int type, WavOff pos)
 {
     if (tbh->magic1 != TBLOCKHDR_MAGIC1 ||
         tbh->magic2 != TBLOCKHDR_MAGIC2) {
         fprintf (stderr,
-            "%lx Wrong block found"
+            "%llx Wrong block found"
             " (magic1=%02x[expected=%02x] magic2=%02x[expected=%02x]), ignoring\n",
             pos, tbh->magic1, TBLOCKHDR_MAGIC1, tbh->magic2, TBLOCKHDR_MAGIC2);
+        Annot (pos, "wrong-block %02x%02x", tbh->magic1, tbh->magic2);
         return -1;
 
     } else if (tbh->blocktype != type) {
-        fprintf (stderr,"%lx Wrong block type %02x, ignoring\n", pos, 
+        fprintf (stderr,"%llx Wrong block type %02x, ignoring\n", pos, 
                 tbh->blocktype);
+        Annot (pos, "wrong-block-type %02x", tbh->blocktype);
         return -1;
     }
     return 0;
@@ -292,11 +628,19 @@ static int GetBytes (void *to, int size, WavPos *wp)
     if (!wp) wp= &mywp;
     wp->pos= wp->len= 0;
 /*  wp= GB.byte.b.wp; <FIXME> */
-    for (i=0; i<size && GB.byte.sta==STA_FILLED; ++i) {
-        if (i==0) *wp= GB.byte.b.wp;
-        else      wp->len += GB.byte.b.wp.len;
-        p[i]= (unsigned char)GB.byte.b.val;
-        ByteRead();
+    if (GB.rs.on) {             /* after ResyncSect */
+        for (i=0; i<size && GB.rs.at+8 <= GB.rs.nbits; ++i, GB.rs.at += 8) {
+            if (i==0) wp->pos= GB.rs.pos [GB.rs.at];
+            p[i]= RsByte (GB.rs.at);
+        }
+        if (i) wp->len= GB.rs.pos [GB.rs.at-1] - wp->pos;
+    } else {
+        for (i=0; i<size && GB.byte.sta==STA_FILLED; ++i) {
+            if (i==0) *wp= GB.byte.b.wp;
+            else      wp->len += GB.byte.b.wp.len;
+            p[i]= (unsigned char)GB.byte.b.val;
+            ByteRead();
+        }
     }
     if (opt.debug) {
         Dump (wp->pos, i, p);
@@ -304,19 +648,22 @@ static int GetBytes (void *to, int size, WavPos *wp)
     if (i != size) {
         fprintf(stderr, "GetBytes: incomplete read %d vs %d\n",
             (int)i, (int)size);
+        Annot (GB.wav.pos, "incomplete-read");
+        if (Recover) longjmp (*Recover, 1);
+        ThreadStop ();
         exit (12);
     }
     return i;
 }
 
-static void Dump (long pos, int n, const void *p)
+static void Dump (WavOff pos, int n, const void *p)
 {
     const unsigned char *ptr;
     int j;
 
     ptr= p;
 
-    fprintf (stderr,"%06lx ", pos);
+    fprintf (stderr,"%06llx ", pos);
     for (j=0; j<n; ++j) {
         fprintf (stderr,"%02x ", ptr[j]);
     }
@@ -324,6 +671,8 @@ static void Dump (long pos, int n, const void *p)
 }
 
 static void CalcIntervals (double avgheadlen);
+static void CalcIntervalsHist (double avgheadlen);
+static void PrintIntervals (const char *title);
 
 static FILE *efopen (const char *name, const char *mode)
 {
@@ -334,6 +683,7 @@ static FILE *efopen (const char *name, const char *mode)
     fprintf (stderr, "Error opening file '%s' mode '%s",
              name, mode);
     perror ("'");
+    ThreadStop ();
     exit (32);
     return NULL;
 }
@@ -349,10 +699,26 @@ static void ParseArgs (int *pargc, char ***pargv)
     parse_arg = 1;
     opt.progname = argv[0];
 
-    while (--argc && **++argv=='-' && parse_arg) {
+    while (--argc && **++argv=='-' && argv[0][1] && parse_arg) { /* "-" is stdin */
         switch (argv[0][1]) {
+        case 'a': case 'A':
+            if (strcasecmp (argv[0], "-autocal")==0) {
+                opt.autocal= 1;
+                break;
+            } goto UNKOPT;
+
         case 'b': case 'B':
-            if (strcasecmp (argv[0], "-bitread")==0) {
+            if (strncasecmp (argv[0], "-band=", 6)==0) {
+                opt.band= atoi (argv[0]+6);
+                if (opt.band < 0 || opt.band > 127) goto UNKOPT;
+                break;
+            } else if (strcasecmp (argv[0], "-batch")==0) {
+                opt.batch= 1;
+                break;
+            } else if (strcasecmp (argv[0], "-bestmix")==0) {
+                opt.chan= CHAN_BEST;
+                break;
+            } else if (strcasecmp (argv[0], "-bitread")==0) {
                 opt.action= ACT_BITREAD;
                 break;
             } else if (strcasecmp (argv[0], "-byteread")==0) {
@@ -361,31 +727,93 @@ static void ParseArgs (int *pargc, char ***pargv)
             } goto UNKOPT;
 
         case 'd': case 'D':
+            if (strcasecmp (argv[0], "-diversity")==0) {
+                opt.diversity= 1;
+                break;
+            } else if (strcasecmp (argv[0], "-dc")==0) {
+                opt.dc= 1;
+                break;
+            }
             ++opt.debug;
             break;
         case 'h': case 'H':
+            if (strcasecmp (argv[0], "-hipass")==0) {
+                opt.hipass= 1;
+                break;
+            }
             opt.action = 2;
             break;
+
         case 'i': case 'I':
+            if (strcasecmp (argv[0], "-interp")==0) {
+                opt.interp= 1;
+                break;
+            }
             opt.action = 1;
             break;
 
+        case 'j': case 'J':
+            if (strncasecmp (argv[0], "-jobs=", 6)==0) {
+                opt.jobs= atoi (argv[0]+6);
+                if (opt.jobs <= 0) goto UNKOPT;
+                break;
+            } goto UNKOPT;
+
+        case 'l': case 'L':
+            if (strcasecmp (argv[0], "-left")==0) {
+                opt.chan= 0;
+                break;
+            } goto UNKOPT;
+
+        case 'm': case 'M':
+            if (strcasecmp (argv[0], "-matched")==0) {
+                opt.matched= 1;
+                break;
+            } goto UNKOPT;
+
         case 'n': case 'N':
             if (strcasecmp (argv[0], "-nocache")==0) {
                 opt.nocache= 1;
                 break;
             } goto UNKOPT;
 
+        case 'o': case 'O':
+            if (strncasecmp (argv[0], "-outdir=", 8)==0 && argv[0][8]) {
+                opt.outdir= argv[0]+8;
+                break;
+            } else if (strncasecmp (argv[0], "-overview=", 10)==0 && argv[0][10]) {
+                opt.overview= argv[0]+10;
+                break;
+            } goto UNKOPT;
+
         case 'p': case 'P':
             if (strcasecmp (argv[0], "-pulseread")==0) {
                 opt.action= ACT_PULSEREAD;
                 break;
             } goto UNKOPT;
 
+        case 'r': case 'R':
+            if (strcasecmp (argv[0], "-right")==0) {
+                opt.chan= 1;
+                break;
+            } else if (strcasecmp (argv[0], "-recover")==0) {
+                opt.recover= 1;
+                break;
+            } goto UNKOPT;
+
         case 's': case 'S':
-            if (strcasecmp (argv[0], "-seqread")==0) {
+            if (strcasecmp (argv[0], "-sum")==0) {
+                opt.chan= CHAN_SUM;
+                break;
+            } else if (strcasecmp (argv[0], "-seqread")==0) {
                 opt.action= ACT_SEQREAD;
                 break;
+            } else if (strcasecmp (argv[0], "-stats")==0) {
+                opt.stats= 1;
+                break;
+            } else if (strcasecmp (argv[0], "-statsjson")==0) {
+                opt.stats= 2;
+                break;
             } goto UNKOPT;
 
         case 'w': case 'W':
@@ -394,7 +822,7 @@ static void ParseArgs (int *pargc, char ***pargv)
                 break;
             } goto UNKOPT;
 
-        case 0: case '-': parse_arg = 0; break;
+        case '-': parse_arg = 0; break;
         default: UNKOPT:
             fprintf (stderr, "Unknown option '%s'\n", *argv);
             exit (4);
@@ -405,20 +833,143 @@ static void ParseArgs (int *pargc, char ***pargv)
     *pargc = argc;
     *pargv = argv;
 }
-static int CasState= 0;
-static char *CasName= NULL;
-static FILE *CasFile= NULL;
+/* -diversity: the files of a channel are collected in memory (DivFile),
+   and written after merging them sector by sector (MergeDiv) */
+typedef struct DivSect {
+    int len;                 /* -1 = not read */
+    int crcok;
+    unsigned char data [256];
+} DivSect;
+
+typedef struct DivFile {
+    struct DivFile *next;
+    char name [256];
+    int namelen;
+    WavOff pos;
+    int complete;            /* CloseCas was called (not AbortCas) */
+    int nsect;               /* number of the last sector read */
+    DivSect sect [256];      /* [0]: header (the bytes after the name), [1..]: data */
+} DivFile;
+
+typedef struct DivChan {
+    const char *fname;
+    int chan;
+    pthread_t thread;
+    jmp_buf stop;            /* GetBytes' fatal errors end the thread, not the process */
+    DivFile *files, **tail;
+    DivFile *cur;
+    unsigned char buf [256]; /* WriteCas collects the current sector here */
+    int buflen;
+    unsigned long rate;
+    int stopped;             /* ThreadStop was called: the channel is cut short */
+} DivChan;
+
+static _Thread_local DivChan *Div= NULL;
+
+/* -batch: one capture, decoded by a worker-thread into its own directory */
+typedef struct BatchJob {
+    const char *fname;
+    char *outdir;
+    jmp_buf stop;            /* fatal errors end the job, not the process */
+    int failed;
+    int programs;            /* CAS-files written... */
+    int partial;             /* ...of them cut short or with a map */
+    long sectok, sectbad;
+    WavOff samples;
+    double time;
+} BatchJob;
+
+static _Thread_local BatchJob *Job= NULL;
+
+/* in a worker-thread the fatal errors end the thread (or job) only */
+static void ThreadStop (void)
+{
+    if (Div) longjmp (Div->stop, 1);
+    if (Job) longjmp (Job->stop, 1);
+}
+
+static _Thread_local int CasState= 0;
+static _Thread_local char *CasName= NULL;
+static _Thread_local FILE *CasFile= NULL;
+static _Thread_local long CasLen= 0;     /* bytes written after the CPMHDR */
+static _Thread_local long CasExpect= -1; /* from the PRGFILEHDR, -1 = unknown */
+
+/* the name and the stdio-buffers of the current file; reset when it is
+   closed, the blocks are kept for the next one */
+static _Thread_local Arena CasArena;
+
+static void *CasAlloc (size_t n)
+{
+    void *p;
+
+    p= ArenaAlloc (&CasArena, n);
+    if (p) return p;
+    fprintf (stderr, "Out of memory (arena (%lu))\n", (unsigned long)n);
+    ThreadStop ();
+    exit (33);
+    return NULL;
+}
+
+/* the buffers kept from file to file, at the end of a worker */
+static void ThreadFree (void)
+{
+    ArenaFree (&CasArena);
+    free (GB.rs.bits);
+    free (GB.rs.pos);
+    GB.rs.bits= NULL;
+    GB.rs.pos= NULL;
+    GB.rs.cap= 0;
+}
+
+/* -recover: the damaged ranges of the current file, written to <name>.map */
+typedef struct Damage {
+    long off;                /* in the CAS-file, after the CPMHDR */
+    long len;
+    WavOff pos;              /* where it was found in the WAV-file */
+    const char *why;
+} Damage;
+
+static _Thread_local Damage *CasDamage= NULL;
+static _Thread_local int CasNDamage= 0, CasMaxDamage= 0;
 
 static void AbortCas (void)
 {
+    if (Div) {
+        Div->cur= NULL;
+        return;
+    }
     if (CasState) {
         fclose (CasFile);
         CasFile = NULL;
         remove (CasName);
-        free (CasName);
         CasName = NULL;
+        ArenaReset (&CasArena);
         CasState= 0;
+        CasNDamage= 0;
+    }
+}
+
+/* -batch: <outdir>/<name>.cas, or <name>-1.cas etc. if it already exists */
+static void StartJobCas (size_t namelen, const char *name)
+{
+    size_t dirlen, size, i;
+    int n;
+
+    dirlen= strlen (Job->outdir);
+    size= dirlen+1+namelen+12+4+1;
+    CasName = CasAlloc (size);
+    for (n=0; ; ++n) {
+        snprintf (CasName, size, "%s/%.*s", Job->outdir, (int)namelen, name);
+        for (i=dirlen+1; i<dirlen+1+namelen; ++i) {
+            if (!isalnum(CasName[i]) && !strchr("-_@", CasName[i]))
+                CasName[i]= '_';
+        }
+        if (n) sprintf (CasName+dirlen+1+namelen, "-%d", n);
+        strcat (CasName, ".cas");
+        if ((CasFile= fopen (CasName, "wbx")) != NULL) return;
+        if (errno != EEXIST) break;
     }
+    efopen (CasName, "wbx");    /* reports the error */
 }
 
 static void StartCas (size_t namelen, const char *name)
@@ -426,17 +977,40 @@ static void StartCas (size_t namelen, const char *name)
     CPMHDR cpm;
     unsigned i;
 
+    if (Div) {
+        DivFile *df;
+
+        df= emalloc (sizeof *df);
+        memset (df, 0, sizeof *df);
+        memcpy (df->name, name, namelen);
+        df->namelen= namelen;
+        df->pos= GB.wav.pos;
+        for (i=0; i<256; ++i) df->sect[i].len= -1;
+        *Div->tail= df;
+        Div->tail= &df->next;
+        Div->cur= df;
+        Div->buflen= 0;
+        return;
+    }
     if (CasState) {
         AbortCas ();
     }
-    CasName = emalloc (namelen+4+1);
-    sprintf (CasName, "%.*s.cas", (int)namelen, name);
-    for (i=0; i<namelen; ++i) {
-        if (!isalnum(CasName[i]) && !strchr("-_@", CasName[i]))
-            CasName[i]= '_';
+    if (Job) {
+        StartJobCas (namelen, name);
+    } else {
+        CasName = CasAlloc (namelen+4+1);
+        snprintf (CasName, namelen+4+1, "%.*s.cas", (int)namelen, name);
+        for (i=0; i<namelen; ++i) {
+            if (!isalnum(CasName[i]) && !strchr("-_@", CasName[i]))
+                CasName[i]= '_';
+        }
+        CasFile = efopen (CasName, "wb");
     }
-    CasFile = efopen (CasName, "wb");
+    setvbuf (CasFile, CasAlloc (BUFSIZ), _IOFBF, BUFSIZ);
     CasState= 1;
+    CasLen= 0;
+    CasExpect= -1;
+    CasNDamage= 0;
 
     memset (&cpm, 0, sizeof (cpm));
     cpm.magic = CPMHDR_MAGIC;
@@ -445,17 +1019,174 @@ static void StartCas (size_t namelen, const char *name)
 
 static void WriteCas (size_t len, const void *data)
 {
+    if (Div) {
+        if (Div->cur && Div->buflen+len <= sizeof Div->buf) {
+            memcpy (Div->buf+Div->buflen, data, len);
+            Div->buflen += len;
+        }
+        return;
+    }
     if (CasState==0) exit(32);
+    if (opt.stats) StatEnter (STG_WRITE);
     fwrite (data, 1, len, CasFile);
+    CasLen += len;
+    if (opt.stats) StatLeave ();
+}
+
+static long TellCas (void)
+{
+    return CasLen;
+}
+
+/* the length of the file (after the CPMHDR), if the header tells it */
+static void ExpectCas (long len)
+{
+    CasExpect= len;
+}
+
+/* notes a damaged range, for the .map */
+static void NoteDamage (long off, long len, WavOff pos, const char *why)
+{
+    Damage *d;
+
+    if (Div || !CasState || len<=0) return;
+    if (CasNDamage == CasMaxDamage) {
+        CasMaxDamage= CasMaxDamage ? 2*CasMaxDamage : 16;
+        CasDamage= realloc (CasDamage, CasMaxDamage * sizeof *CasDamage);
+        if (!CasDamage) {
+            fprintf (stderr, "Out of memory\n");
+            exit (16);
+        }
+    }
+    d= &CasDamage [CasNDamage++];
+    d->off= off;
+    d->len= len;
+    d->pos= pos;
+    d->why= why;
+}
+
+/* -recover: notes a damaged range; without -recover the CRC-messages tell it */
+static void DamageCas (long off, long len, WavOff pos, const char *why)
+{
+    if (opt.recover) NoteDamage (off, len, pos, why);
+}
+
+/* zeroes instead of the missing bytes, so the offsets are kept */
+static void FillCas (long len, WavOff pos, const char *why)
+{
+    static const char zeroes [256];
+    long n;
+
+    if (Div || !CasState || len<=0) return;
+    DamageCas (TellCas (), len, pos, why);
+    for (; len>0; len -= n) {
+        n= len < (long)sizeof zeroes ? len : (long)sizeof zeroes;
+        WriteCas (n, zeroes);
+    }
+}
+
+/* -recover: the current file can't be read further (GetBytes failed, or the
+   data-block is missing); it is closed as a partial file */
+static void RecoverCas (void)
+{
+    fprintf (stderr, "%06llx recovering: scanning for the next block\n", GB.wav.pos);
+    Annot (GB.wav.pos, "recover");
+    ResyncEnd ();
+    if (Div) {
+        AbortCas ();        /* MergeDiv gets it as an incomplete file */
+        return;
+    }
+    if (!CasState) return;
+    if (CasExpect > TellCas ()) {
+        FillCas (CasExpect - TellCas (), GB.wav.pos, "lost");
+    } else if (CasExpect < 0) {
+        DamageCas (TellCas (), 1, GB.wav.pos, "truncated");
+    }
+    CloseCas ();
+}
+
+/* a buffered file broken off after some of its data-blocks: without -recover
+   too, it is closed as a partial file, with a .map marking where it ends */
+static void TruncCas (void)
+{
+    fprintf (stderr, "%06llx the file is cut off, the sectors read are kept\n", GB.wav.pos);
+    Annot (GB.wav.pos, "truncated");
+    if (Div) {
+        AbortCas ();        /* MergeDiv gets it as an incomplete file */
+        return;
+    }
+    if (!CasState) return;
+    NoteDamage (TellCas (), 1, GB.wav.pos, "truncated");
+    CloseCas ();
+}
+
+/* called after each sector (0 is the header-sector) */
+static void CrcCas (int sectno, int crcok)
+{
+    if (!crcok) {
+        fprintf (stderr, "CRC error in sector %d\n", sectno);
+    }
+    if (Job) {
+        if (crcok) ++Job->sectok;
+        else       ++Job->sectbad;
+    }
+    if (Div && Div->cur && sectno >= (int)(sizeof Div->cur->sect / sizeof Div->cur->sect[0])) {
+        fprintf (stderr, "diversity: too many sectors, the file is dropped\n");
+        Div->cur= NULL;
+    }
+    if (Div) {
+        if (Div->cur) {
+            DivSect *ds= &Div->cur->sect [sectno];
+
+            memcpy (ds->data, Div->buf, Div->buflen);
+            ds->len= Div->buflen;
+            ds->crcok= crcok;
+            Div->cur->nsect= sectno;
+        }
+        Div->buflen= 0;
+    }
+}
+
+/* <name>.map: one line per damaged range, the offsets are in the CAS-file */
+static void WriteMap (void)
+{
+    char *name;
+    FILE *f;
+    int i;
+
+    name= CasAlloc (strlen (CasName)+1);
+    strcpy (name, CasName);
+    strcpy (name+strlen (name)-4, ".map");
+    f= efopen (name, "w");
+    setvbuf (f, CasAlloc (BUFSIZ), _IOFBF, BUFSIZ);
+    fprintf (f, "# %s: damaged ranges (offset length wav-position reason)\n", CasName);
+    for (i=0; i<CasNDamage; ++i) {
+        fprintf (f, "%06lx %ld %06llx %s\n",
+            (long)sizeof (CPMHDR) + CasDamage[i].off, CasDamage[i].len,
+            CasDamage[i].pos, CasDamage[i].why);
+    }
+    fclose (f);
+    fprintf (stderr, "%s is partial, see %s\n", CasName, name);
+    if (Job) ++Job->partial;
+    CasNDamage= 0;
 }
 
 static void CloseCas (void)
 {
+    if (Div) {
+        if (Div->cur) Div->cur->complete= 1;
+        Div->cur= NULL;
+        return;
+    }
+    if (CasNDamage) {
+        WriteMap ();
+    }
+    if (Job) ++Job->programs;
     fclose (CasFile);
     CasFile = NULL;
-    free (CasName);
     CasName = NULL;
     CasState= 0;
+    ArenaReset (&CasArena);
 }
 
 static void *emalloc (int n)
@@ -506,6 +1237,19 @@ static const double F_lead_h =               1.05;
 static const double F_sync_l = 736.0/470.0 * 0.95;
 static const double F_sync_h = 736.0/470.0 * 1.35; /* was: 1.05 */
 
+static void PrintIntervals (const char *title)
+{
+    if (GB.frac!=1) {
+        fprintf (stderr, "(1/%d samples) ", GB.frac);
+    }
+    fprintf (stderr, "%s: bit1: %d-%d, lead: %d-%d, bit0: %d-%d, sync: %d-%d\n",
+        title,
+        GB.bit1.minv, GB.bit1.maxv,
+        GB.lead.minv, GB.lead.maxv,
+        GB.bit0.minv, GB.bit0.maxv,
+        GB.sync.minv, GB.sync.maxv);
+}
+
 static void CalcIntervals (double i)
 {
     GB.bit1.minv= floor (i * F_bit1_l);
@@ -515,109 +1259,511 @@ static void CalcIntervals (double i)
     GB.sync.maxv= ceil (i* F_sync_h);
 
     if (opt.debug>=1) {
-        fprintf (stderr, "intervals: bit1: %d-%d, lead: %d-%d, bit0: %d-%d, sync: %d-%d\n",
-            GB.bit1.minv, GB.bit1.maxv,
-            GB.lead.minv, GB.lead.maxv,
-            GB.bit0.minv, GB.bit0.maxv,
-            GB.sync.minv, GB.sync.maxv);
+        PrintIntervals ("intervals");
+    }
+}
+
+/* the peak of the whole-file histogram in [lo,hi], -1 if there aren't enough samples */
+#define HIST_MINPEAK 32
+
+static int HistPeak (double lo, double hi)
+{
+    int i, imin, imax, ipeak;
+
+    imin= (int)ceil (lo);
+    imax= (int)floor (hi);
+    if (imin < 1) imin= 1;
+    if (imax > HIST_SIZE-2) imax= HIST_SIZE-2;
+    for (i= imin, ipeak= -1; i<=imax; ++i) {
+        if (ipeak==-1 || ST.tot.hist[i] > ST.tot.hist[ipeak]) ipeak= i;
+    }
+    if (ipeak==-1 || ST.tot.hist[ipeak] < HIST_MINPEAK) return -1;
+    return ipeak;
+}
+
+/* -autocal: bit1/bit0 peaks are taken from the pulses of the previous blocks,
+   the window-boundaries are the midpoints between the neighbouring peaks;
+   if a peak is missing (eg. first block), CalcIntervals' values remain */
+static void CalcIntervalsHist (double i)
+{
+    int p1, pl, p0, ps;
+
+    i /= GB.frac;   /* the histogram is in samples */
+    p1= HistPeak (i*388.0/470.0*0.92, i*388.0/470.0*1.08);
+    p0= HistPeak (i*552.0/470.0*0.92, i*552.0/470.0*1.08);
+    if (p1==-1 || p0==-1) return;
+    pl= (int)floor (i+0.5);
+    ps= (int)floor (i*736.0/470.0+0.5);
+    if (!(p1 < pl && pl < p0 && p0 < ps)) return;
+    p1 *= GB.frac;
+    pl *= GB.frac;
+    p0 *= GB.frac;
+    ps *= GB.frac;
+
+    GB.bit1.maxv= (p1+pl)/2;
+    GB.bit1.minv= p1 - (GB.bit1.maxv - p1);
+    GB.lead.minv= GB.bit1.maxv+1;
+    GB.lead.maxv= (pl+p0)/2;
+    GB.bit0.minv= GB.lead.maxv+1;
+    GB.bit0.maxv= (p0+ps)/2;
+    GB.sync.minv= GB.bit0.maxv+1;
+
+    if (opt.debug>=1) {
+        PrintIntervals ("intervals (autocal)");
     }
 }
 
+/* the stdio-buffer of the WAV-file, the same for each capture of a thread */
+static _Thread_local char WavBuf [BUFSIZ];
+
 static void WavOpen (const char *name)
 {
-    GB.wfile= efopen (name, "rb");
+    if (strcmp (name, "-")==0) {
+        GB.wfile= stdin;
+    } else {
+        GB.wfile= efopen (name, "rb");
+        setvbuf (GB.wfile, WavBuf, _IOFBF, sizeof WavBuf);
+    }
+    WavParseHeader ();
+    GB.raw.len= 0;
+    GB.ring.head= 0;
     GB.wav.sta= STA_INIT;
     GB.wav.pos= 0;
+    GB.frac= opt.interp ? FRAC : 1;
+    if (StatsOn()) ST.start= Now();
     WavRead();
     GB.seq.sta= STA_INIT;
     GB.pulse.sta= STA_INIT;
     GB.bit.sta= STA_INIT;
     GB.byte.sta= STA_INIT;
-
-    GB.fh.len= WavReadBytes (&GB.fh.bytes, sizeof GB.fh.bytes);
-    if (opt.debug>=1) {
-        fprintf (stderr, "Wav-header skipped (%u bytes)\n",
-            (unsigned)GB.fh.len);
-    }
 }
 
 static void WavClose (void)
 {
-    fclose (GB.wfile);
+    if (GB.wfile != stdin) fclose (GB.wfile);
     GB.wfile= NULL;
 }
 
-static int WavRead (void) {
-    int c;
-
-    if (GB.wav.sta==STA_EOF) return EOF;
-    if (GB.wav.sta!=STA_INIT) ++GB.wav.pos;
+static unsigned long Peek4 (const unsigned char *p)
+{
+    return (unsigned long)PEEK2 (p) | ((unsigned long)PEEK2 (p+2) << 16);
+}
 
-    c= fgetc (GB.wfile);
-    if (c==EOF) {
-        GB.wav.sta= STA_EOF;
-    } else {
-        GB.wav.sta= STA_FILLED;
-        GB.wav.cache= (unsigned char)c;
-    }
-    return c;
+static WavOff Peek8 (const unsigned char *p)
+{
+    return (WavOff)Peek4 (p) | ((WavOff)Peek4 (p+4) << 32);
 }
 
-static size_t WavReadBytes (void *to, size_t len) {
-    unsigned char *p0= to;
-    unsigned char *plim= p0+len;
-    unsigned char *p= p0;
+static int HdrRead (void *to, size_t len)
+{
+    return fread (to, 1, len, GB.wfile)==len ? 0 : -1;
+}
 
-    if (len==0) return 0;
-    if (GB.wav.sta==STA_EOF) return 0;
+/* skipping by reading, as stdin might be a pipe */
+static int HdrSkip (WavOff len)
+{
+    unsigned char tmp [256];
+    size_t n;
 
-    while (p<plim && GB.wav.sta != EOF) {
-        *p++ = GB.wav.cache;
-        WavRead();
+    while (len > 0) {
+        n= len > (WavOff)sizeof tmp ? sizeof tmp : (size_t)len;
+        if (HdrRead (tmp, n)) return -1;
+        len -= n;
     }
-    return p - p0;
+    return 0;
 }
 
-#define SignOfByte(b) ((b)<0x80 ? (-1) : \
-                       (b)>0x80 ?   1  : 0)
-
-static int SeqRead (void)
+/* 'fmt ' chunk: tag(2) channels(2) rate(4) byterate(4) blockalign(2) bits(2) */
+static int WavParseFmt (const unsigned char *p)
 {
-    if (GB.seq.sta == STA_EOF) return EOF;
-    if (GB.wav.sta == STA_EOF) {
-        GB.seq.sta= STA_EOF;
-        return EOF;
+    unsigned tag;
+
+    tag= PEEK2 (p);
+    GB.fh.channels= PEEK2 (p+2);
+    GB.fh.rate= Peek4 (p+4);
+    GB.fh.bits= PEEK2 (p+14);
+    if ((tag!=1 && tag!=0xfffe) || GB.fh.channels==0 ||
+        (GB.fh.bits!=8 && GB.fh.bits!=16)) {
+        fprintf (stderr, "Unsupported WAV-format (tag=%04x channels=%u bits=%u)\n",
+            tag, GB.fh.channels, GB.fh.bits);
+        ThreadStop ();
+        exit (16);
     }
+    return 0;
+}
 
-    GB.seq.sta= STA_FILLED;
-    GB.seq.s.wp.pos= GB.wav.pos;
-    GB.seq.s.wp.len= 1;
-    GB.seq.s.sign= SignOfByte (GB.wav.cache);
-    WavRead();
+/* RIFF/RF64: the magic (4 bytes) has already been read */
+static int WavParseRiff (void)
+{
+    unsigned char ck [8], buf [28];
+    WavOff len, ds64data= -1;
+    int fmtfound= 0;
 
-    while (GB.wav.sta == STA_FILLED &&
-           SignOfByte(GB.wav.cache)==GB.seq.s.sign) {
-        ++GB.seq.s.wp.len;
-        WavRead();
+    if (HdrRead (buf, 8) || memcmp (buf+4, "WAVE", 4)) return -1;
+    while (1) {
+        if (HdrRead (ck, 8)) return -1;
+        len= Peek4 (ck+4);
+        if (GB.fh.type==WAV_RF64 && memcmp (ck, "ds64", 4)==0) {
+            if (len < 24 || HdrRead (buf, 24)) return -1;
+            ds64data= Peek8 (buf+8);
+            len -= 24;
+        } else if (memcmp (ck, "fmt ", 4)==0) {
+            if (len < 16 || HdrRead (buf, 16)) return -1;
+            fmtfound= !WavParseFmt (buf);
+            len -= 16;
+        } else if (memcmp (ck, "data", 4)==0) {
+            if (!fmtfound) return -1;
+            if (GB.fh.type==WAV_RF64 && len==0xffffffffUL) len= ds64data;
+            else if (len==0 || len==0xffffffffUL) len= -1; /* written by a live capture */
+            GB.fh.datarem= len;
+            return 0;
+        }
+        if (HdrSkip (len + (len&1))) return -1;
     }
-    return 0;
 }
 
-static int PulseRead (void)
+/* Sony Wave64: chunks are GUID(16) + size(8, including the 24 bytes), 8-byte aligned */
+static const unsigned char W64_riff [16] = {
+    'r','i','f','f', 0x2e,0x91,0xcf,0x11, 0xa5,0xd6,0x28,0xdb, 0x04,0xc1,0x00,0x00
+};
+static const unsigned char W64_wave [16] = {
+    'w','a','v','e', 0xf3,0xac,0xd3,0x11, 0x8c,0xd1,0x00,0xc0, 0x4f,0x8e,0xdb,0x8a
+};
+static const unsigned char W64_fmt [16] = {
+    'f','m','t',' ', 0xf3,0xac,0xd3,0x11, 0x8c,0xd1,0x00,0xc0, 0x4f,0x8e,0xdb,0x8a
+};
+static const unsigned char W64_data [16] = {
+    'd','a','t','a', 0xf3,0xac,0xd3,0x11, 0x8c,0xd1,0x00,0xc0, 0x4f,0x8e,0xdb,0x8a
+};
+
+static int WavParseW64 (void)
 {
-    Seq sFirst, sNext;
+    unsigned char ck [24], buf [16];
+    WavOff len;
+    int fmtfound= 0;
 
-    if (GB.pulse.sta == STA_EOF) return EOF;
-    if (GB.seq.sta==STA_INIT) SeqRead();
-    if (GB.seq.sta==STA_EOF) {
-        GB.pulse.sta= STA_EOF;
-        return EOF;
+    if (HdrRead (ck+4, 12) || memcmp (ck+4, W64_riff+4, 12) ||
+        HdrRead (ck, 8) || HdrRead (buf, 16) || memcmp (buf, W64_wave, 16)) return -1;
+    while (1) {
+        if (HdrRead (ck, 24)) return -1;
+        len= Peek8 (ck+16) - 24;
+        if (len < 0) return -1;
+        if (memcmp (ck, W64_fmt, 16)==0) {
+            if (len < 16 || HdrRead (buf, 16)) return -1;
+            fmtfound= !WavParseFmt (buf);
+            len -= 16;
+        } else if (memcmp (ck, W64_data, 16)==0) {
+            if (!fmtfound) return -1;
+            GB.fh.datarem= len;
+            return 0;
+        }
+        if (HdrSkip (len + (-len&7))) return -1;
     }
-    if (GB.pulse.sta == STA_INIT) {
-        Seq sZero;
-        int foundzeroes= 0;
+}
 
-        while (GB.seq.sta==STA_FILLED && !foundzeroes) {
+static void WavParseHeader (void)
+{
+    unsigned char magic [4];
+    int rc;
+
+    GB.fh.type= WAV_RAW;
+    GB.fh.channels= 1;
+    GB.fh.bits= 8;
+    GB.fh.rate= 0;
+    GB.fh.datarem= -1;
+
+    if (HdrRead (magic, 4)) {
+        return; /* empty file: EOF at the first read */
+    }
+    if (memcmp (magic, "RIFF", 4)==0) {
+        GB.fh.type= WAV_RIFF;
+        rc= WavParseRiff ();
+    } else if (memcmp (magic, "RF64", 4)==0) {
+        GB.fh.type= WAV_RF64;
+        rc= WavParseRiff ();
+    } else if (memcmp (magic, W64_riff, 4)==0) {
+        GB.fh.type= WAV_W64;
+        rc= WavParseW64 ();
+    } else {
+        rc= HdrSkip (64-4);
+    }
+    if (rc) {
+        fprintf (stderr, "Bad or truncated WAV-header\n");
+        ThreadStop ();
+        exit (16);
+    }
+    if (GB.chan >= (int)GB.fh.channels ||
+        (GB.chan < 0 && GB.fh.channels > 2)) {
+        fprintf (stderr, "Channel selection doesn't fit the WAV-file (channels=%u)\n",
+            GB.fh.channels);
+        ThreadStop ();
+        exit (16);
+    }
+    GB.snr[0]= GB.snr[1]= 0;
+    memset (&GB.fe, 0, sizeof GB.fe);
+    GB.fe.hold= GB.fh.rate ? (int)(GB.fh.rate/4000) : 11; /* 0.25 msec */
+    if (GB.fe.hold < 2) GB.fe.hold= 2;
+    if (opt.debug>=1) {
+        fprintf (stderr, "Wav-header: type=%d channels=%u bits=%u rate=%lu datalen=%lld\n",
+            GB.fh.type, GB.fh.channels, GB.fh.bits, GB.fh.rate, GB.fh.datarem);
+    }
+}
+
+/* channel 'c' of the frame at 'p' as 16-bit signed */
+#define FrameSample(p,c) (GB.fh.bits==8 ? ((int)(p)[c] - 0x80) * 256 : \
+                          (int)(short)((p)[2*(c)] | ((p)[2*(c)+1] << 8)))
+
+/* CHAN_BEST: the signal/noise ratio of a channel is estimated as
+   (sum of |sample|) / (sum of |difference of neighbouring samples|):
+   the tape-signal is slow compared to the sampling rate, hiss is not;
+   the weights of the first two channels are proportional to it */
+static void MixWeights (const unsigned char *p, size_t n, size_t frame, int *w)
+{
+    double a [2], d [2], snr;
+    int prev [2], c, v;
+    size_t i;
+
+    for (c=0; c<2; ++c) {
+        a[c]= d[c]= 0;
+        prev[c]= FrameSample (p, c);
+    }
+    for (i=0; i<n; ++i, p+=frame) {
+        for (c=0; c<2; ++c) {
+            v= FrameSample (p, c);
+            a[c] += abs (v);
+            d[c] += abs (v - prev[c]);
+            prev[c]= v;
+        }
+    }
+    for (c=0; c<2; ++c) {
+        snr= a[c] / (d[c] + 1);
+        GB.snr[c]= GB.snr[c]==0 ? snr : (GB.snr[c] + snr) / 2;
+    }
+    w[0]= 1 + (int)(256 * GB.snr[0] / (GB.snr[0] + GB.snr[1] + 1e-9));
+    w[1]= 1 + (int)(256 * GB.snr[1] / (GB.snr[0] + GB.snr[1] + 1e-9));
+}
+
+/* front-end of a contiguous piece of the ring: DC-offset removal, high-pass,
+   signs with dead-band; the loops except the high-pass and the hysteresis
+   are independent per sample, so the compiler can vectorize them */
+static void FrontEndBlock (const unsigned char *in, short *val, signed char *sgn, size_t n)
+{
+    size_t i;
+    long sum;
+    double mean, r;
+    int dc, band, v;
+
+    if (opt.dc) {   /* the mean of the block, smoothed over the blocks */
+        for (i=0, sum=0; i<n; ++i) {
+            sum += in[i];
+        }
+        mean= ((double)sum/n - 0x80) * 256;
+        GB.fe.dc= GB.fe.ndc++ ? GB.fe.dc*0.75 + mean*0.25 : mean;
+    }
+    dc= (int)GB.fe.dc;
+    for (i=0; i<n; ++i) {
+        v= ((int)in[i] - 0x80) * 256 - dc;
+        val[i]= (short)(v < -32768 ? -32768 : v > 32767 ? 32767 : v);
+    }
+    if (opt.hipass) { /* one pole, about 100 Hz */
+        r= GB.fh.rate ? 1.0 - 2*3.14159265*100/GB.fh.rate : 0.986;
+        for (i=0; i<n; ++i) {
+            GB.fe.hpy= val[i] - GB.fe.hpx + r*GB.fe.hpy;
+            GB.fe.hpx= val[i];
+            val[i]= (short)(GB.fe.hpy < -32768 ? -32768 : GB.fe.hpy > 32767 ? 32767 : GB.fe.hpy);
+        }
+    }
+    band= opt.band * 256;
+    for (i=0; i<n; ++i) {
+        sgn[i]= (signed char)((val[i] > band) - (val[i] < -band));
+    }
+    /* hysteresis: crossing the band doesn't end the sequence; with no band
+       it keeps an exact zero sample at a crossing from cutting the run */
+    {
+        for (i=0; i<n; ++i) {
+            if (sgn[i] != 0) {
+                GB.fe.last= sgn[i];
+                GB.fe.zrun= 0;
+            } else if (GB.fe.last != 0) {
+                if (++GB.fe.zrun <= GB.fe.hold) sgn[i]= (signed char)GB.fe.last;
+                else GB.fe.last= 0;
+            }
+        }
+    }
+}
+
+/* new samples in the ring: [from,from+n) */
+static void FrontEnd (WavOff from, size_t n)
+{
+    size_t i0, n0;
+
+    i0= (size_t)(from & (RING_SIZE-1));
+    n0= RING_SIZE - i0 < n ? RING_SIZE - i0 : n;
+    FrontEndBlock (GB.ring.buf + i0, GB.ring.val + i0, GB.ring.sign + i0, n0);
+    OvwAdd (GB.ring.val + i0, n0);
+    if (n0 < n) {
+        FrontEndBlock (GB.ring.buf, GB.ring.val, GB.ring.sign, n - n0);
+        OvwAdd (GB.ring.val, n - n0);
+    }
+}
+
+/* reads the next piece of the data-chunk into the ring, returns the number of new samples */
+static size_t WavFill (void)
+{
+    size_t frame, want, got, n, i;
+    const unsigned char *p;
+    unsigned char *ring;
+    int c, v, w [2];
+
+    frame= GB.fh.channels * (GB.fh.bits/8);
+    do {
+        want= sizeof GB.raw.buf - GB.raw.len;
+        if (GB.fh.datarem >= 0 && (WavOff)want > GB.fh.datarem) want= (size_t)GB.fh.datarem;
+        if (want==0) break;
+        got= fread (GB.raw.buf + GB.raw.len, 1, want, GB.wfile);
+        if (got==0) break;
+        GB.raw.len += got;
+        if (GB.fh.datarem >= 0) GB.fh.datarem -= got;
+    } while (GB.raw.len < frame);
+
+    n= GB.raw.len / frame;
+    ring= GB.ring.buf;
+    p= GB.raw.buf;
+    c= GB.chan;
+    if (c<0 && GB.fh.channels==1) c= 0;
+    if (c>=0 && GB.fh.bits==8) {
+        for (i=0; i<n; ++i, p+=frame) {
+            ring [(GB.ring.head+i) & (RING_SIZE-1)]= p[c];
+        }
+    } else if (c>=0) { /* 16 bit signed: the high byte, made unsigned */
+        for (i=0; i<n; ++i, p+=frame) {
+            ring [(GB.ring.head+i) & (RING_SIZE-1)]= (unsigned char)(p[2*c+1]^0x80);
+        }
+    } else {
+        if (c==CHAN_BEST) {
+            MixWeights (p, n, frame, w);
+        } else {
+            w[0]= w[1]= 1;
+        }
+        for (i=0; i<n; ++i, p+=frame) {
+            v= (w[0]*FrameSample (p, 0) + w[1]*FrameSample (p, 1)) / (w[0]+w[1]);
+            ring [(GB.ring.head+i) & (RING_SIZE-1)]= (unsigned char)((v>>8)+0x80);
+        }
+    }
+    FrontEnd (GB.ring.head, n);
+    GB.ring.head += n;
+    GB.raw.len -= n*frame;
+    memmove (GB.raw.buf, p, GB.raw.len);
+    return n;
+}
+
+static int WavRead (void) {
+    if (GB.wav.sta==STA_EOF) return EOF;
+    if (GB.wav.sta!=STA_INIT) ++GB.wav.pos;
+
+    if (GB.wav.pos==GB.ring.head && WavFill()==0) {
+        GB.wav.sta= STA_EOF;
+        return EOF;
+    }
+    GB.wav.sta= STA_FILLED;
+    GB.wav.cache= GB.ring.buf [GB.wav.pos & (RING_SIZE-1)];
+    GB.wav.sign= GB.ring.sign [GB.wav.pos & (RING_SIZE-1)];
+    return GB.wav.cache;
+}
+
+
+static int SeqRead (void)
+{
+    int rc;
+
+    if (!StatsOn()) return SeqRead1();
+    StatEnter (STG_SEQ);
+    rc= SeqRead1();
+    if (rc==0) {
+        ++ST.blk.runs;
+    }
+    StatLeave ();
+    return rc;
+}
+
+#define SignOf(v) ((v)>0 ? 1 : (v)<0 ? -1 : 0)
+
+/* the zero-crossing before the sample at 'pos', in 1/GB.frac samples;
+   linear interpolation between the two samples (the previous one is still in the ring);
+   with a dead-band the sign changes after the signal has crossed zero,
+   so the crossing is looked for in the last GB.fe.hold samples */
+static WavOff Crossing (WavOff pos)
+{
+    WavOff lim;
+    int va, vb, sb;
+
+    if (GB.frac==1 || pos==0) return pos*GB.frac;
+    sb= SignOf (GB.ring.val [pos & (RING_SIZE-1)]);
+    lim= pos - GB.fe.hold;
+    while (pos-1 > 0 && pos > lim && sb != 0 &&
+           SignOf (GB.ring.val [(pos-1) & (RING_SIZE-1)])==sb) --pos;
+    va= abs (GB.ring.val [(pos-1) & (RING_SIZE-1)]);
+    vb= abs (GB.ring.val [pos & (RING_SIZE-1)]);
+    if (va+vb==0) return pos*GB.frac - GB.frac/2;
+    return (pos-1)*GB.frac + ((WavOff)va*GB.frac + (va+vb)/2) / (va+vb);
+}
+
+static int SeqRead1 (void)
+{
+    if (GB.seq.sta == STA_EOF) return EOF;
+    if (GB.wav.sta == STA_EOF) {
+        GB.seq.sta= STA_EOF;
+        return EOF;
+    }
+
+    GB.seq.sta= STA_FILLED;
+    GB.seq.s.wp.pos= GB.wav.pos;
+    GB.seq.s.wp.len= 1;
+    GB.seq.s.sign= GB.wav.sign;
+    GB.seq.s.fx= Crossing (GB.wav.pos);
+    WavRead();
+
+    while (GB.wav.sta == STA_FILLED &&
+           GB.wav.sign==GB.seq.s.sign) {
+        ++GB.seq.s.wp.len;
+        WavRead();
+    }
+    return 0;
+}
+
+static int PulseRead (void)
+{
+    int rc;
+    WavOff len;
+
+    if (!StatsOn()) return PulseRead1();
+    StatEnter (STG_PULSE);
+    rc= PulseRead1();
+    if (rc==0) {
+        len= GB.pulse.p.wp.len;
+        if (ST.blk.pulses==0) ST.blkpos= GB.pulse.p.wp.pos;
+        ++ST.blk.pulses;
+        ++ST.blk.hist [len < HIST_SIZE ? len : HIST_SIZE-1];
+    }
+    StatLeave ();
+    return rc;
+}
+
+static int PulseRead1 (void)
+{
+    Seq sFirst, sNext;
+
+    if (GB.pulse.sta == STA_EOF) return EOF;
+    if (GB.seq.sta==STA_INIT) SeqRead();
+    if (GB.seq.sta==STA_EOF) {
+        GB.pulse.sta= STA_EOF;
+        return EOF;
+    }
+    if (GB.pulse.sta == STA_INIT) {
+        Seq sZero;
+        int foundzeroes= 0;
+
+        while (GB.seq.sta==STA_FILLED && !foundzeroes) {
             foundzeroes= GB.seq.s.sign==0 && GB.seq.s.wp.len >= MINZEROES;
             if (foundzeroes) sZero= GB.seq.s;
             SeqRead();
@@ -629,16 +1775,41 @@ static int PulseRead (void)
         sFirst= GB.seq.s;
         fprintf(stderr,
                 "PulseRead: found zeroes at"
-                " %06lx (len=%ld), data after it at %06lx\n",
+                " %06llx (len=%lld), data after it at %06llx\n",
                 sZero.wp.pos, sZero.wp.len, sFirst.wp.pos);
         sFirst= GB.seq.s;
+        GB.pulse.sign= sFirst.sign;
     } else {
         sFirst= GB.seq.s;
+        if (sFirst.sign==0 && opt.recover && sFirst.wp.len < MINZEROES) {
+            fprintf(stderr,
+                "PulseRead: dropout at %06llx (len=%lld) skipped\n",
+                sFirst.wp.pos, sFirst.wp.len);
+            SeqRead();
+            if (GB.seq.sta==STA_EOF) {
+                GB.pulse.sta= STA_EOF;
+                return EOF;
+            }
+            sFirst= GB.seq.s;
+        }
+        if (sFirst.sign== -GB.pulse.sign && opt.recover) {
+            /* the rest of a damaged pulse: the halves are paired again */
+            fprintf(stderr,
+                "PulseRead: half-pulse at %06llx (len=%lld) skipped\n",
+                sFirst.wp.pos, sFirst.wp.len);
+            SeqRead();
+            if (GB.seq.sta==STA_EOF) {
+                GB.pulse.sta= STA_EOF;
+                return EOF;
+            }
+            sFirst= GB.seq.s;
+        }
         if (sFirst.sign==0) {
             fprintf(stderr,
                 "PulseRead: after valid impulse found zeroes at"
-                " %06lx (len=%ld); reset state\n",
+                " %06llx (len=%lld); reset state\n",
                 sFirst.wp.pos, sFirst.wp.len);
+            StatReject (REJ_ZEROES);
             GB.pulse.sta= STA_EOF;
             return EOF;
         }
@@ -647,16 +1818,24 @@ static int PulseRead (void)
     if (GB.seq.sta==STA_EOF) {
         fprintf(stderr,
                 "PulseRead: EOF after a half-pulse\n");
+        StatReject (REJ_HALFEOF);
         GB.pulse.sta= STA_EOF;
         return EOF;
     }
     sNext= GB.seq.s;
-    if (sNext.sign==0 || sFirst.sign*sNext.sign != -1) {
+    if (sNext.sign==0 && opt.recover && sNext.wp.len < MINZEROES) {
+        /* -recover: a dropout in the second half; the pulse is made of
+           them, BitRead takes it as a bit if it can */
+        fprintf(stderr,
+                "PulseRead: dropout at %06llx (len=%lld) within a pulse\n",
+                sNext.wp.pos, sNext.wp.len);
+    } else if (sNext.sign==0 || sFirst.sign*sNext.sign != -1) {
         fprintf(stderr,
                 "The halves of the pulse doesn't match"
-                " p=%06lx/l=%ld/s=%d vs p=%06lx/l=%ld/s=%d\n",
-                (long)sFirst.wp.pos, (long)sFirst.wp.len, (int)sFirst.sign,
-                (long)sNext.wp.pos,  (long)sNext.wp.len,  (int)sNext.sign);
+                " p=%06llx/l=%lld/s=%d vs p=%06llx/l=%lld/s=%d\n",
+                (WavOff)sFirst.wp.pos, (WavOff)sFirst.wp.len, (int)sFirst.sign,
+                (WavOff)sNext.wp.pos,  (WavOff)sNext.wp.len,  (int)sNext.sign);
+        StatReject (REJ_HALVES);
         GB.pulse.sta= STA_EOF;
         return EOF;
     }
@@ -665,12 +1844,18 @@ static int PulseRead (void)
     GB.pulse.p.wp.len= sFirst.wp.len + sNext.wp.len;
     GB.pulse.p.len1= sFirst.wp.len;
     GB.pulse.p.len2= sNext.wp.len;
+    if (GB.seq.sta==STA_FILLED) {
+        GB.pulse.p.flen= (long)(GB.seq.s.fx - sFirst.fx);
+    } else {
+        GB.pulse.p.flen= (long)((sNext.wp.pos + sNext.wp.len)*GB.frac - sFirst.fx);
+    }
     GB.pulse.sta= STA_FILLED;
     return 0;
 }
 
 static int PulseReadReset (void)
 {
+    StatBlock ();
     GB.pulse.sta= STA_INIT;
     return PulseRead();
 }
@@ -689,24 +1874,25 @@ static int BitRead_FindSync(void)
 
         sumlen= 0;
         for (i=0; i<leadunit && GB.pulse.sta==STA_FILLED; ++i) {
-    /*      fprintf (stderr,"pulse at %06lx len=%ld\n", GB.pulse.p.pos, GB.pulse.p.len); */
-            sumlen += GB.pulse.p.wp.len;
+    /*      fprintf (stderr,"pulse at %06llx len=%lld\n", GB.pulse.p.pos, GB.pulse.p.len); */
+            sumlen += GB.pulse.p.flen;
             PulseRead();
         }
         if (GB.pulse.sta==STA_EOF) {
             GB.bit.sta= STA_EOF;
             return STA_EOF;
         }
-        headavglen= sumlen/leadunit;
+        headavglen= (double)sumlen/leadunit;
 
         range.minv= floor(headavglen*0.95);
         range.maxv= ceil(headavglen*1.05);
-        fprintf (stderr, "BitRead_FindSync: avg=%g range=[%d,%d]\n", headavglen, range.minv, range.maxv);
+        fprintf (stderr, "BitRead_FindSync: avg=%g range=[%d,%d]\n",
+            headavglen/GB.frac, range.minv, range.maxv);
 
         rngerr= 0;
         for (i=0; i<leadunit && !rngerr && GB.pulse.sta==STA_FILLED; ++i) {
-    /*      fprintf (stderr,"pulse at %06lx len=%ld\n", GB.pulse.p.pos, GB.pulse.p.len); */
-            rngerr= ! IsInInterval (GB.pulse.p.wp.len, &range);
+    /*      fprintf (stderr,"pulse at %06llx len=%lld\n", GB.pulse.p.pos, GB.pulse.p.len); */
+            rngerr= ! IsInInterval (GB.pulse.p.flen, &range);
             if (rngerr) continue;
             PulseRead();
         }
@@ -718,30 +1904,184 @@ static int BitRead_FindSync(void)
     }
     if (!leadfound) {
         fprintf (stderr, "BitRead_FindSync: couldn't find the leader\n");
+        StatReject (REJ_NOLEAD);
         GB.bit.sta= STA_EOF;
         return STA_EOF;
     }
+    GB.leadavg= headavglen;
     CalcIntervals (headavglen);
+    if (opt.autocal) {
+        CalcIntervalsHist (headavglen);
+    }
+    if (opt.matched) {
+        if (MfSync ()) {
+            StatReject (REJ_NOSYNC);
+            GB.bit.sta= STA_EOF;
+            return STA_EOF;
+        }
+        GB.bit.sta= STA_FILLED;
+        return 0;
+    }
     while (GB.pulse.sta != STA_EOF &&
-           IsInInterval (GB.pulse.p.wp.len, &GB.lead)) {
+           IsInInterval (GB.pulse.p.flen, &GB.lead)) {
         PulseRead();
     }
     if (GB.pulse.sta != STA_EOF &&
-           IsInInterval (GB.pulse.p.wp.len, &GB.sync)) {
-        fprintf (stderr, "BitRead_FindSync: found the sync at %06lx-%06lx (len=%d)\n",
-            (long)GB.pulse.p.wp.pos,
-            (long)(GB.pulse.p.wp.pos + GB.pulse.p.wp.len),
+           IsInInterval (GB.pulse.p.flen, &GB.sync)) {
+        fprintf (stderr, "BitRead_FindSync: found the sync at %06llx-%06llx (len=%d)\n",
+            (WavOff)GB.pulse.p.wp.pos,
+            (WavOff)(GB.pulse.p.wp.pos + GB.pulse.p.wp.len),
             (int)GB.pulse.p.wp.len);
+        Annot (GB.pulse.p.wp.pos, "sync");
         GB.bit.sta= STA_FILLED;
         PulseRead();
         return 0;
     } else {
+        StatReject (REJ_NOSYNC);
         GB.bit.sta= STA_EOF;
         return STA_EOF;
     }
 }
 
 static int BitRead (void)
+{
+    int rc;
+
+    if (!StatsOn()) return BitRead1();
+    StatEnter (STG_BIT);
+    rc= BitRead1();
+    if (rc==0) {
+        ++ST.blk.bits;
+    }
+    StatLeave ();
+    return rc;
+}
+
+/* matched filter: the templates are made from the measured leader */
+static void MfStart (void)
+{
+    static const double usec [MF_NUM] = { 388.0, 470.0, 552.0, 736.0 };
+    double sum;
+    int c, n, len;
+
+    for (c=0; c<MF_NUM; ++c) {
+        GB.mf.len [c]= GB.leadavg / GB.frac * usec [c] / 470.0;
+        len= (int)ceil (GB.mf.len [c]);
+        if (len > MF_MAXLEN) len= MF_MAXLEN;
+        for (n=0, sum=0; n<MF_MAXLEN; ++n) {
+            GB.mf.tpl [c][n]= n<len ? (float)sin (2*3.14159265*(n+0.5)/GB.mf.len [c]) : 0.0f;
+            sum += GB.mf.tpl [c][n] * GB.mf.tpl [c][n];
+        }
+        GB.mf.tplnorm [c]= sqrt (sum);
+    }
+    GB.mf.t= (double)GB.pulse.p.wp.pos; /* a pulse of the leader */
+}
+
+/* |correlation| / (|x| * |tpl|) of the signal from 'pos' with template 'c';
+   the dot-products are simple loops over float arrays, vectorized by the compiler */
+static double MfScore (WavOff pos, int c)
+{
+    float x [MF_MAXLEN];
+    float dot, xx;
+    int n, len;
+
+    len= (int)ceil (GB.mf.len [c]);
+    if (len > MF_MAXLEN) len= MF_MAXLEN;
+    for (n=0; n<len; ++n) {
+        x[n]= GB.ring.val [(pos+n) & (RING_SIZE-1)];
+    }
+    for (n=0, dot=0, xx=0; n<len; ++n) {
+        dot += x[n] * GB.mf.tpl [c][n];
+        xx  += x[n] * x[n];
+    }
+    if (xx==0) return 0;
+    return fabs (dot) / (sqrt (xx) * GB.mf.tplnorm [c]);
+}
+
+/* the best of the templates cfrom..cto at GB.mf.t, allowing +-1 sample
+   timing-error (tape speed drift); returns -1 at EOF */
+static int MfBest (int cfrom, int cto, double *pbest, int *pd)
+{
+    WavOff pos, need;
+    double score;
+    int c, bestc, d;
+
+    pos= (WavOff)floor (GB.mf.t + 0.5);
+    need= pos + 1 + (WavOff)ceil (GB.mf.len [cto]);
+    while (GB.wav.sta==STA_FILLED && GB.wav.pos <= need) {
+        WavRead ();
+    }
+    if (GB.wav.pos <= need) return -1;
+    for (c=cfrom, *pbest=-1, bestc=cfrom, *pd=0; c<=cto; ++c) {
+        for (d= -1; d<=1; ++d) {
+            if (pos+d < 0) continue;
+            score= MfScore (pos+d, c);
+            if (score > *pbest) *pbest= score, bestc= c, *pd= d;
+        }
+    }
+    return bestc;
+}
+
+/* steps through the leader until the sync; noisy periods are tolerated */
+#define MF_MAXNOISE 16
+static int MfSync (void)
+{
+    double best;
+    int c, d, noise;
+
+    MfStart ();
+    for (noise= 0; noise <= MF_MAXNOISE; ) {
+        c= MfBest (MF_LEAD, MF_SYNC, &best, &d); /* MF_BIT0 is between them */
+        if (c==-1) return EOF;
+        if (c==MF_SYNC && best >= MF_MINSCORE) {
+            fprintf (stderr, "BitRead_FindSync: matched filter found the sync at %06llx\n",
+                (WavOff)floor (GB.mf.t + d + 0.5));
+            Annot ((WavOff)floor (GB.mf.t + d + 0.5), "sync");
+            GB.mf.t += d + GB.mf.len [MF_SYNC];
+            return 0;
+        }
+        noise= c==MF_LEAD && best >= MF_MINSCORE ? 0 : noise+1;
+        GB.mf.t += d + GB.mf.len [MF_LEAD];
+    }
+    return EOF;
+}
+
+/* lead (or nothing matching) after the bits means the end of the block */
+static int MfBit (void)
+{
+    WavOff pos;
+    double best;
+    int bestc, bestd;
+
+    pos= (WavOff)floor (GB.mf.t + 0.5);
+    bestc= MfBest (MF_BIT1, MF_BIT0, &best, &bestd);
+    if (bestc==-1) {
+        GB.bit.sta= STA_EOF;
+        return EOF;
+    }
+    if (bestc!=MF_LEAD && best < MF_MINSCORE && opt.recover &&
+        ++GB.guess <= REC_MAXGUESS) {
+        fprintf(stderr,
+                "BitRead: matched filter: weak bit at %06llx (score=%.2f) taken as %d\n",
+                pos, best, bestc==MF_BIT1);
+    } else if (bestc==MF_LEAD || best < MF_MINSCORE) {
+        fprintf(stderr,
+                "BitRead: matched filter found no bit at"
+                " %06llx (%s, score=%.2f); reset state\n",
+                pos, bestc==MF_LEAD ? "lead" : "noise", best);
+        StatReject (REJ_NONBIT);
+        GB.bit.sta= STA_EOF;
+        return EOF;
+    }
+    GB.bit.b.wp.pos= pos+bestd;
+    GB.bit.b.wp.len= (WavOff)floor (GB.mf.len [bestc] + 0.5);
+    GB.bit.b.val= bestc==MF_BIT1;
+    GB.mf.t += bestd + GB.mf.len [bestc];
+    if (best >= MF_MINSCORE) GB.guess= 0;
+    return 0;
+}
+
+static int BitRead1 (void)
 {
     if (GB.bit.sta == STA_EOF) return EOF;
     if (GB.pulse.sta==STA_INIT) PulseRead();
@@ -752,6 +2092,11 @@ static int BitRead (void)
     if (GB.bit.sta==STA_INIT) {
         int rc= BitRead_FindSync();
         if (rc) return STA_EOF;
+        if (opt.matched) return MfBit ();
+    } else if (opt.matched) {
+        return MfBit ();
+    } else if (GB.pend) {
+        GB.pend= 0;             /* read ahead by RecLeadOff */
     } else {
         PulseRead();
     }
@@ -759,17 +2104,25 @@ static int BitRead (void)
         GB.bit.sta= STA_EOF;
         return EOF;
     }
-    if (IsInInterval (GB.pulse.p.wp.len, &GB.bit0)) {
+    if (IsInInterval (GB.pulse.p.flen, &GB.bit0)) {
         GB.bit.b.wp= GB.pulse.p.wp;
         GB.bit.b.val= 0;
-    } else if (IsInInterval (GB.pulse.p.wp.len, &GB.bit1)) {
+        GB.guess= 0;
+    } else if (IsInInterval (GB.pulse.p.flen, &GB.bit1)) {
         GB.bit.b.wp= GB.pulse.p.wp;
         GB.bit.b.val= 1;
+        GB.guess= 0;
+    } else if (opt.recover && ++GB.guess <= REC_MAXGUESS && !RecLeadOff ()) {
+        /* taken as the nearer bit, the sector-CRC tells if it was right */
+        fprintf(stderr,
+                "BitRead: non-bit at %06llx (len=%lld) taken as %d\n",
+                GB.bit.b.wp.pos, GB.bit.b.wp.len, GB.bit.b.val);
     } else {
         fprintf(stderr,
                 "BitRead: after valid bits found non-bit at"
-                " %06lx (len=%ld); reset state\n",
+                " %06llx (len=%lld); reset state\n",
                 GB.pulse.p.wp.pos, GB.pulse.p.wp.len);
+        StatReject (REJ_NONBIT);
         GB.bit.sta= STA_EOF;
         return EOF;
     }
@@ -777,14 +2130,50 @@ static int BitRead (void)
     return 0;
 }
 
+/* -recover: the block ends with the lead-off, a single lead-length pulse
+   is rather a damaged bit; the non-bit is put into GB.bit.b unless
+   it is the lead-off (then the pulse-state is as it was) */
+static int RecLeadOff (void)
+{
+    Pulse p= GB.pulse.p;
+
+    if (IsInInterval (p.flen, &GB.lead)) {
+        PulseRead();
+        if (GB.pulse.sta==STA_EOF || IsInInterval (GB.pulse.p.flen, &GB.lead)) {
+            GB.pulse.p= p;
+            return 1;
+        }
+        GB.pend= 1;
+    }
+    GB.bit.b.wp= p.wp;
+    GB.bit.b.val= p.flen < GB.leadavg;
+    return 0;
+}
+
 static int BitReadReset (void)
 {
     GB.bit.sta= STA_INIT;
+    GB.guess= 0;
+    GB.pend= 0;
     PulseReadReset();
     return BitRead();
 }
 
 static int ByteRead (void)
+{
+    int rc;
+
+    if (!StatsOn()) return ByteRead1();
+    StatEnter (STG_BYTE);
+    rc= ByteRead1();
+    if (rc==0) {
+        ++ST.blk.bytes;
+    }
+    StatLeave ();
+    return rc;
+}
+
+static int ByteRead1 (void)
 {
     int nbit= 0;
     int byteval= 0;
@@ -815,8 +2204,8 @@ static int ByteRead (void)
         return 0;
     } else {
         if (nbit != 0) {
-            fprintf (stderr, "ByteRead: incomplete byte read pos=%06lx nbit=%d\n",
-                (long)GB.byte.b.wp.pos, nbit);
+            fprintf (stderr, "ByteRead: incomplete byte read pos=%06llx nbit=%d\n",
+                (WavOff)GB.byte.b.wp.pos, nbit);
         }
         GB.byte.sta= STA_EOF;
         return EOF;
@@ -830,24 +2219,95 @@ static int ByteReadReset (void)
     return ByteRead();
 }
 
-static void DWB_print (size_t psave, size_t nsave, int csave)
+static void RsPush (int bit, WavOff pos)
+{
+    GB.rs.bits [GB.rs.nbits]= (unsigned char)bit;
+    GB.rs.pos  [GB.rs.nbits]= pos;
+    ++GB.rs.nbits;
+}
+
+/* -recover: 'tsh' (just read) is not the header of sector 'from'.
+   The rest of the block is read bit by bit, and the first sector-header
+   from..nsect is searched for at any bit-offset whose sector has a good CRC;
+   GetBytes continues from there. Returns its number, or -1 */
+static int ResyncSect (const TSECTHDR *tsh, int from, int nsect)
+{
+    long cap, k;
+    int s, ss, j;
+    TSECTHDR h;
+    TSECTEND e;
+    unsigned char data [256];
+
+    if (GB.rs.on) {
+        GB.rs.at -= 8 * sizeof (*tsh);  /* it came from here */
+    } else {
+        cap= 8L * ((nsect-from+2) * (sizeof h + 256 + sizeof e));
+        if (cap > GB.rs.cap) {
+            free (GB.rs.bits);
+            free (GB.rs.pos);
+            GB.rs.bits= emalloc (cap);
+            GB.rs.pos= emalloc (cap * sizeof *GB.rs.pos);
+            GB.rs.cap= cap;
+        }
+        GB.rs.on= 1;
+        GB.rs.nbits= GB.rs.at= 0;
+        for (j=0; j<8; ++j) RsPush (tsh->sectno >> j & 1, GB.byte.b.wp.pos);
+        for (j=0; j<8; ++j) RsPush (tsh->size   >> j & 1, GB.byte.b.wp.pos);
+        if (GB.byte.sta==STA_FILLED) {
+            for (j=0; j<8; ++j) RsPush (GB.byte.b.val >> j & 1, GB.byte.b.wp.pos);
+        }
+        while (GB.bit.sta==STA_FILLED && GB.rs.nbits < cap) {
+            RsPush (GB.bit.b.val, GB.bit.b.wp.pos);
+            BitRead ();
+        }
+        GB.byte.sta= STA_EOF;
+    }
+    for (k= GB.rs.at; k + 8L*(long)(sizeof h + 1 + sizeof e) <= GB.rs.nbits; ++k) {
+        s= RsByte (k);
+        if (s < from || s > nsect) continue;
+        h.sectno= s;
+        h.size= RsByte (k+8);
+        if ((ss= h.size)==0) ss= 256;
+        if (k + 8L*(long)(sizeof h + ss + sizeof e) > GB.rs.nbits) continue;
+        for (j=0; j<ss; ++j) data[j]= RsByte (k + 8*(sizeof h + j));
+        e.eof= RsByte (k + 8*(sizeof h + ss));
+        e.crc[0]= RsByte (k + 8*(sizeof h + ss + 1));
+        e.crc[1]= RsByte (k + 8*(sizeof h + ss + 2));
+        if (SectCrcOk (&h, data, ss, &e)) {
+            fprintf (stderr, "%06llx resynchronized: sector %d at bit %+ld\n",
+                GB.rs.pos [k], s, k - GB.rs.at);
+            Annot (GB.rs.pos [k], "resync %d", s);
+            GB.rs.at= k;
+            return s;
+        }
+    }
+    fprintf (stderr, "no sector-header found in the rest of the block\n");
+    return -1;
+}
+
+static void ResyncEnd (void)
+{
+    GB.rs.on= 0;
+}
+
+static void DWB_print (WavOff psave, WavOff nsave, int csave)
 {
     if (nsave==1) {
-        fprintf (stderr,"%06lx: %02x\n",
-                (long)psave,
+        fprintf (stderr,"%06llx: %02x\n",
+                (WavOff)psave,
                 (unsigned char)csave);
     } else {
-        fprintf (stderr,"%06lx= %02x (*%ld)\n",
-                (long)psave,
+        fprintf (stderr,"%06llx= %02x (*%lld)\n",
+                (WavOff)psave,
                 (unsigned char)csave,
-                (long)nsave);
+                (WavOff)nsave);
     }
     fflush(stdout);
 }
 
 static void DumpWavBytes (void)
 {
-    unsigned long psave= 0;
+    WavOff psave= 0;
     int csave= 0;
     int nsave= 0;
 
@@ -881,29 +2341,35 @@ static void DumpSequences (void)
     if (GB.seq.sta == STA_INIT) SeqRead();
 
     while (GB.seq.sta == STA_FILLED) {
-        fprintf (stderr,"%06lx: %c *%ld\n",
-            (long)GB.seq.s.wp.pos,
+        fprintf (stderr,"%06llx: %c *%lld\n",
+            (WavOff)GB.seq.s.wp.pos,
             SignToChar (GB.seq.s.sign),
-            (long)GB.seq.s.wp.len);
+            (WavOff)GB.seq.s.wp.len);
         SeqRead();
     }
 }
 
 static void DP_print (size_t nsave, const Pulse *psave)
 {
-    if (nsave==1) {
-        fprintf (stderr,"%06lx: %ld (%ld+%ld)\n",
-            (long)psave->wp.pos,
-            (long)psave->wp.len,
-            (long)psave->len1,
-            (long)psave->len2);
+    if (GB.frac!=1) {
+        fprintf (stderr,"%06llx: %.2f (%lld+%lld)\n",
+            (WavOff)psave->wp.pos,
+            (double)psave->flen/GB.frac,
+            (WavOff)psave->len1,
+            (WavOff)psave->len2);
+    } else if (nsave==1) {
+        fprintf (stderr,"%06llx: %lld (%lld+%lld)\n",
+            (WavOff)psave->wp.pos,
+            (WavOff)psave->wp.len,
+            (WavOff)psave->len1,
+            (WavOff)psave->len2);
     } else {
-        fprintf (stderr,"%06lx= %ld (%ld+%ld) (*%ld)\n",
-            (long)psave->wp.pos,
-            (long)psave->wp.len,
-            (long)psave->len1,
-            (long)psave->len2,
-            (long)nsave);
+        fprintf (stderr,"%06llx= %lld (%lld+%lld) (*%lld)\n",
+            (WavOff)psave->wp.pos,
+            (WavOff)psave->wp.len,
+            (WavOff)psave->len1,
+            (WavOff)psave->len2,
+            (WavOff)nsave);
     }
     fflush(stdout);
 }
@@ -917,7 +2383,7 @@ static void DumpPulses (void)
 
 ELEJE:
     while (GB.pulse.sta == STA_FILLED) {
-        if (opt.nocache) {
+        if (opt.nocache || GB.frac!=1) {
             DP_print (1, &GB.pulse.p);
         } else {
             if (ncache!=0 &&
@@ -951,7 +2417,7 @@ static void DumpBits (void)
 ELEJE:
     if (GB.bit.sta == STA_INIT) BitRead();
     while (GB.bit.sta==STA_FILLED) {
-        printf("%06lx: %d (len=%ld)\n",
+        printf("%06llx: %d (len=%lld)\n",
             GB.bit.b.wp.pos, GB.bit.b.val, GB.bit.b.wp.len);
         fflush(stdout);
         BitRead ();
@@ -967,7 +2433,7 @@ static void DumpBytes (void)
 ELEJE:
     if (GB.byte.sta == STA_INIT) ByteRead();
     while (GB.byte.sta==STA_FILLED) {
-        printf("%06lx: %02x (len=%ld)\n",
+        printf("%06llx: %02x (len=%lld)\n",
             GB.byte.b.wp.pos, GB.byte.b.val, GB.byte.b.wp.len);
         fflush(stdout);
         ByteRead ();
@@ -977,3 +2443,672 @@ ELEJE:
         goto ELEJE;
     }
 }
+
+static double Now (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/* the time elapsed since the last mark is charged to the innermost stage */
+static void StatCharge (void)
+{
+    double now;
+
+    now= Now();
+    if (ST.depth>0) {
+        ST.blk.time [ST.stack [ST.depth-1]] += now - ST.mark;
+    }
+    ST.mark= now;
+}
+
+static void StatEnter (int stg)
+{
+    StatCharge ();
+    if (ST.depth < (int)(sizeof ST.stack/sizeof ST.stack[0])) {
+        ST.stack [ST.depth++]= stg;
+    }
+}
+
+static void StatLeave (void)
+{
+    StatCharge ();
+    if (ST.depth>0) --ST.depth;
+}
+
+static void StatReject (int rej)
+{
+    ++ST.blk.rejected [rej];
+}
+
+static void StatAdd (Stats *to, const Stats *from)
+{
+    int i;
+
+    to->runs   += from->runs;
+    to->pulses += from->pulses;
+    to->bits   += from->bits;
+    to->bytes  += from->bytes;
+    for (i=0; i<REJ_NUM; ++i) to->rejected [i] += from->rejected [i];
+    for (i=0; i<STG_NUM; ++i) to->time [i] += from->time [i];
+    for (i=0; i<HIST_SIZE; ++i) to->hist [i] += from->hist [i];
+}
+
+static void StatPrintText (const char *title, const Stats *s)
+{
+    int i;
+
+    fprintf (stderr, "stats: %s: runs=%lld pulses=%lld bits=%lld bytes=%lld\n",
+        title, s->runs, s->pulses, s->bits, s->bytes);
+    fprintf (stderr, "stats:   rejected:");
+    for (i=0; i<REJ_NUM; ++i) {
+        fprintf (stderr, " %s=%lu", RejName [i], s->rejected [i]);
+    }
+    fprintf (stderr, "\nstats:   time:");
+    for (i=0; i<STG_NUM; ++i) {
+        fprintf (stderr, " %s=%.6f", StgName [i], s->time [i]);
+    }
+    fprintf (stderr, "\nstats:   hist (len*count):");
+    for (i=0; i<HIST_SIZE; ++i) {
+        if (s->hist [i]) fprintf (stderr, " %d*%lu", i, s->hist [i]);
+    }
+    fprintf (stderr, "\n");
+}
+
+static void StatPrintJson (const Stats *s)
+{
+    int i, n;
+
+    printf ("{\"runs\": %lld, \"pulses\": %lld, \"bits\": %lld, \"bytes\": %lld,"
+            " \"rejected\": {",
+        s->runs, s->pulses, s->bits, s->bytes);
+    for (i=0; i<REJ_NUM; ++i) {
+        printf ("%s\"%s\": %lu", i ? ", " : "", RejName [i], s->rejected [i]);
+    }
+    printf ("}, \"time\": {");
+    for (i=0; i<STG_NUM; ++i) {
+        printf ("%s\"%s\": %.6f", i ? ", " : "", StgName [i], s->time [i]);
+    }
+    printf ("}, \"hist\": {");
+    for (i=0, n=0; i<HIST_SIZE; ++i) {
+        if (s->hist [i]) printf ("%s\"%d\": %lu", n++ ? ", " : "", i, s->hist [i]);
+    }
+    printf ("}}");
+}
+
+/* closes the current block: reports it, and adds it to the totals */
+static void StatBlock (void)
+{
+    char title [64];
+
+    if (!StatsOn()) return;
+    if (ST.blk.pulses!=0) {
+        if (opt.stats==1) {
+            sprintf (title, "block #%d at %06llx", ST.nblk+1, ST.blkpos);
+            StatPrintText (title, &ST.blk);
+        } else if (opt.stats==2) {
+            printf ("%s\n{\"pos\": %lld, \"stats\": ",
+                ST.nblk ? "," : "{\"blocks\": [", ST.blkpos);
+            StatPrintJson (&ST.blk);
+            printf ("}");
+        }
+        ++ST.nblk;
+    }
+    StatAdd (&ST.tot, &ST.blk);
+    memset (&ST.blk, 0, sizeof ST.blk);
+}
+
+static void StatReport (void)
+{
+    double wall;
+
+    if (!opt.stats) return;
+    StatBlock ();
+    wall= Now() - ST.start;
+    if (opt.stats==1) {
+        StatPrintText ("total", &ST.tot);
+        fprintf (stderr, "stats: samples=%lld wall=%.6f samples/s=%.0f\n",
+            GB.wav.pos, wall, wall>0 ? GB.wav.pos/wall : 0.0);
+    } else {
+        printf ("%s],\n\"total\": ", ST.nblk ? "" : "{\"blocks\": [");
+        StatPrintJson (&ST.tot);
+        printf (",\n\"samples\": %lld, \"wall\": %.6f}\n", GB.wav.pos, wall);
+    }
+}
+
+static void *DivThread (void *arg)
+{
+    Div= arg;
+    GB.chan= Div->chan;
+    if (setjmp (Div->stop)==0) {
+        WavOpen (Div->fname);
+        Div->rate= GB.fh.rate;
+        DecodeTape ();
+    } else {
+        Div->stopped= 1;
+    }
+    Div->cur= NULL;     /* partial file (GetBytes failed): it is kept as it is */
+    if (GB.wfile) WavClose ();
+    if (opt.stats) {
+        static pthread_mutex_t mx= PTHREAD_MUTEX_INITIALIZER;
+
+        pthread_mutex_lock (&mx);
+        fprintf (stderr, "stats: channel %d\n", Div->chan);
+        StatReport ();
+        pthread_mutex_unlock (&mx);
+    }
+    ThreadFree ();
+    return NULL;
+}
+
+/* the same file in the other channel: same name, found at about the same time */
+static DivFile *DivPair (DivFile *df, DivFile *list, WavOff tol)
+{
+    for (; list; list= list->next) {
+        if (list->namelen==df->namelen &&
+            memcmp (list->name, df->name, df->namelen)==0 &&
+            llabs (list->pos - df->pos) <= tol) return list;
+    }
+    return NULL;
+}
+
+/* prefers a sector with good CRC, then a sector read at all, then channel 0 */
+static const DivSect *DivChoose (const DivFile *f0, const DivFile *f1, int i, int *from)
+{
+    const DivSect *s0= f0 ? &f0->sect[i] : NULL;
+    const DivSect *s1= f1 ? &f1->sect[i] : NULL;
+
+    *from= 0;
+    if (s0 && s0->len>=0 && s0->crcok) return s0;
+    if (s1 && s1->len>=0 && s1->crcok) { *from= 1; return s1; }
+    if (s0 && s0->len>=0) return s0;
+    if (s1 && s1->len>=0) { *from= 1; return s1; }
+    return NULL;
+}
+
+static void MergeDiv (DivFile *f0, DivFile *f1)
+{
+    const DivFile *f= f0 ? f0 : f1;
+    const DivSect *ds;
+    int nsect, i, from, bad;
+
+    nsect= f0 ? f0->nsect : 0;
+    if (f1 && f1->nsect > nsect) nsect= f1->nsect;
+
+    for (i=0, bad=0; i<=nsect; ++i) {
+        ds= DivChoose (f0, f1, i, &from);
+        if (!ds) {
+            fprintf (stderr, "diversity: \"%.*s\": sector %d is missing, dropped\n",
+                f->namelen, f->name, i);
+            return;
+        }
+        if (!ds->crcok) ++bad;
+        if (opt.debug>=1 || from!=0) {
+            fprintf (stderr, "diversity: \"%.*s\": sector %d from channel %d%s\n",
+                f->namelen, f->name, i, from, ds->crcok ? "" : " (CRC error)");
+        }
+    }
+    if (!((f0 && f0->complete) || (f1 && f1->complete))) {
+        fprintf (stderr, "diversity: \"%.*s\": incomplete in both channels, dropped\n",
+            f->namelen, f->name);
+        return;
+    }
+    StartCas (f->namelen, f->name);
+    for (i=0; i<=nsect; ++i) {
+        ds= DivChoose (f0, f1, i, &from);
+        WriteCas (ds->len, ds->data);
+    }
+    CloseCas ();
+    fprintf (stderr, "diversity: \"%.*s\": %d sectors written, %d with CRC error\n",
+        f->namelen, f->name, nsect+1, bad);
+}
+
+/* returns the exit code: 12 if a channel was cut short (GetBytes failed) */
+static int Diversity (const char *name)
+{
+    static DivChan dc [2];
+    DivFile *f0, *f1, *p;
+    WavOff tol;
+    int c, rc;
+
+    if (strcmp (name, "-")==0) {
+        fprintf (stderr, "-diversity reads the file twice, stdin can't be used\n");
+        exit (8);
+    }
+    /* the file and its header are checked here, where the errors exit;
+       in the threads they would only end the channel */
+    GB.chan= 0;
+    GB.wfile= efopen (name, "rb");
+    WavParseHeader ();
+    WavClose ();
+    if (GB.fh.channels < 2) {
+        fprintf (stderr, "-diversity needs a stereo WAV-file (channels=%u)\n",
+            GB.fh.channels);
+        exit (16);
+    }
+    for (c=0; c<2; ++c) {
+        dc[c].fname= name;
+        dc[c].chan= c;
+        dc[c].files= NULL;
+        dc[c].tail= &dc[c].files;
+        dc[c].stopped= 0;
+        if (pthread_create (&dc[c].thread, NULL, DivThread, &dc[c])) {
+            fprintf (stderr, "pthread_create failed\n");
+            exit (33);
+        }
+    }
+    rc= 0;
+    for (c=0; c<2; ++c) {
+        pthread_join (dc[c].thread, NULL);
+        if (dc[c].stopped) {
+            fprintf (stderr, "diversity: channel %d was cut short\n", c);
+            rc= 12;
+        }
+    }
+
+    tol= dc[0].rate ? (WavOff)dc[0].rate : 65536; /* one second */
+    f0= dc[0].files;
+    f1= dc[1].files;
+    while (f0 || f1) {
+        if (f0 && (p= DivPair (f0, f1, tol)) != NULL) {
+            while (f1 != p) {     /* found only in channel 1 */
+                MergeDiv (NULL, f1);
+                f1= f1->next;
+            }
+            MergeDiv (f0, f1);
+            f0= f0->next;
+            f1= f1->next;
+        } else if (f0 && (!f1 || f0->pos <= f1->pos)) {
+            MergeDiv (f0, NULL);
+            f0= f0->next;
+        } else {
+            MergeDiv (NULL, f1);
+            f1= f1->next;
+        }
+    }
+    return rc;
+}
+
+/* -batch: the captures are taken by the workers in the order of the list;
+   each capture gets its own directory under opt.outdir (made in advance,
+   <base>-1 etc. if the name is taken), and a line in the summary (stdout) */
+static BatchJob *BatchList;
+static int BatchN, BatchNext;
+static pthread_mutex_t BatchMx= PTHREAD_MUTEX_INITIALIZER;
+
+static void *BatchThread (void *arg)
+{
+    BatchJob *job;
+    double start;
+
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock (&BatchMx);
+        job= BatchNext < BatchN ? &BatchList [BatchNext++] : NULL;
+        pthread_mutex_unlock (&BatchMx);
+        if (!job) break;
+
+        Job= job;
+        GB.chan= opt.chan;
+        GB.wav.pos= 0;
+        start= Now ();
+        fprintf (stderr, "batch: %s -> %s\n", job->fname, job->outdir);
+        if (setjmp (job->stop)==0) {
+            WavOpen (job->fname);
+            DecodeTape ();
+        } else {
+            job->failed= 1;
+            Recover= NULL;
+            if (CasState) {     /* cut short: kept as it is */
+                ++job->partial;
+                CloseCas ();
+            }
+        }
+        job->samples= GB.wav.pos;
+        job->time= Now () - start;
+        if (GB.wfile) WavClose ();
+        Job= NULL;
+    }
+    ThreadFree ();
+    return NULL;
+}
+
+static void BatchAdd (const char *fname, int *max)
+{
+    if (BatchN == *max) {
+        *max= *max ? 2 * *max : 64;
+        BatchList= realloc (BatchList, *max * sizeof *BatchList);
+        if (!BatchList) {
+            fprintf (stderr, "Out of memory\n");
+            exit (33);
+        }
+    }
+    memset (&BatchList [BatchN], 0, sizeof *BatchList);
+    BatchList [BatchN].fname= strcpy (emalloc (strlen (fname)+1), fname);
+    ++BatchN;
+}
+
+static int BatchCmp (const void *p1, const void *p2)
+{
+    return strcmp (((const BatchJob *)p1)->fname, ((const BatchJob *)p2)->fname);
+}
+
+/* the *.wav files of a directory, or the lines of a list ("-" is stdin) */
+static void BatchCollect (const char *name)
+{
+    struct stat st;
+    DIR *d;
+    struct dirent *de;
+    FILE *f;
+    char line [FILENAME_MAX+2];
+    size_t len;
+    int max= 0, c;
+
+    if (strcmp (name, "-")!=0 && stat (name, &st)==0 && S_ISDIR (st.st_mode)) {
+        if ((d= opendir (name))==NULL) {
+            fprintf (stderr, "Error opening directory '%s': %s\n", name, strerror (errno));
+            exit (32);
+        }
+        while ((de= readdir (d)) != NULL) {
+            len= strlen (de->d_name);
+            if (len<=4 || strcasecmp (de->d_name+len-4, ".wav")!=0) continue;
+            if (snprintf (line, sizeof line, "%s/%s", name, de->d_name) >= (int)sizeof line) {
+                fprintf (stderr, "batch: %s/%s: the path is too long, skipped\n",
+                    name, de->d_name);
+                continue;
+            }
+            BatchAdd (line, &max);
+        }
+        closedir (d);
+        qsort (BatchList, BatchN, sizeof *BatchList, BatchCmp);
+        return;
+    }
+    f= strcmp (name, "-")==0 ? stdin : efopen (name, "r");
+    while (fgets (line, sizeof line, f)) {
+        len= strlen (line);
+        if (len==sizeof line-1 && line[len-1]!='\n') {
+            fprintf (stderr, "batch: %.40s...: the path is too long, skipped\n", line);
+            while ((c= getc (f)) != EOF && c!='\n') ;
+            continue;
+        }
+        while (len && (line[len-1]=='\n' || line[len-1]=='\r')) line[--len]= 0;
+        if (len==0 || line[0]=='#') continue;
+        BatchAdd (line, &max);
+    }
+    if (f != stdin) fclose (f);
+}
+
+/* <outdir>/<base of the capture>, with -1, -2... if it exists */
+static char *BatchDir (const char *fname)
+{
+    const char *base, *dot;
+    char *dir;
+    size_t len, size;
+    int n;
+
+    base= strrchr (fname, '/');
+    base= base ? base+1 : fname;
+    dot= strrchr (base, '.');
+    len= dot && dot!=base ? (size_t)(dot-base) : strlen (base);
+    size= strlen (opt.outdir)+1+len+12;
+    dir= emalloc (size);
+    for (n=0; ; ++n) {
+        snprintf (dir, size, "%s/%.*s", opt.outdir, (int)len, base);
+        if (n) sprintf (dir+strlen (dir), "-%d", n);
+        if (mkdir (dir, 0777)==0) return dir;
+        if (errno != EEXIST) {
+            fprintf (stderr, "Error creating directory '%s': %s\n", dir, strerror (errno));
+            exit (32);
+        }
+    }
+}
+
+/* JSON-string: the file names may contain anything */
+static void BatchPutStr (const char *s)
+{
+    putchar ('"');
+    for (; *s; ++s) {
+        if (*s=='"' || *s=='\\') printf ("\\%c", *s);
+        else if ((unsigned char)*s < 0x20) printf ("\\u%04x", *s);
+        else putchar (*s);
+    }
+    putchar ('"');
+}
+
+/* returns the exit code: 12 if a capture failed (the summary tells which) */
+static int Batch (const char *name)
+{
+    pthread_t *th;
+    BatchJob *j, tot;
+    double start, wall;
+    int i, n;
+
+    if (opt.diversity || opt.action) {
+        fprintf (stderr, "-batch only decodes, one channel\n");
+        exit (8);
+    }
+    opt.stats= opt.autocal= 0;  /* the summary reports instead */
+    BatchCollect (name);
+    mkdir (opt.outdir, 0777);
+    for (i=0; i<BatchN; ++i) {
+        BatchList[i].outdir= BatchDir (BatchList[i].fname);
+    }
+
+    n= opt.jobs;
+    if (n<=0) n= (int)sysconf (_SC_NPROCESSORS_ONLN);
+    if (n<=0) n= 1;
+    if (n > BatchN) n= BatchN;
+    th= emalloc ((n ? n : 1) * sizeof *th);
+    start= Now ();
+    for (i=0; i<n; ++i) {
+        if (pthread_create (&th[i], NULL, BatchThread, NULL)) {
+            fprintf (stderr, "pthread_create failed\n");
+            exit (33);
+        }
+    }
+    for (i=0; i<n; ++i) {
+        pthread_join (th[i], NULL);
+    }
+    wall= Now () - start;
+
+    memset (&tot, 0, sizeof tot);
+    printf ("{\"captures\": [");
+    for (i=0; i<BatchN; ++i) {
+        j= &BatchList [i];
+        printf ("%s\n{\"file\": ", i ? "," : "");
+        BatchPutStr (j->fname);
+        printf (", \"outdir\": ");
+        BatchPutStr (j->outdir);
+        printf (", \"failed\": %d, \"programs\": %d, \"partial\": %d,"
+                " \"sectors_ok\": %ld, \"sectors_failed\": %ld,"
+                " \"samples\": %lld, \"time\": %.6f, \"samples_per_s\": %.0f}",
+            j->failed, j->programs, j->partial, j->sectok, j->sectbad,
+            j->samples, j->time, j->time>0 ? j->samples/j->time : 0.0);
+        tot.failed += j->failed;
+        tot.programs += j->programs;
+        tot.partial += j->partial;
+        tot.sectok += j->sectok;
+        tot.sectbad += j->sectbad;
+        tot.samples += j->samples;
+    }
+    printf ("],\n\"total\": {\"captures\": %d, \"failed\": %d, \"programs\": %d,"
+            " \"partial\": %d, \"sectors_ok\": %ld, \"sectors_failed\": %ld,"
+            " \"samples\": %lld, \"jobs\": %d, \"wall\": %.6f, \"samples_per_s\": %.0f}}\n",
+        BatchN, tot.failed, tot.programs, tot.partial, tot.sectok, tot.sectbad,
+        tot.samples, n, wall, wall>0 ? tot.samples/wall : 0.0);
+    return tot.failed ? 12 : 0;
+}
+
+/* -overview=FILE: min/max pyramid of the signal (the front-end output,
+   8 bit signed) made while reading, with the events of the decoding;
+   all numbers little endian:
+
+     0  "WAVOVW1" and a zero byte
+     8  u32 sample-rate
+    12  u32 samples per bucket at level 0 (OVW_BASE), doubled level by level
+    16  u64 samples
+    24  u32 number of levels (the last one has a single bucket)
+    28  u32 0
+    32  u64 offset, u64 length of the events
+    48  OVW_MAXLEVEL * (u64 offset, u64 number of buckets)
+   560  the buckets of level 0, 1...: s8 min, s8 max
+        the events: text lines "<sample> <event> [<details>]"
+
+   Level 0 is written while reading; at the end each of the others is
+   made from the one below it, read back from the file in chunks. */
+#define OVW_BASE     64
+#define OVW_MAXLEVEL 32
+#define OVW_HDRSIZE  (48 + 16*OVW_MAXLEVEL)
+#define OVW_CHUNK    4096    /* buckets of the level below, even */
+
+static struct {
+    FILE *f;
+    char *name;
+    long long samples, n0;
+    int cnt, min, max;       /* the current bucket of level 0 */
+    char *ev;                /* events */
+    size_t evlen, evmax;
+} Ovw;
+
+static void OvwPut (unsigned long long val, int n)
+{
+    for (; n>0; --n, val >>= 8) putc ((int)(val & 0xff), Ovw.f);
+}
+
+static void OvwOpen (const char *name)
+{
+    int i;
+
+    Ovw.f= efopen (name, "w+b");
+    Ovw.name= strcpy (emalloc (strlen (name)+1), name);
+    for (i=0; i<OVW_HDRSIZE; ++i) putc (0, Ovw.f);
+}
+
+static void OvwBucket (void)
+{
+    putc ((unsigned char)(signed char)Ovw.min, Ovw.f);
+    putc ((unsigned char)(signed char)Ovw.max, Ovw.f);
+    ++Ovw.n0;
+    Ovw.cnt= 0;
+}
+
+/* appends the level above the 'n' buckets at 'from' to the file at 'to':
+   a bucket is the union of two, an unpaired one is kept as it is;
+   returns the number of buckets, or -1 if the level below can't be read */
+static long long OvwLevelUp (off_t from, long long n, off_t to)
+{
+    signed char in [2*OVW_CHUNK], out [OVW_CHUNK];
+    long long done;
+    size_t m, i;
+
+    for (done=0; done<n; done += m) {
+        m= n-done < OVW_CHUNK ? (size_t)(n-done) : OVW_CHUNK;
+        if (fseeko (Ovw.f, from + 2*done, SEEK_SET) ||
+            fread (in, 2, m, Ovw.f) != m) return -1;
+        for (i=0; i<m; i+=2) {
+            out[i]= in[2*i];
+            out[i+1]= in[2*i+1];
+            if (i+1 < m) {
+                if (in[2*i+2] < out[i])   out[i]= in[2*i+2];
+                if (in[2*i+3] > out[i+1]) out[i+1]= in[2*i+3];
+            }
+        }
+        fseeko (Ovw.f, to, SEEK_SET);
+        fwrite (out, 2, (m+1)/2, Ovw.f);
+        to += 2*((m+1)/2);
+    }
+    return (n+1)/2;
+}
+
+static void OvwAdd (const short *val, size_t n)
+{
+    size_t i;
+    int v;
+
+    if (!Ovw.f) return;
+    for (i=0; i<n; ++i) {
+        v= val[i] >> 8;
+        if (Ovw.cnt==0) {
+            Ovw.min= Ovw.max= v;
+        } else if (v < Ovw.min) {
+            Ovw.min= v;
+        } else if (v > Ovw.max) {
+            Ovw.max= v;
+        }
+        if (++Ovw.cnt == OVW_BASE) OvwBucket ();
+    }
+    Ovw.samples += n;
+}
+
+static void Annot (WavOff pos, const char *fmt, ...)
+{
+    va_list ap;
+    char line [128];
+    int len;
+
+    if (!Ovw.f) return;
+    len= sprintf (line, "%lld ", pos);
+    va_start (ap, fmt);
+    len += vsnprintf (line+len, sizeof line - len - 1, fmt, ap);
+    va_end (ap);
+    if (len > (int)sizeof line - 2) len= sizeof line - 2;
+    line [len++]= '\n';
+    if (Ovw.evlen + len > Ovw.evmax) {
+        Ovw.evmax= Ovw.evmax ? 2*Ovw.evmax : 4096;
+        Ovw.ev= realloc (Ovw.ev, Ovw.evmax);
+        if (!Ovw.ev) {
+            fprintf (stderr, "Out of memory\n");
+            exit (33);
+        }
+    }
+    memcpy (Ovw.ev + Ovw.evlen, line, len);
+    Ovw.evlen += len;
+}
+
+/* at exit: the rest of the file is read (the decoding may have stopped
+   early), the partial bucket closed, the levels and the header written */
+static void OvwClose (void)
+{
+    off_t off [OVW_MAXLEVEL], evoff;
+    long long cnt [OVW_MAXLEVEL];
+    int k, nlevel;
+
+    if (!Ovw.f) return;
+    if (GB.wfile) {
+        while (WavFill () > 0) ;
+    }
+    if (Ovw.cnt) OvwBucket ();
+    off [0]= OVW_HDRSIZE;
+    cnt [0]= Ovw.n0;
+    for (nlevel=1; cnt[nlevel-1]>1 && nlevel<OVW_MAXLEVEL; ++nlevel) {
+        off [nlevel]= off [nlevel-1] + 2*cnt [nlevel-1];
+        cnt [nlevel]= OvwLevelUp (off [nlevel-1], cnt [nlevel-1], off [nlevel]);
+        if (cnt [nlevel] < 0) {
+            fprintf (stderr, "Error reading back '%s'\n", Ovw.name);
+            exit (32);
+        }
+    }
+    evoff= off [nlevel-1] + 2*cnt [nlevel-1];
+    fseeko (Ovw.f, evoff, SEEK_SET);
+    fwrite (Ovw.ev, 1, Ovw.evlen, Ovw.f);
+
+    fseek (Ovw.f, 0, SEEK_SET);
+    fwrite ("WAVOVW1", 1, 8, Ovw.f);
+    OvwPut (GB.fh.rate, 4);
+    OvwPut (OVW_BASE, 4);
+    OvwPut (Ovw.samples, 8);
+    OvwPut (nlevel, 4);
+    OvwPut (0, 4);
+    OvwPut (evoff, 8);
+    OvwPut (Ovw.evlen, 8);
+    for (k=0; k<nlevel; ++k) {
+        OvwPut (off[k], 8);
+        OvwPut (cnt[k], 8);
+    }
+    if (fclose (Ovw.f)) {
+        fprintf (stderr, "Error writing '%s'\n", Ovw.name);
+    }
+    Ovw.f= NULL;
+}